@@ -0,0 +1,145 @@
+#pragma once
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Alignment of all tensor storage: one cache line, enough for aligned AVX-512 loads.
+inline constexpr size_t kTensorAlignment = 64;
+
+inline constexpr size_t alignUp(size_t bytes, size_t alignment = kTensorAlignment) {
+    return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+// An allocator policy hands out kTensorAlignment-aligned raw storage through static
+// functions, so tensors stay as small as before and copies need no allocator state.
+template<typename A>
+concept AllocatorPolicy = requires(void* p, size_t bytes) {
+    { A::allocate(bytes) } -> std::same_as<void*>;
+    A::deallocate(p, bytes);
+};
+
+// Plain aligned heap allocation. This is the default policy.
+struct HeapAllocator {
+    static void* allocate(size_t bytes) {
+        return ::operator new(alignUp(bytes), std::align_val_t(kTensorAlignment));
+    }
+    static void deallocate(void* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(kTensorAlignment));
+    }
+};
+
+// Bump allocator over large aligned chunks. Individual frees are no-ops; memory is
+// recycled in bulk by rewinding to a mark (see ArenaScope) or by reset().
+class Arena {
+public:
+    struct Mark { size_t chunk, offset; };
+
+    explicit Arena(size_t chunkBytes = size_t(4) << 20) : chunkBytes_(alignUp(chunkBytes)) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        for (auto& c : chunks_)
+            HeapAllocator::deallocate(c.base, c.size);
+    }
+
+    void* allocate(size_t bytes) {
+        bytes = alignUp(bytes);
+        while (current_ < chunks_.size()) {
+            Chunk& c = chunks_[current_];
+            if (offset_ + bytes <= c.size) {
+                void* p = c.base + offset_;
+                offset_ += bytes;
+                return p;
+            }
+            ++current_;
+            offset_ = 0;
+        }
+        size_t size = bytes > chunkBytes_ ? bytes : chunkBytes_;
+        chunks_.push_back({ static_cast<std::byte*>(HeapAllocator::allocate(size)), size });
+        current_ = chunks_.size() - 1;
+        offset_ = bytes;
+        return chunks_.back().base;
+    }
+
+    Mark mark() const { return { current_, offset_ }; }
+    // Everything allocated after m becomes invalid; the chunks themselves are kept.
+    void rewind(const Mark& m) { current_ = m.chunk; offset_ = m.offset; }
+    void reset() { rewind({ 0, 0 }); }
+
+private:
+    struct Chunk { std::byte* base; size_t size; };
+    size_t chunkBytes_;
+    std::vector<Chunk> chunks_;
+    size_t current_ = 0, offset_ = 0;
+};
+
+// Policy that allocates from a per-thread arena. Tensors using it must not outlive
+// the enclosing ArenaScope.
+struct ArenaAllocator {
+    static Arena& arena() {
+        thread_local Arena a;
+        return a;
+    }
+    static void* allocate(size_t bytes) { return arena().allocate(bytes); }
+    static void deallocate(void*, size_t) noexcept {}
+};
+
+// Rewinds the calling thread's arena on scope exit, e.g. once per training step.
+class ArenaScope {
+public:
+    ArenaScope() : mark_(ArenaAllocator::arena().mark()) {}
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+    ~ArenaScope() { ArenaAllocator::arena().rewind(mark_); }
+private:
+    Arena::Mark mark_;
+};
+
+// Size-class pool: requests are rounded up to a power of two between 64 B and 64 MiB
+// and recycled through per-thread free lists. Larger blocks go straight to the heap.
+struct PoolAllocator {
+    static constexpr size_t kMinClassBytes = 64;
+    static constexpr size_t kNumClasses = 21;  // 64 B .. 64 MiB
+
+    static void* allocate(size_t bytes) {
+        size_t cls = sizeClass(bytes);
+        if (cls >= kNumClasses)
+            return HeapAllocator::allocate(bytes);
+        auto& list = freeLists().lists[cls];
+        if (!list.empty()) {
+            void* p = list.back();
+            list.pop_back();
+            return p;
+        }
+        return HeapAllocator::allocate(kMinClassBytes << cls);
+    }
+    static void deallocate(void* p, size_t bytes) {
+        size_t cls = sizeClass(bytes);
+        if (cls >= kNumClasses)
+            HeapAllocator::deallocate(p, bytes);
+        else
+            freeLists().lists[cls].push_back(p);
+    }
+
+private:
+    static size_t sizeClass(size_t bytes) {
+        size_t cls = 0;
+        for (size_t cap = kMinClassBytes; cap < bytes; cap <<= 1)
+            ++cls;
+        return cls;
+    }
+    struct FreeLists {
+        std::array<std::vector<void*>, kNumClasses> lists;
+        ~FreeLists() {
+            for (auto& list : lists)
+                for (void* p : list)
+                    HeapAllocator::deallocate(p, 0);
+        }
+    };
+    static FreeLists& freeLists() {
+        thread_local FreeLists f;
+        return f;
+    }
+};
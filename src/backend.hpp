@@ -0,0 +1,539 @@
+#pragma once
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dispatch.hpp"
+#include "gemm.hpp"
+#include "sparse.hpp"
+
+// Dense matrices and bias rows of a layer's scalar type.
+template<typename T>
+using MatrixX = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+template<typename T>
+using RowVectorX = Eigen::Matrix<T, 1, Eigen::Dynamic>;
+
+// Compute backends: the primitives the layers are built from, behind one interface so
+// an implementation can be picked at runtime (nn_trainer --backend=...) to A/B-test
+// performance or check results against a reference on any host.
+//   naive      plain loops, the reference
+//   eigen      Eigen expressions
+//   optimized  the in-tree kernels (gemm.hpp and the dispatched SIMD kernels)
+// Matrices are column-major with a leading dimension ld unless an operand says otherwise.
+template<typename T>
+class Backend {
+public:
+    virtual ~Backend() = default;
+    virtual const char* name() const = 0;
+
+    // C = alpha * A * B + beta * C, with C (A.rows x B.cols) at C[i * rsC + j * csC].
+    virtual void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                      T alpha, T beta) const = 0;
+    // The same for pre-packed B followed by the epilogue (see gemm.hpp), and
+    // C = alpha * A * B^T + beta * C, zeroed where a non-null gate (laid out like C) is not
+    // positive: a layer's input gradient through the ReLU whose output is gate.
+    virtual void gemmPacked(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC,
+                            ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue) const = 0;
+    // B may also be a bf16 copy of the weights, accumulated in T (mixed precision).
+    virtual void gemmPacked(const GemmOperand<T>& A, const PackedPanels<Eigen::bfloat16>& B, T* C, ptrdiff_t rsC,
+                            ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue) const = 0;
+    virtual void gemmPackedTransposed(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC,
+                                      ptrdiff_t csC, T alpha, T beta, const T* gate) const = 0;
+    // gemmPacked specialized for B of exactly n columns (column-contiguous A, C column-major
+    // with column stride ldc), or null if the backend has none for that width. For callers
+    // that know their width at compile time, see StaticDense.
+    virtual dispatch::NarrowGemm<T> narrowGemmPacked(size_t n) const = 0;
+    // Sparse layer inputs (CSR, see sparse.hpp): C (X.rows x B.cols, ld ldc) = X * B for
+    // pre-packed B, followed by the epilogue, and out (row-major, count x n) = the rows of
+    // X * G listed in rows, for G of X.cols x n with leading dimension ldg.
+    virtual void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<T>& B, T* C, size_t ldc,
+                                  const GemmEpilogue<T>& epilogue) const = 0;
+    virtual void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<Eigen::bfloat16>& B, T* C, size_t ldc,
+                                  const GemmEpilogue<T>& epilogue) const = 0;
+    virtual void sparseGemmRows(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg,
+                                size_t n, T* out) const = 0;
+    // out[i, j] += bias[j].
+    virtual void biasAdd(T* out, const T* bias, size_t rows, size_t cols, size_t ld) const = 0;
+    // out = max(in, 0) and out = grad * (act > 0) over n elements.
+    virtual void relu(const T* in, T* out, size_t n) const = 0;
+    virtual void reluBackward(const T* grad, const T* act, T* out, size_t n) const = 0;
+    // Row-wise softmax.
+    virtual void softmaxRows(const T* in, T* out, size_t rows, size_t cols, size_t ld) const = 0;
+    // sums[j] = sum_i m[i, j].
+    virtual void columnSums(const T* m, size_t rows, size_t cols, size_t ld, T* sums) const = 0;
+    // Cross-entropy from logits in one pass: returns -sum(label * log(softmaxRows(logits))) and sets
+    // grad = scale * (softmaxRows(logits) - label).
+    virtual T softmaxCrossEntropy(const T* logits, const T* label, T* grad, size_t rows, size_t cols, size_t ld,
+                                  T scale) const = 0;
+};
+
+namespace backend_detail {
+
+// Element (i, j) of a pre-packed operand, as T.
+template<typename T, typename S>
+T packedAt(const PackedPanels<S>& B, size_t i, size_t j) {
+    const auto* data = gemm_detail::raw(B.data);
+    return gemm_detail::widen<T>(
+        data[(j / kPackedPanelWidth) * B.panelStride + i * kPackedPanelWidth + j % kPackedPanelWidth]);
+}
+
+template<typename T>
+T operandAt(const GemmOperand<T>& A, size_t i, size_t j) {
+    return A.data[static_cast<ptrdiff_t>(i) * A.rs + static_cast<ptrdiff_t>(j) * A.cs];
+}
+
+template<typename T>
+void scaleInto(T& c, T acc, T alpha, T beta) {
+    c = beta != T(0) ? alpha * acc + beta * c : alpha * acc;
+}
+
+template<typename T>
+using Mat = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+template<typename T>
+using StridedMap = Eigen::Map<Mat<T>, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+template<typename T>
+using ConstStridedMap = Eigen::Map<const Mat<T>, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+template<typename T>
+using ColMap = Eigen::Map<Mat<T>, 0, Eigen::OuterStride<>>;
+template<typename T>
+using ConstColMap = Eigen::Map<const Mat<T>, 0, Eigen::OuterStride<>>;
+
+template<typename T>
+using RowMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<>>;
+template<typename T>
+using ConstRowMap =
+    Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<>>;
+
+// Calls fn with the operand as an Eigen map: column- or row-major with an outer stride
+// when one dimension is contiguous (so Eigen's own blocked product applies), otherwise
+// a generic strided map.
+template<typename T, typename Fn>
+void withMap(const T* data, size_t rows, size_t cols, ptrdiff_t rs, ptrdiff_t cs, Fn&& fn) {
+    const Eigen::Index r = static_cast<Eigen::Index>(rows), c = static_cast<Eigen::Index>(cols);
+    if (rs == 1)
+        fn(ConstColMap<T>(data, r, c, Eigen::OuterStride<>(cs)));
+    else if (cs == 1)
+        fn(ConstRowMap<T>(data, r, c, Eigen::OuterStride<>(rs)));
+    else
+        fn(ConstStridedMap<T>(data, r, c, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(cs, rs)));
+}
+
+template<typename T, typename Fn>
+void withMap(T* data, size_t rows, size_t cols, ptrdiff_t rs, ptrdiff_t cs, Fn&& fn) {
+    const Eigen::Index r = static_cast<Eigen::Index>(rows), c = static_cast<Eigen::Index>(cols);
+    if (rs == 1)
+        fn(ColMap<T>(data, r, c, Eigen::OuterStride<>(cs)));
+    else if (cs == 1)
+        fn(RowMap<T>(data, r, c, Eigen::OuterStride<>(rs)));
+    else
+        fn(StridedMap<T>(data, r, c, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(cs, rs)));
+}
+
+// Calls fn with a CSR view as an Eigen sparse map (which wants int row offsets).
+template<typename T, typename Fn>
+void withSparseMap(const SparseRows<T>& X, Fn&& fn) {
+    thread_local std::vector<int32_t> outer;
+    outer.assign(X.rowPtr, X.rowPtr + X.rows + 1);
+    fn(Eigen::Map<const Eigen::SparseMatrix<T, Eigen::RowMajor, int32_t>>(
+        static_cast<Eigen::Index>(X.rows), static_cast<Eigen::Index>(X.cols), outer.back(), outer.data(), X.colIdx,
+        X.values));
+}
+
+// C = alpha * product + beta * C for an Eigen product expression.
+template<typename Dst, typename Product, typename T>
+void assignScaled(Dst&& C, const Product& product, T alpha, T beta) {
+    if (beta == T(0)) {
+        C.noalias() = alpha * product;
+    } else {
+        C *= beta;
+        C.noalias() += alpha * product;
+    }
+}
+
+} // namespace backend_detail
+
+template<typename T>
+class NaiveBackend : public Backend<T> {
+public:
+    const char* name() const override { return "naive"; }
+
+    void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+              T alpha, T beta) const override {
+        using namespace backend_detail;
+        for (size_t i = 0; i < A.rows; ++i)
+            for (size_t j = 0; j < B.cols; ++j) {
+                T acc = T(0);
+                for (size_t k = 0; k < A.cols; ++k)
+                    acc += operandAt(A, i, k) * operandAt(B, k, j);
+                scaleInto(C[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC], acc, alpha, beta);
+            }
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                    T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        packedProduct(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<Eigen::bfloat16>& B, T* C, ptrdiff_t rsC,
+                    ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        packedProduct(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPackedTransposed(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC,
+                              ptrdiff_t csC, T alpha, T beta, const T* gate) const override {
+        using namespace backend_detail;
+        for (size_t i = 0; i < A.rows; ++i)
+            for (size_t j = 0; j < B.rows; ++j) {
+                T acc = T(0);
+                for (size_t k = 0; k < A.cols; ++k)
+                    acc += operandAt(A, i, k) * packedAt<T>(B, j, k);
+                const ptrdiff_t o = static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC;
+                scaleInto(C[o], acc, alpha, beta);
+                if (gate && !(gate[o] > T(0)))
+                    C[o] = T(0);
+            }
+    }
+    dispatch::NarrowGemm<T> narrowGemmPacked(size_t) const override { return nullptr; }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<T>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        sparsePackedProduct(X, B, C, ldc, epilogue);
+    }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<Eigen::bfloat16>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        sparsePackedProduct(X, B, C, ldc, epilogue);
+    }
+    void sparseGemmRows(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg, size_t n,
+                        T* out) const override {
+        for (size_t i = 0; i < count; ++i)
+            for (size_t j = 0; j < n; ++j) {
+                T acc = T(0);
+                for (size_t e = X.rowPtr[rows[i]]; e < X.rowPtr[rows[i] + 1]; ++e)
+                    acc += X.values[e] * G[j * ldg + static_cast<size_t>(X.colIdx[e])];
+                out[i * n + j] = acc;
+            }
+    }
+    void biasAdd(T* out, const T* bias, size_t rows, size_t cols, size_t ld) const override {
+        for (size_t i = 0; i < rows; ++i)
+            for (size_t j = 0; j < cols; ++j)
+                out[j * ld + i] += bias[j];
+    }
+    void relu(const T* in, T* out, size_t n) const override {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = in[i] > T(0) ? in[i] : T(0);
+    }
+    void reluBackward(const T* grad, const T* act, T* out, size_t n) const override {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = act[i] > T(0) ? grad[i] : T(0);
+    }
+    void softmaxRows(const T* in, T* out, size_t rows, size_t cols, size_t ld) const override {
+        for (size_t i = 0; i < rows; ++i) {
+            T m = in[i];
+            for (size_t j = 1; j < cols; ++j)
+                m = std::max(m, in[j * ld + i]);
+            T s = T(0);
+            for (size_t j = 0; j < cols; ++j)
+                s += std::exp(in[j * ld + i] - m);
+            for (size_t j = 0; j < cols; ++j)
+                out[j * ld + i] = std::exp(in[j * ld + i] - m) / s;
+        }
+    }
+    void columnSums(const T* m, size_t rows, size_t cols, size_t ld, T* sums) const override {
+        for (size_t j = 0; j < cols; ++j) {
+            sums[j] = T(0);
+            for (size_t i = 0; i < rows; ++i)
+                sums[j] += m[j * ld + i];
+        }
+    }
+    T softmaxCrossEntropy(const T* logits, const T* label, T* grad, size_t rows, size_t cols, size_t ld,
+                          T scale) const override {
+        T loss = T(0);
+        for (size_t i = 0; i < rows; ++i) {
+            T m = logits[i];
+            for (size_t j = 1; j < cols; ++j)
+                m = std::max(m, logits[j * ld + i]);
+            T s = T(0);
+            for (size_t j = 0; j < cols; ++j)
+                s += std::exp(logits[j * ld + i] - m);
+            const T lse = m + std::log(s);
+            for (size_t j = 0; j < cols; ++j) {
+                const T z = logits[j * ld + i], y = label[j * ld + i];
+                loss -= y * (z - lse);
+                grad[j * ld + i] = (std::exp(z - m) / s - y) * scale;
+            }
+        }
+        return loss;
+    }
+
+private:
+    // The packed products for either storage type of B.
+    template<typename S>
+    void packedProduct(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                       T alpha, T beta, const GemmEpilogue<T>& epilogue) const {
+        using namespace backend_detail;
+        for (size_t i = 0; i < A.rows; ++i)
+            for (size_t j = 0; j < B.cols; ++j) {
+                T acc = T(0);
+                for (size_t k = 0; k < A.cols; ++k)
+                    acc += operandAt(A, i, k) * packedAt<T>(B, k, j);
+                T& c = C[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC];
+                scaleInto(c, acc, alpha, beta);
+                if (epilogue.bias)
+                    c += epilogue.bias[j];
+                if (epilogue.relu)
+                    c = std::max(c, T(0));
+            }
+    }
+    template<typename S>
+    void sparsePackedProduct(const SparseRows<T>& X, const PackedPanels<S>& B, T* C, size_t ldc,
+                             const GemmEpilogue<T>& epilogue) const {
+        using namespace backend_detail;
+        for (size_t i = 0; i < X.rows; ++i)
+            for (size_t j = 0; j < B.cols; ++j) {
+                T acc = epilogue.bias ? epilogue.bias[j] : T(0);
+                for (size_t e = X.rowPtr[i]; e < X.rowPtr[i + 1]; ++e)
+                    acc += X.values[e] * packedAt<T>(B, static_cast<size_t>(X.colIdx[e]), j);
+                C[j * ldc + i] = epilogue.relu ? std::max(acc, T(0)) : acc;
+            }
+    }
+};
+
+template<typename T>
+class EigenBackend : public Backend<T> {
+public:
+    const char* name() const override { return "eigen"; }
+
+    void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+              T alpha, T beta) const override {
+        using namespace backend_detail;
+        withMap(A.data, A.rows, A.cols, A.rs, A.cs, [&](const auto& a) {
+            withMap(B.data, B.rows, B.cols, B.rs, B.cs, [&](const auto& b) {
+                withMap(C, A.rows, B.cols, rsC, csC, [&](auto c) { assignScaled(c, a * b, alpha, beta); });
+            });
+        });
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                    T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        packedProduct(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<Eigen::bfloat16>& B, T* C, ptrdiff_t rsC,
+                    ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        packedProduct(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPackedTransposed(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC,
+                              ptrdiff_t csC, T alpha, T beta, const T* gate) const override {
+        using namespace backend_detail;
+        withMap(C, A.rows, B.rows, rsC, csC, [&](auto c) {
+            for (size_t j0 = 0, p = 0; j0 < B.cols; j0 += kPackedPanelWidth, ++p) {
+                const GemmOperand<T> panel = gemm_detail::panelOperand(B, p);
+                const ConstRowMap<T> b(panel.data, panel.rows, panel.cols, Eigen::OuterStride<>(panel.rs));
+                withMap(A.data + static_cast<ptrdiff_t>(j0) * A.cs, A.rows, panel.cols, A.rs, A.cs,
+                        [&](const auto& a) { assignScaled(c, a * b.transpose(), alpha, p == 0 ? beta : T(1)); });
+            }
+            if (gate)
+                withMap(gate, A.rows, B.rows, rsC, csC,
+                        [&](const auto& g) { c = (g.array() > T(0)).select(c, T(0)); });
+        });
+    }
+    dispatch::NarrowGemm<T> narrowGemmPacked(size_t) const override { return nullptr; }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<T>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        sparsePackedProduct(X, B, C, ldc, epilogue);
+    }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<Eigen::bfloat16>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        sparsePackedProduct(X, B, C, ldc, epilogue);
+    }
+    void sparseGemmRows(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg, size_t n,
+                        T* out) const override {
+        using namespace backend_detail;
+        const ConstColMap<T> g(G, X.cols, n, Eigen::OuterStride<>(ldg));
+        RowMap<T> o(out, count, n, Eigen::OuterStride<>(n));
+        withSparseMap(X, [&](const auto& x) {
+            for (size_t i = 0; i < count; ++i)
+                o.row(i).noalias() = x.row(rows[i]) * g;
+        });
+    }
+    void biasAdd(T* out, const T* bias, size_t rows, size_t cols, size_t ld) const override {
+        using namespace backend_detail;
+        ColMap<T>(out, rows, cols, Eigen::OuterStride<>(ld)).rowwise() +=
+            Eigen::Map<const Eigen::Matrix<T, 1, Eigen::Dynamic>>(bias, cols);
+    }
+    void relu(const T* in, T* out, size_t n) const override {
+        Eigen::Map<Eigen::Array<T, Eigen::Dynamic, 1>>(out, n) =
+            Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>>(in, n).max(T(0));
+    }
+    void reluBackward(const T* grad, const T* act, T* out, size_t n) const override {
+        using Arr = Eigen::Array<T, Eigen::Dynamic, 1>;
+        Eigen::Map<Arr>(out, n) = (Eigen::Map<const Arr>(act, n) > T(0)).select(Eigen::Map<const Arr>(grad, n), T(0));
+    }
+    void softmaxRows(const T* in, T* out, size_t rows, size_t cols, size_t ld) const override {
+        using namespace backend_detail;
+        ConstColMap<T> x(in, rows, cols, Eigen::OuterStride<>(ld));
+        ColMap<T> y(out, rows, cols, Eigen::OuterStride<>(ld));
+        const Eigen::Matrix<T, Eigen::Dynamic, 1> m = x.rowwise().maxCoeff();
+        y = (x.colwise() - m).array().exp().matrix();
+        const Eigen::Matrix<T, Eigen::Dynamic, 1> s = y.rowwise().sum();
+        y = y.array().colwise() / s.array();
+    }
+    void columnSums(const T* m, size_t rows, size_t cols, size_t ld, T* sums) const override {
+        using namespace backend_detail;
+        Eigen::Map<Eigen::Matrix<T, 1, Eigen::Dynamic>>(sums, cols) =
+            ConstColMap<T>(m, rows, cols, Eigen::OuterStride<>(ld)).colwise().sum();
+    }
+    T softmaxCrossEntropy(const T* logits, const T* label, T* grad, size_t rows, size_t cols, size_t ld,
+                          T scale) const override {
+        using namespace backend_detail;
+        ConstColMap<T> z(logits, rows, cols, Eigen::OuterStride<>(ld)), y(label, rows, cols, Eigen::OuterStride<>(ld));
+        const Eigen::Array<T, Eigen::Dynamic, 1> m = z.rowwise().maxCoeff();
+        const Eigen::Array<T, Eigen::Dynamic, 1> lse =
+            m + (z.array().colwise() - m).exp().rowwise().sum().log();
+        ColMap<T>(grad, rows, cols, Eigen::OuterStride<>(ld)) =
+            (((z.array().colwise() - lse).exp() - y.array()) * scale).matrix();
+        return (y.array().rowwise().sum() * lse).sum() - (y.array() * z.array()).sum();
+    }
+
+private:
+    // Each panel of a packed operand is a row-major matrix with row stride
+    // kPackedPanelWidth; a bf16 panel is cast to T for the product.
+    template<typename S>
+    static auto panelMap(const PackedPanels<S>& B, size_t p) {
+        const size_t cols = std::min(kPackedPanelWidth, B.cols - p * kPackedPanelWidth);
+        return backend_detail::ConstRowMap<S>(B.data + p * B.panelStride, B.rows, cols,
+                                              Eigen::OuterStride<>(kPackedPanelWidth))
+            .template cast<T>();
+    }
+    template<typename S>
+    void packedProduct(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                       T alpha, T beta, const GemmEpilogue<T>& epilogue) const {
+        using namespace backend_detail;
+        withMap(A.data, A.rows, A.cols, A.rs, A.cs, [&](const auto& a) {
+            for (size_t j0 = 0, p = 0; j0 < B.cols; j0 += kPackedPanelWidth, ++p) {
+                const auto b = panelMap(B, p);
+                withMap(C + static_cast<ptrdiff_t>(j0) * csC, A.rows, b.cols(), rsC, csC, [&](auto c) {
+                    assignScaled(c, a * b, alpha, beta);
+                    if (epilogue.bias)
+                        c.rowwise() += Eigen::Map<const Eigen::Matrix<T, 1, Eigen::Dynamic>>(epilogue.bias + j0,
+                                                                                            b.cols());
+                    if (epilogue.relu)
+                        c = c.cwiseMax(T(0));
+                });
+            }
+        });
+    }
+    template<typename S>
+    void sparsePackedProduct(const SparseRows<T>& X, const PackedPanels<S>& B, T* C, size_t ldc,
+                             const GemmEpilogue<T>& epilogue) const {
+        using namespace backend_detail;
+        withSparseMap(X, [&](const auto& x) {
+            for (size_t j0 = 0, p = 0; j0 < B.cols; j0 += kPackedPanelWidth, ++p) {
+                const auto b = panelMap(B, p);
+                ColMap<T> c(C + j0 * ldc, X.rows, b.cols(), Eigen::OuterStride<>(ldc));
+                c.noalias() = x * b;
+                if (epilogue.bias)
+                    c.rowwise() += Eigen::Map<const Eigen::Matrix<T, 1, Eigen::Dynamic>>(epilogue.bias + j0, b.cols());
+                if (epilogue.relu)
+                    c = c.cwiseMax(T(0));
+            }
+        });
+    }
+};
+
+template<typename T>
+class OptimizedBackend : public Backend<T> {
+public:
+    const char* name() const override { return "optimized"; }
+
+    void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+              T alpha, T beta) const override {
+        ::gemm(A, B, C, rsC, csC, alpha, beta);
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                    T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        ::gemm(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPacked(const GemmOperand<T>& A, const PackedPanels<Eigen::bfloat16>& B, T* C, ptrdiff_t rsC,
+                    ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue) const override {
+        ::gemm(A, B, C, rsC, csC, alpha, beta, epilogue);
+    }
+    void gemmPackedTransposed(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC,
+                              ptrdiff_t csC, T alpha, T beta, const T* gate) const override {
+        ::gemmTransposed(A, B, C, rsC, csC, alpha, beta, gate);
+    }
+    dispatch::NarrowGemm<T> narrowGemmPacked(size_t n) const override {
+        return n >= 1 && n <= dispatch::kNarrowWidths ? dispatch::kernels<T>().gemmPackedNarrow[n - 1] : nullptr;
+    }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<T>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        dispatch::kernels<T>().sparseTimesPacked(X, B, C, ldc, epilogue);
+    }
+    void sparseGemmPacked(const SparseRows<T>& X, const PackedPanels<Eigen::bfloat16>& B, T* C, size_t ldc,
+                          const GemmEpilogue<T>& epilogue) const override {
+        dispatch::kernels<T>().sparseTimesPackedBf16(X, B, C, ldc, epilogue);
+    }
+    // G is transposed once so each stored entry reads one contiguous gradient row.
+    void sparseGemmRows(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg, size_t n,
+                        T* out) const override {
+        thread_local std::vector<T> gt;
+        gt.resize(X.cols * n);
+        for (size_t j = 0; j < n; ++j)
+            for (size_t c = 0; c < X.cols; ++c)
+                gt[c * n + j] = G[j * ldg + c];
+        dispatch::kernels<T>().sparseRowsTimesDense(X, rows, count, gt.data(), n, n, out);
+    }
+    void biasAdd(T* out, const T* bias, size_t rows, size_t cols, size_t ld) const override {
+        for (size_t j = 0; j < cols; ++j) {
+            T* o = out + j * ld;
+            const T b = bias[j];
+            for (size_t i = 0; i < rows; ++i)
+                o[i] += b;
+        }
+    }
+    void relu(const T* in, T* out, size_t n) const override { dispatch::kernels<T>().relu(in, out, n); }
+    void reluBackward(const T* grad, const T* act, T* out, size_t n) const override {
+        dispatch::kernels<T>().reluBackward(grad, act, out, n);
+    }
+    void softmaxRows(const T* in, T* out, size_t rows, size_t cols, size_t ld) const override {
+        dispatch::kernels<T>().softmaxRows(in, out, rows, cols, ld);
+    }
+    void columnSums(const T* m, size_t rows, size_t cols, size_t ld, T* sums) const override {
+        for (size_t j = 0; j < cols; ++j) {
+            const T* col = m + j * ld;
+            T s[4] = {};
+            size_t i = 0;
+            for (; i + 4 <= rows; i += 4)
+                for (size_t u = 0; u < 4; ++u)
+                    s[u] += col[i + u];
+            for (; i < rows; ++i)
+                s[0] += col[i];
+            sums[j] = (s[0] + s[1]) + (s[2] + s[3]);
+        }
+    }
+    T softmaxCrossEntropy(const T* logits, const T* label, T* grad, size_t rows, size_t cols, size_t ld,
+                          T scale) const override {
+        return dispatch::kernels<T>().crossEntropyRows(logits, label, grad, rows, cols, ld, scale);
+    }
+};
+
+// Backend selected by name (naive, eigen, optimized); throws std::invalid_argument for
+// other names.
+template<typename T>
+std::unique_ptr<Backend<T>> makeBackend(const std::string& name) {
+    if (name == "naive")
+        return std::make_unique<NaiveBackend<T>>();
+    if (name == "eigen")
+        return std::make_unique<EigenBackend<T>>();
+    if (name == "optimized")
+        return std::make_unique<OptimizedBackend<T>>();
+    throw std::invalid_argument("Unknown backend: " + name + " (expected naive, eigen or optimized)");
+}
+
+// Shared instance of the optimized backend, the default for layers.
+template<typename T>
+const Backend<T>& defaultBackend() {
+    static const OptimizedBackend<T> backend;
+    return backend;
+}
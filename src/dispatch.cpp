@@ -0,0 +1,119 @@
+#include "dispatch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+
+// One namespace per kernels_isa.cpp build; NN_KERNELS_<LEVEL> is set by CMakeLists.txt
+// for the levels compiled into this binary.
+#define DECLARE_KERNEL_TABLES(level)                  \
+    namespace dispatch::level {                       \
+    extern const KernelTable<float> kTableF32;        \
+    extern const KernelTable<double> kTableF64;       \
+    }
+
+DECLARE_KERNEL_TABLES(generic)
+#ifdef NN_KERNELS_SSE42
+DECLARE_KERNEL_TABLES(sse42)
+#endif
+#ifdef NN_KERNELS_AVX2
+DECLARE_KERNEL_TABLES(avx2)
+#endif
+#ifdef NN_KERNELS_AVX512
+DECLARE_KERNEL_TABLES(avx512)
+#endif
+
+namespace dispatch {
+
+const char* isaName(Isa isa) {
+    switch (isa) {
+    case Isa::SSE42: return "sse42";
+    case Isa::AVX2: return "avx2";
+    case Isa::AVX512: return "avx512";
+    default: return "generic";
+    }
+}
+
+Isa detectIsa() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+#ifdef NN_KERNELS_AVX512
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+        return Isa::AVX512;
+#endif
+#ifdef NN_KERNELS_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return Isa::AVX2;
+#endif
+#ifdef NN_KERNELS_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+        return Isa::SSE42;
+#endif
+#endif
+    return Isa::GENERIC;
+}
+
+Isa activeIsa() {
+    static const Isa isa = [] {
+        Isa best = detectIsa();
+        const char* cap = std::getenv("NN_ISA");
+        if (!cap)
+            return best;
+        for (Isa level : { Isa::GENERIC, Isa::SSE42, Isa::AVX2, Isa::AVX512 })
+            if (std::strcmp(cap, isaName(level)) == 0)
+                return level < best ? level : best;
+        std::cerr << "Warning: ignoring NN_ISA=" << cap
+                  << " (expected generic, sse42, avx2 or avx512); using " << isaName(best) << "\n";
+        return best;
+    }();
+    return isa;
+}
+
+namespace {
+
+template<typename T>
+const KernelTable<T>& select(const KernelTable<T>& generic, const KernelTable<T>* sse42,
+                             const KernelTable<T>* avx2, const KernelTable<T>* avx512) {
+    switch (activeIsa()) {
+    case Isa::AVX512: if (avx512) return *avx512; [[fallthrough]];
+    case Isa::AVX2: if (avx2) return *avx2; [[fallthrough]];
+    case Isa::SSE42: if (sse42) return *sse42; [[fallthrough]];
+    default: return generic;
+    }
+}
+
+#ifdef NN_KERNELS_SSE42
+#define TABLE_SSE42(name) &sse42::name
+#else
+#define TABLE_SSE42(name) nullptr
+#endif
+#ifdef NN_KERNELS_AVX2
+#define TABLE_AVX2(name) &avx2::name
+#else
+#define TABLE_AVX2(name) nullptr
+#endif
+#ifdef NN_KERNELS_AVX512
+#define TABLE_AVX512(name) &avx512::name
+#else
+#define TABLE_AVX512(name) nullptr
+#endif
+
+} // namespace
+
+template<>
+const KernelTable<float>& kernels<float>() {
+    static const KernelTable<float>& table =
+        select(generic::kTableF32, TABLE_SSE42(kTableF32), TABLE_AVX2(kTableF32), TABLE_AVX512(kTableF32));
+    return table;
+}
+
+template<>
+const KernelTable<double>& kernels<double>() {
+    static const KernelTable<double>& table =
+        select(generic::kTableF64, TABLE_SSE42(kTableF64), TABLE_AVX2(kTableF64), TABLE_AVX512(kTableF64));
+    return table;
+}
+
+} // namespace dispatch
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Runtime selection of the hot kernels. src/kernels_isa.cpp is compiled once per ISA
+// level (see CMakeLists.txt) and each copy exports a KernelTable; the table for the best
+// level the host CPU supports is picked on first use. The environment variable NN_ISA
+// (generic, sse42, avx2, avx512) caps the level, e.g. to exercise the older paths.
+
+template<typename T>
+struct GemmOperand;
+template<typename T>
+struct PackedPanels;
+template<typename T>
+struct SparseRows;
+template<typename T>
+struct GemmEpilogue;
+template<typename T>
+struct MomentumStep;
+template<typename T>
+struct AdamStep;
+struct QuantizedPanels;
+struct QuantEpilogue;
+namespace Eigen {
+struct bfloat16;
+}
+
+namespace dispatch {
+
+enum class Isa { GENERIC, SSE42, AVX2, AVX512 };
+
+const char* isaName(Isa isa);
+// Best level supported by this CPU (and OS) among the levels compiled into the binary.
+Isa detectIsa();
+// Level in use: detectIsa(), capped by NN_ISA.
+Isa activeIsa();
+
+// Cache blocking and thread count of the blocked GEMM loops; zero selects the built-in
+// default. Set per problem shape by a tuning profile (gemm_tuning.hpp).
+struct GemmParams {
+    size_t mc = 0, kc = 0, nc = 0;
+    int threads = 0;
+};
+
+// Widths with a dedicated gemmPackedNarrow kernel: B of one packed panel (kPackedPanelWidth
+// in gemm.hpp), e.g. the 10 logits.
+inline constexpr size_t kNarrowWidths = 12;
+template<typename T>
+using NarrowGemm = void (*)(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, size_t ldc,
+                            const GemmEpilogue<T>& epilogue);
+
+template<typename T>
+struct KernelTable {
+    Isa isa;
+    // C = alpha * A * B + beta * C, zeroed where a non-null gate is not positive, see
+    // gemmGated() in gemm.hpp.
+    void (*gemm)(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                 T alpha, T beta, const T* gate, const GemmParams& params);
+    // The same with B already in panel form (PackedMatrix), followed by the epilogue.
+    void (*gemmPacked)(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                       T alpha, T beta, const GemmEpilogue<T>& epilogue, const GemmParams& params);
+    // ... and with the panels holding a bf16 copy of B, accumulated in T (mixed precision).
+    void (*gemmPackedBf16)(const GemmOperand<T>& A, const PackedPanels<Eigen::bfloat16>& B, T* C, ptrdiff_t rsC,
+                           ptrdiff_t csC, T alpha, T beta, const GemmEpilogue<T>& epilogue, const GemmParams& params);
+    // gemmPacked for column-contiguous A and B of exactly n columns, compiled for that width:
+    // entry n - 1, with C column-major (column stride ldc) and the epilogue fused into the
+    // stores, see gemmPackedNarrow() in gemm.hpp.
+    NarrowGemm<T> gemmPackedNarrow[kNarrowWidths];
+    // Sparse layer inputs in CSR form, see sparse.hpp: C = X * B (then the epilogue), and
+    // the listed rows of X * G for row-major G.
+    void (*sparseTimesPacked)(const SparseRows<T>& X, const PackedPanels<T>& B, T* C, size_t ldc,
+                              const GemmEpilogue<T>& epilogue);
+    void (*sparseTimesPackedBf16)(const SparseRows<T>& X, const PackedPanels<Eigen::bfloat16>& B, T* C, size_t ldc,
+                                  const GemmEpilogue<T>& epilogue);
+    void (*sparseRowsTimesDense)(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg,
+                                 size_t n, T* out);
+    // Y[v, :] = A * X[v, :] and y = A^T x for row-major A, see matvec.hpp.
+    void (*gemvBatched)(const T* A, size_t rows, size_t cols, size_t lda,
+                        const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy);
+    void (*gemvTransposed)(const T* A, size_t rows, size_t cols, size_t lda, const T* x, T* y);
+    // Row-wise softmax of a column-major rows x cols matrix with column stride ld.
+    void (*softmaxRows)(const T* in, T* out, size_t rows, size_t cols, size_t ld);
+    // Fused softmax + cross-entropy: the summed loss, and grad = scale * (softmax - labels).
+    T (*crossEntropyRows)(const T* logits, const T* labels, T* grad, size_t rows, size_t cols, size_t ld, T scale);
+    // out = max(in, 0) and out = grad * (act > 0) over n elements.
+    void (*relu)(const T* in, T* out, size_t n);
+    void (*reluBackward)(const T* grad, const T* act, T* out, size_t n);
+    // Fused in-place optimizer steps over a rows x n block, parameters and state with row
+    // stride ldp and the gradient with ldg, see optimizers.hpp.
+    void (*momentumStep)(T* p, T* velocity, const T* g, size_t rows, size_t n, size_t ldp, size_t ldg,
+                         const MomentumStep<T>& step);
+    void (*adamStep)(T* p, T* m, T* v, const T* g, size_t rows, size_t n, size_t ldp, size_t ldg,
+                     const AdamStep<T>& step);
+    // dst = src / 255 for 8-bit pixels, and dst = src rounded to bf16.
+    void (*pixelsToReal)(const uint8_t* src, T* dst, size_t n);
+    void (*realToBf16)(const T* src, Eigen::bfloat16* dst, size_t n);
+    // u8 x s8 product of row-major A (M x B.rows, row stride lda) with int32 sums, rescaled
+    // by the epilogue, see quantized.hpp. Independent of T; both tables hold it.
+    void (*gemmU8S8)(const uint8_t* A, size_t M, size_t lda, const QuantizedPanels& B,
+                     const QuantEpilogue& epilogue);
+};
+
+template<typename T>
+inline constexpr bool hasKernels = std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+template<typename T>
+const KernelTable<T>& kernels();
+
+template<>
+const KernelTable<float>& kernels<float>();
+template<>
+const KernelTable<double>& kernels<double>();
+
+} // namespace dispatch
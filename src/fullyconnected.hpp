@@ -1,35 +1,271 @@
 #ifndef FULLY_CONNECTED_HPP
 #define FULLY_CONNECTED_HPP
 #include <Eigen/Dense>
+#include "backend.hpp"
 #include "optimizers.hpp"
+#include "gemm.hpp"
+#include "sparse.hpp"
+#include "tensor_convert.hpp"
 #include <iostream>
 #include <cmath>
 #include <cstdlib>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+// Batches with at most this fraction of nonzero inputs take the sparse-input path of a
+// layer with setSparseInput(true); raw MNIST pixels are about 80% zeros.
+inline constexpr double kSparseInputMaxDensity = 0.25;
+
+// The backward steps FullyConnected shares with StaticDense (sequential.hpp).
+namespace dense_detail {
+
+// The inputs present in a sparse batch, ascending: the nonempty rows of its CSR transpose.
+template<typename T>
+void activeInputs(const CsrMatrix<T> &inputT, std::vector<int32_t> &rows) {
+    rows.clear();
+    const std::vector<size_t> &rowPtr = inputT.rowPtr();
+    for (size_t k = 0; k + 1 < rowPtr.size(); ++k)
+        if (rowPtr[k + 1] > rowPtr[k])
+            rows.push_back(static_cast<int32_t>(k));
+}
+
+// gradWeights (in x out, row-major, the order in which the update walks the packed
+// panels) = input^T * grad for a batch x in input and a column-major batch x out grad.
+// A sparse batch (inputT its CSR transpose, else null) only fills the rows of its active
+// inputs, compactly: row r belongs to input activeRows[r].
+template<typename T>
+void weightGradient(const Backend<T> &backend, const GemmOperand<T> &input, const CsrMatrix<T> *inputT,
+                    const T *grad, size_t batch, size_t out, T *gradWeights, std::vector<int32_t> &activeRows) {
+    if (inputT) {
+        activeInputs(*inputT, activeRows);
+        backend.sparseGemmRows(inputT->view(), activeRows.data(), activeRows.size(), grad, batch, out, gradWeights);
+    } else {
+        backend.gemm(input.transposed(), { grad, batch, out, 1, static_cast<ptrdiff_t>(batch) }, gradWeights, out, 1,
+                     T(1), T(0));
+    }
+}
+
+// Turns the compact weight gradient of a sparse batch into the full one in place: row r
+// moves to row activeRows[r] >= r (last first) and the rows in between are zeroed.
+template<typename M>
+void spreadActiveRows(M &gradWeights, const std::vector<int32_t> &activeRows) {
+    size_t next = static_cast<size_t>(gradWeights.rows());
+    for (size_t r = activeRows.size(); r-- > 0;) {
+        const size_t k = static_cast<size_t>(activeRows[r]);
+        gradWeights.middleRows(k + 1, next - k - 1).setZero();
+        if (k != r)
+            gradWeights.row(k) = gradWeights.row(r);
+        next = k;
+    }
+    gradWeights.topRows(next).setZero();
+}
+
+// Applies the weight gradient from weightGradient: an optimizer with sparse updates only
+// touches the active rows of a sparse batch, others get the spread full gradient.
+template<typename T, typename M>
+void updateWeights(Optimizer<T> &optimizer, PackedMatrix<T> &weights, M &gradWeights, bool sparseBatch,
+                   const std::vector<int32_t> &activeRows) {
+    const size_t out = weights.cols();
+    if (sparseBatch && optimizer.sparseUpdates()) {
+        optimizer.updateWeightRows(weights, gradWeights.data(), out, activeRows);
+    } else {
+        if (sparseBatch)
+            spreadActiveRows(gradWeights, activeRows);
+        optimizer.updateWeights(weights, gradWeights.data(), out);
+    }
+}
+
+} // namespace dense_detail
+
+// Inference-only copy of a FullyConnected layer: the packed weights and the bias are
+// frozen and nothing is cached for a backward pass. The weights are stored as S (e.g. a
+// bf16 copy of float weights) and computed with in T. The fused ReLU is not part of what
+// save() stores.
+template<typename T = double, typename S = T>
+class FrozenFullyConnected {
+public:
+    FrozenFullyConnected(PackedMatrix<S> weights, RowVectorX<T> bias, const Backend<T> &backend = defaultBackend<T>())
+        : backend_(&backend), weights_(std::move(weights)), bias_(std::move(bias)) {
+        if (static_cast<size_t>(bias_.size()) != weights_.cols())
+            throw std::invalid_argument("FrozenFullyConnected: bias size does not match the weights");
+    }
+    // The weights followed by the bias as a 1 x out packed matrix.
+    static FrozenFullyConnected load(std::istream &in, const Backend<T> &backend = defaultBackend<T>()) {
+        PackedMatrix<S> weights = PackedMatrix<S>::load(in);
+        RowVectorX<T> bias = PackedMatrix<T>::load(in).toDense();
+        return FrozenFullyConnected(std::move(weights), std::move(bias), backend);
+    }
+    void save(std::ostream &out) const {
+        weights_.save(out);
+        PackedMatrix<T>(bias_).save(out);
+    }
+    void setSparseInput(bool enabled) { sparseInput_ = enabled; }
+    void setRelu(bool enabled) { relu_ = enabled; }
+    MatrixX<T> forward(const MatrixX<T> &input) const {
+        MatrixX<T> output(input.rows(), weights_.cols());
+        const GemmEpilogue<T> epilogue{ bias_.data(), relu_ };
+        CsrMatrix<T> inputT;
+        if (sparseInput_)
+            inputT = CsrMatrix<T>::fromDense(input.data(), input.cols(), input.rows(), input.rows());
+        if (sparseInput_ && inputT.density() <= kSparseInputMaxDensity)
+            backend_->sparseGemmPacked(inputT.transposed().view(), weights_.view(), output.data(), output.rows(),
+                                       epilogue);
+        else
+            backend_->gemmPacked(gemmOperand(input), weights_.view(), output.data(), 1, output.rows(), T(1), T(0),
+                                 epilogue);
+        return output;
+    }
+private:
+    const Backend<T> *backend_;
+    PackedMatrix<S> weights_;
+    RowVectorX<T> bias_;
+    bool sparseInput_ = false, relu_ = false;
+};
+
+// Weights and bias are kept apart: forward adds the bias in the GEMM epilogue and
+// backward takes its gradient as the column sums of the output gradient, so the input is
+// used as it is, without an augmented copy. The input passed to forward must stay alive
+// until the following backward. With setRelu(true) the layer is Linear+ReLU: the
+// activation is applied in the same epilogue and its output is all backward needs.
+// The initial weights are drawn in double and rounded to T, so every precision starts
+// from the same network.
+//
+// With a storage type S other than T (Eigen::bfloat16 for mixed precision) the forward
+// products read a bf16 working copy of the weights and accumulate in T, while the
+// optimizer updates the T master weights. The copy is rounded anew after every update,
+// in one vectorized pass over the panels (even a sparse batch touches most rows of a
+// layer fed MNIST pixels). The input gradient uses the master weights.
+template<typename T = double, typename S = T>
 class FullyConnected {
 public:
-    FullyConnected(size_t in, size_t out) : in_size(in), out_size(out) {
-        weights_.resize(in_size + 1, out_size);
-        weights_.topRows(in_size) = heUniformInit(in_size, out_size);
-        weights_.row(in_size).setZero();
+    FullyConnected(size_t in, size_t out, const Backend<T> &backend = defaultBackend<T>())
+        : in_size(in), out_size(out), backend_(&backend), weights_(in, out), bias_(RowVectorX<T>::Zero(out)) {
+        Eigen::MatrixXd w = heUniformInit(in_size, out_size);
+        for (size_t j = 0; j < out_size; ++j)
+            for (size_t i = 0; i < in_size; ++i)
+                weights_(i, j) = static_cast<T>(w(i, j));
+        refreshWorking();
+    }
+    // Weights as an (in + 1) x out matrix whose last row is the bias.
+    void setWeights(const MatrixX<T> &w) {
+        weights_ = PackedMatrix<T>(w.topRows(w.rows() - 1));
+        bias_ = w.template bottomRows<1>();
+        refreshWorking();
+    }
+    MatrixX<T> weights() const {
+        MatrixX<T> w(in_size + 1, out_size);
+        w.topRows(in_size) = weights_.toDense();
+        w.template bottomRows<1>() = bias_;
+        return w;
     }
-    void setWeights(const Eigen::MatrixXd &w) { weights_ = w; }
-    Eigen::MatrixXd forward(const Eigen::MatrixXd &input) {
+    FrozenFullyConnected<T, S> freeze() const {
+        FrozenFullyConnected<T, S> frozen(working(), bias_, *backend_);
+        frozen.setSparseInput(sparseInput_);
+        frozen.setRelu(relu_);
+        return frozen;
+    }
+    // Drops all inputs but the listed ones (ascending), keeping their weights; batches
+    // then carry only those input columns. Meant for inputs that are zero in the whole
+    // training set: they never contribute to the output nor receive a gradient.
+    void keepInputs(const std::vector<int32_t> &inputs) {
+        PackedMatrix<T> kept(inputs.size(), out_size);
+        for (size_t j = 0; j < out_size; ++j)
+            for (size_t i = 0; i < inputs.size(); ++i)
+                kept(i, j) = weights_(static_cast<size_t>(inputs[i]), j);
+        weights_ = std::move(kept);
+        in_size = inputs.size();
+        refreshWorking();
+    }
+    // Sparse-input mode, for a layer fed raw pixels: forward and the weight gradient only
+    // visit the nonzero inputs of batches sparser than kSparseInputMaxDensity, and plain
+    // SGD only updates the weight rows of inputs present in the batch.
+    void setSparseInput(bool enabled) { sparseInput_ = enabled; }
+    void setRelu(bool enabled) { relu_ = enabled; }
+    // The output stays valid until the next forward.
+    const MatrixX<T> &forward(const MatrixX<T> &input) {
         size_t batch = input.rows();
-        input_aug_.resize(batch, in_size + 1);
-        input_aug_.block(0, 0, batch, in_size) = input;
-        input_aug_.col(in_size) = Eigen::VectorXd::Ones(batch);
-        return input_aug_ * weights_;
+        input_ = &input;
+        output_.resize(batch, out_size);
+        const GemmEpilogue<T> epilogue{ bias_.data(), relu_ };
+        sparseBatch_ = false;
+        if (sparseInput_) {
+            // The column-major batch read row-major is its transpose: one CSR row per input.
+            inputT_ = CsrMatrix<T>::fromDense(input.data(), in_size, batch, batch);
+            sparseBatch_ = inputT_.density() <= kSparseInputMaxDensity;
+        }
+        if (sparseBatch_)
+            backend_->sparseGemmPacked(inputT_.transposed().view(), working().view(), output_.data(), batch, epilogue);
+        else
+            backend_->gemmPacked(gemmOperand(input), working().view(), output_.data(), 1, batch, T(1), T(0), epilogue);
+        return output_;
     }
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &grad, const SGD &sgd) {
-        Eigen::MatrixXd gradWeights = input_aug_.transpose() * grad;
-        Eigen::MatrixXd prevGrad = grad * weights_.topRows(in_size).transpose();
-        weights_ = sgd.updateWeights(weights_, gradWeights);
-        return prevGrad;
+    // What backward returns: nothing (e.g. for the first layer), the gradient w.r.t. the
+    // input, or that gradient through the ReLU that produced the input (zero where the
+    // input is not positive), which folds the activation's backward pass into the
+    // input-gradient GEMM.
+    enum class InputGrad { None, Plain, ThroughRelu };
+    // Updates the parameters in place with the optimizer and returns the input gradient
+    // asked for, valid until the next backward. outputGrad is w.r.t. the output, after the
+    // ReLU of a fused layer unless preActivation says the next layer already took it
+    // through the ReLU (InputGrad::ThroughRelu). The gradients live in buffers reused
+    // across steps.
+    const MatrixX<T> &backward(const MatrixX<T> &outputGrad, Optimizer<T> &optimizer,
+                                    InputGrad inputGrad = InputGrad::Plain, bool preActivation = false) {
+        if (relu_ && !preActivation) {
+            // The ReLU output is positive exactly where its input was.
+            gradRelu_.resize(outputGrad.rows(), outputGrad.cols());
+            backend_->reluBackward(outputGrad.data(), output_.data(), gradRelu_.data(), outputGrad.size());
+        }
+        const MatrixX<T> &grad = relu_ && !preActivation ? gradRelu_ : outputGrad;
+        gradWeights_.resize(in_size, out_size);
+        dense_detail::weightGradient(*backend_, gemmOperand(*input_), sparseBatch_ ? &inputT_ : nullptr, grad.data(),
+                                     grad.rows(), out_size, gradWeights_.data(), activeRows_);
+        gradBias_.resize(out_size);
+        backend_->columnSums(grad.data(), grad.rows(), out_size, grad.rows(), gradBias_.data());
+        if (inputGrad == InputGrad::None) {
+            prevGrad_.resize(0, 0);
+        } else {
+            prevGrad_.resize(grad.rows(), in_size);
+            backend_->gemmPackedTransposed(gemmOperand(grad), weights_.view(), prevGrad_.data(), 1, prevGrad_.rows(),
+                                           T(1), T(0), inputGrad == InputGrad::ThroughRelu ? input_->data() : nullptr);
+        }
+        dense_detail::updateWeights(optimizer, weights_, gradWeights_, sparseBatch_, activeRows_);
+        refreshWorking();
+        optimizer.updateBias(bias_, gradBias_);
+        return prevGrad_;
     }
 private:
+    static constexpr bool kMixed = !std::is_same_v<S, T>;
+
+    // The weights the forward products read.
+    const PackedMatrix<S> &working() const {
+        if constexpr (kMixed)
+            return working_;
+        else
+            return weights_;
+    }
+    // Rounds the master weights into the working copy, padding included (it stays zero).
+    void refreshWorking() {
+        if constexpr (kMixed) {
+            if (working_.rows() != weights_.rows() || working_.cols() != weights_.cols())
+                working_ = PackedMatrix<S>(weights_.rows(), weights_.cols());
+            convertBuffer(weights_.data(), working_.data(), weights_.storageSize());
+        }
+    }
+
     size_t in_size, out_size;
-    Eigen::MatrixXd weights_, input_aug_;
+    const Backend<T> *backend_;
+    PackedMatrix<T> weights_;
+    PackedMatrix<S> working_;       // rounded copy of weights_ when S != T
+    RowVectorX<T> bias_, gradBias_;
+    const MatrixX<T> *input_ = nullptr;
+    MatrixX<T> output_, gradRelu_, prevGrad_;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> gradWeights_;
+    bool sparseInput_ = false, sparseBatch_ = false, relu_ = false;
+    CsrMatrix<T> inputT_;           // transposed input of a sparse batch
+    std::vector<int32_t> activeRows_;    // inputs present in it
 };
 
 #endif // FULLY_CONNECTED_HPP
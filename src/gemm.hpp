@@ -0,0 +1,1130 @@
+#pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "allocator.hpp"
+#include "dispatch.hpp"
+#include "gemm_tuning.hpp"
+#include "matvec.hpp"
+#include "simd.hpp"
+#include "tensor.hpp"
+
+// In-tree GEMM, C = alpha * A * B + beta * C, in the Goto/BLIS style:
+//   for jc (NC columns of C):  for pc (KC of K):  pack B[pc, jc] into NR-wide panels
+//     for ic (MC rows of C):  pack A[ic, pc] into MR-tall panels
+//       for jr, ir (parallel):  MR x NR register-blocked microkernel over KC
+// Operands are described by element strides, so transposed operands and both Eigen
+// storage orders are handled by the packing routines and never materialized. Degenerate
+// shapes (a single row or column, K == 1, or a dimension of at most kSkinnyMax) skip the
+// packing and use dedicated kernels.
+
+// Strided view of a matrix operand: element (i, j) lives at data[i * rs + j * cs].
+template<typename T>
+struct GemmOperand {
+    const T* data;
+    size_t rows, cols;
+    ptrdiff_t rs, cs;
+
+    GemmOperand transposed() const { return { data, cols, rows, cs, rs }; }
+};
+
+// Operand view of an Eigen expression with direct storage access (matrices, blocks, maps).
+template<typename Derived>
+GemmOperand<typename Derived::Scalar> gemmOperand(const Eigen::DenseBase<Derived>& m) {
+    const ptrdiff_t inner = m.innerStride(), outer = m.outerStride();
+    return { m.derived().data(), static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols()),
+             Derived::IsRowMajor ? outer : inner, Derived::IsRowMajor ? inner : outer };
+}
+
+// Panel width of pre-packed B operands; a multiple of every microkernel's NR, so one
+// packed layout serves all ISA levels.
+inline constexpr size_t kPackedPanelWidth = 12;
+
+// Pre-packed B operand (see PackedMatrix): the columns are split into kPackedPanelWidth
+// wide panels, the last one zero-padded; panel p starts at data + p * panelStride and
+// holds element (k, j) at k * kPackedPanelWidth + j.
+template<typename T>
+struct PackedPanels {
+    const T* data;
+    size_t rows, cols;
+    size_t panelStride;
+};
+
+// Applied to C as it is stored, after the full product of a pre-packed GEMM: bias[j] is
+// added to column j, then relu clamps C at 0. A layer's forward pass, activation
+// included, is then one GEMM with no extra pass over C.
+template<typename T>
+struct GemmEpilogue {
+    const T* bias = nullptr;
+    bool relu = false;
+};
+
+namespace gemm_detail {
+inline namespace SIMD_ISA {
+
+// Pre-packed operands may hold a bf16 copy of the weights. The kernels read it as raw
+// 16-bit patterns, which keeps the widening loops vectorizable, and widen each one to T:
+// a bf16 is the top half of a float.
+template<typename S>
+using RawElement = std::conditional_t<std::is_same_v<S, Eigen::bfloat16>, uint16_t, S>;
+
+template<typename S>
+inline const RawElement<S>* raw(const S* p) {
+    return reinterpret_cast<const RawElement<S>*>(p);
+}
+
+template<typename T, typename R>
+inline T widen(R v) {
+    if constexpr (std::is_same_v<R, uint16_t>)
+        return static_cast<T>(std::bit_cast<float>(uint32_t(v) << 16));
+    else
+        return v;
+}
+
+// Rows [k0, k0 + kc) of panels [q0, q1) of B as T, one kc x kPackedPanelWidth block per
+// panel, for the blocked loops on bf16 panels.
+template<typename T, typename S>
+void widenPanels(const PackedPanels<S>& B, size_t q0, size_t q1, size_t k0, size_t kc, T* dst) {
+    constexpr size_t PW = kPackedPanelWidth;
+    for (size_t q = q0; q < q1; ++q) {
+        const RawElement<S>* src = raw(B.data + q * B.panelStride + k0 * PW);
+        T* d = dst + (q - q0) * kc * PW;
+        for (size_t i = 0; i < kc * PW; ++i)
+            d[i] = widen<T>(src[i]);
+    }
+}
+
+template<typename T>
+struct KernelShape {
+    using P = simd::Packet<T>;
+    // Two packets of C rows per microkernel column; with one-lane packets use four.
+    static constexpr size_t kMrPackets = P::size == 1 ? 4 : 2;
+    static constexpr size_t MR = kMrPackets * P::size;
+    // 2 x NR accumulators + 2 A packets + 1 broadcast fit the register file.
+#if defined(__AVX512F__)
+    static constexpr size_t NR = 12;
+#else
+    static constexpr size_t NR = 6;
+#endif
+};
+
+// Default cache blocking: an MC x KC block of A stays in L2, a KC x NR panel of B in L1.
+template<typename T>
+struct Blocking {
+    static constexpr size_t MR = KernelShape<T>::MR;
+    static constexpr size_t NR = KernelShape<T>::NR;
+    static constexpr size_t KC = 256;
+    static constexpr size_t MC = MR * (sizeof(T) == 4 ? 12 : 6);
+    static constexpr size_t NC = NR * 340;
+};
+
+// Below this many multiply-adds the loops run single-threaded.
+inline constexpr size_t kParallelMinWork = size_t(1) << 20;
+
+inline int maxThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Blocking of one call: the defaults, or the tuned GemmParams rounded to whole
+// microkernel panels.
+template<typename T>
+struct BlockSizes {
+    using BK = Blocking<T>;
+    size_t mc, kc, nc;
+    int threads;
+
+    explicit BlockSizes(const dispatch::GemmParams& p)
+        : mc(roundUp(p.mc ? p.mc : BK::MC, BK::MR)), kc(p.kc ? p.kc : BK::KC),
+          nc(roundUp(p.nc ? p.nc : BK::NC, BK::NR)), threads(p.threads > 0 ? p.threads : maxThreads()) {}
+
+    static size_t roundUp(size_t v, size_t step) { return (v + step - 1) / step * step; }
+};
+
+// Grow-only, kTensorAlignment-aligned scratch buffer for packed panels.
+template<typename T>
+class PackBuffer {
+public:
+    PackBuffer() = default;
+    PackBuffer(const PackBuffer&) = delete;
+    PackBuffer& operator=(const PackBuffer&) = delete;
+    ~PackBuffer() {
+        if (data_)
+            HeapAllocator::deallocate(data_, capacity_ * sizeof(T));
+    }
+    T* get(size_t n) {
+        if (n > capacity_) {
+            if (data_)
+                HeapAllocator::deallocate(data_, capacity_ * sizeof(T));
+            data_ = static_cast<T*>(HeapAllocator::allocate(n * sizeof(T)));
+            capacity_ = n;
+        }
+        return data_;
+    }
+private:
+    T* data_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+// Packs rows [i0, i0 + mc) x cols [p0, p0 + kc) of A into MR-tall panels: panel p holds,
+// for each k, MR consecutive rows (zero-padded past mc).
+template<typename T>
+void packA(const T* A, ptrdiff_t rsA, ptrdiff_t csA, size_t mc, size_t kc, T* Ap, int threads) {
+    constexpr size_t MR = KernelShape<T>::MR;
+    const long panels = static_cast<long>((mc + MR - 1) / MR);
+    #pragma omp parallel for schedule(static) if (mc * kc >= (size_t(1) << 16)) num_threads(threads)
+    for (long p = 0; p < panels; ++p) {
+        const size_t i0 = static_cast<size_t>(p) * MR;
+        const size_t m = std::min(MR, mc - i0);
+        T* dst = Ap + i0 * kc;
+        const T* src = A + static_cast<ptrdiff_t>(i0) * rsA;
+        if (rsA == 1 && m == MR) {
+            for (size_t k = 0; k < kc; ++k)
+                std::memcpy(dst + k * MR, src + static_cast<ptrdiff_t>(k) * csA, MR * sizeof(T));
+        } else {
+            for (size_t k = 0; k < kc; ++k) {
+                for (size_t i = 0; i < m; ++i)
+                    dst[k * MR + i] = src[static_cast<ptrdiff_t>(i) * rsA + static_cast<ptrdiff_t>(k) * csA];
+                for (size_t i = m; i < MR; ++i)
+                    dst[k * MR + i] = T(0);
+            }
+        }
+    }
+}
+
+// Packs rows [p0, p0 + kc) x cols [j0, j0 + nc) of B into NR-wide panels: panel p holds,
+// for each k, NR consecutive columns (zero-padded past nc).
+template<typename T>
+void packB(const T* B, ptrdiff_t rsB, ptrdiff_t csB, size_t kc, size_t nc, T* Bp, int threads) {
+    constexpr size_t NR = KernelShape<T>::NR;
+    const long panels = static_cast<long>((nc + NR - 1) / NR);
+    #pragma omp parallel for schedule(static) if (nc * kc >= (size_t(1) << 16)) num_threads(threads)
+    for (long p = 0; p < panels; ++p) {
+        const size_t j0 = static_cast<size_t>(p) * NR;
+        const size_t n = std::min(NR, nc - j0);
+        T* dst = Bp + j0 * kc;
+        const T* src = B + static_cast<ptrdiff_t>(j0) * csB;
+        if (csB == 1 && n == NR) {
+            for (size_t k = 0; k < kc; ++k)
+                std::memcpy(dst + k * NR, src + static_cast<ptrdiff_t>(k) * rsB, NR * sizeof(T));
+        } else {
+            for (size_t k = 0; k < kc; ++k) {
+                for (size_t j = 0; j < n; ++j)
+                    dst[k * NR + j] = src[static_cast<ptrdiff_t>(k) * rsB + static_cast<ptrdiff_t>(j) * csB];
+                for (size_t j = n; j < NR; ++j)
+                    dst[k * NR + j] = T(0);
+            }
+        }
+    }
+}
+
+// C[0:m, 0:n] = alpha * Ap * Bp + beta * C for one MR x NR tile; m <= MR and n <= NR at
+// the edges. Row k of the B panel starts at Bp + k * ldb (NR for panels packed by
+// packB). beta == 0 never reads C. A non-null bias (the tile's first column) is added
+// per column and relu clamps the result, for the last KC block of an epilogue; so does a
+// non-null gate (laid out like C), which zeroes C where it is not positive.
+template<typename T>
+void microKernel(size_t kc, const T* Ap, const T* Bp, size_t ldb, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                 size_t m, size_t n, T alpha, T beta, const T* bias = nullptr, bool relu = false,
+                 const T* gate = nullptr) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    constexpr size_t MP = KernelShape<T>::kMrPackets;
+    constexpr size_t MR = KernelShape<T>::MR;
+    constexpr size_t NR = KernelShape<T>::NR;
+
+    typename P::type acc[NR][MP];
+    for (size_t j = 0; j < NR; ++j)
+        for (size_t i = 0; i < MP; ++i)
+            acc[j][i] = P::zero();
+    for (size_t k = 0; k < kc; ++k) {
+        typename P::type a[MP];
+        for (size_t i = 0; i < MP; ++i)
+            a[i] = P::loadu(Ap + k * MR + i * W);
+        for (size_t j = 0; j < NR; ++j) {
+            typename P::type b = P::set1(Bp[k * ldb + j]);
+            for (size_t i = 0; i < MP; ++i)
+                acc[j][i] = P::fmadd(a[i], b, acc[j][i]);
+        }
+    }
+
+    const typename P::type va = P::set1(alpha), vb = P::set1(beta);
+    if (rsC == 1 && m == MR && n == NR) {
+        for (size_t j = 0; j < NR; ++j) {
+            T* c = C + static_cast<ptrdiff_t>(j) * csC;
+            for (size_t i = 0; i < MP; ++i) {
+                typename P::type r = P::mul(acc[j][i], va);
+                if (beta != T(0))
+                    r = P::fmadd(P::loadu(c + i * W), vb, r);
+                if (bias)
+                    r = P::add(r, P::set1(bias[j]));
+                if (relu)
+                    r = P::max(r, P::zero());
+                if (gate)
+                    r = P::selectPositive(P::loadu(gate + static_cast<ptrdiff_t>(j) * csC + i * W), r);
+                P::storeu(c + i * W, r);
+            }
+        }
+        return;
+    }
+    alignas(64) T tile[NR][MR];
+    for (size_t j = 0; j < NR; ++j)
+        for (size_t i = 0; i < MP; ++i)
+            P::storeu(&tile[j][i * W], P::mul(acc[j][i], va));
+    for (size_t j = 0; j < n; ++j) {
+        const T b = bias ? bias[j] : T(0);
+        for (size_t i = 0; i < m; ++i) {
+            T& c = C[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC];
+            c = (beta != T(0) ? tile[j][i] + beta * c : tile[j][i]) + b;
+            if (relu && !(c > T(0)))
+                c = T(0);
+            if (gate && !(gate[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC] > T(0)))
+                c = T(0);
+        }
+    }
+}
+
+
+// A single row or column of C is a matrix-vector product; padding it to a full MR x NR
+// tile would waste most of the microkernel, so it goes to the matvec kernels instead:
+// M == 1 computes c^T = B^T a^T, N == 1 computes c = A b.
+template<typename T>
+void gemvPath(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+              T alpha, T beta) {
+    const bool rowCase = A.rows == 1;
+    const GemmOperand<T> mat = rowCase ? B.transposed() : A;
+    const T* xs = rowCase ? A.data : B.data;
+    const ptrdiff_t xStride = rowCase ? A.cs : B.rs;
+    const ptrdiff_t yStride = rowCase ? csC : rsC;
+    const size_t len = mat.rows, K = mat.cols;
+
+    thread_local PackBuffer<T> xBuf, yBuf;
+    T* x = xBuf.get(K);
+    T* y = yBuf.get(len);
+    for (size_t k = 0; k < K; ++k)
+        x[k] = xs[static_cast<ptrdiff_t>(k) * xStride];
+    if (mat.cs == 1) {
+        matvec_detail::gemv(mat.data, len, K, static_cast<size_t>(mat.rs), x, y);
+    } else if (mat.rs == 1) {
+        matvec_detail::gemvTransposed(mat.data, K, len, static_cast<size_t>(mat.cs), x, y);
+    } else {
+        for (size_t l = 0; l < len; ++l) {
+            T t = T(0);
+            for (size_t k = 0; k < K; ++k)
+                t += mat.data[static_cast<ptrdiff_t>(l) * mat.rs + static_cast<ptrdiff_t>(k) * mat.cs] * x[k];
+            y[l] = t;
+        }
+    }
+    for (size_t l = 0; l < len; ++l) {
+        T& c = C[static_cast<ptrdiff_t>(l) * yStride];
+        c = beta != T(0) ? alpha * y[l] + beta * c : alpha * y[l];
+    }
+}
+
+// K == 1 is an outer product: no reduction to block for, so stream C along its
+// contiguous dimension (via C^T = B^T A^T for column-major C).
+template<typename T>
+void outerProduct(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                  T alpha, T beta) {
+    if (rsC == 1 && csC != 1) {
+        outerProduct(B.transposed(), A.transposed(), C, csC, rsC, alpha, beta);
+        return;
+    }
+    const long M = static_cast<long>(A.rows);
+    const size_t N = B.cols;
+    const T* b = B.data;
+    const ptrdiff_t csB = B.cs;
+    #pragma omp parallel for schedule(static) if (A.rows * N >= kParallelMinWork / 4)
+    for (long i = 0; i < M; ++i) {
+        const T a = alpha * A.data[i * A.rs];
+        T* c = C + i * rsC;
+        if (csC == 1 && csB == 1 && beta == T(0)) {
+            for (size_t j = 0; j < N; ++j)
+                c[j] = a * b[j];
+        } else if (csC == 1 && csB == 1) {
+            for (size_t j = 0; j < N; ++j)
+                c[j] = a * b[j] + beta * c[j];
+        } else {
+            for (size_t j = 0; j < N; ++j) {
+                T& cij = c[static_cast<ptrdiff_t>(j) * csC];
+                const T ab = a * b[static_cast<ptrdiff_t>(j) * csB];
+                cij = beta != T(0) ? ab + beta * cij : ab;
+            }
+        }
+    }
+}
+
+// Narrow products, as in the 10-class output layer: a dimension of at most kSkinnyMax
+// would be padded to a full MR x NR tile, and packing an operand that is streamed only
+// once does not pay off. These kernels keep the narrow dimension in registers instead.
+inline constexpr size_t kSkinnyMax = 16;
+#if defined(__AVX512F__)
+inline constexpr size_t kVectorRegisters = 32;
+#else
+inline constexpr size_t kVectorRegisters = 16;
+#endif
+
+// c[0:W] = alpha * acc + beta * c[0:W], for contiguous c.
+template<typename T>
+inline void storeScaled(T* c, typename simd::Packet<T>::type acc, T alpha, T beta, const T* gate = nullptr) {
+    using P = simd::Packet<T>;
+    typename P::type r = P::mul(acc, P::set1(alpha));
+    if (beta != T(0))
+        r = P::fmadd(P::loadu(c), P::set1(beta), r);
+    if (gate)
+        r = P::selectPositive(P::loadu(gate), r);
+    P::storeu(c, r);
+}
+
+template<typename T>
+inline void storeScaled(T& c, T acc, T alpha, T beta, const T* gate = nullptr) {
+    c = beta != T(0) ? alpha * acc + beta * c : alpha * acc;
+    if (gate && !(*gate > T(0)))
+        c = T(0);
+}
+
+// c[0:W] = acc + bias, then the ReLU: a layer's output with the epilogue in the store.
+template<typename T>
+inline void storeBiased(T* c, typename simd::Packet<T>::type acc, T bias, bool relu) {
+    using P = simd::Packet<T>;
+    typename P::type r = P::add(acc, P::set1(bias));
+    if (relu)
+        r = P::max(r, P::zero());
+    P::storeu(c, r);
+}
+
+template<typename T>
+inline void storeBiased(T& c, T acc, T bias, bool relu) {
+    c = acc + bias;
+    if (relu && !(c > T(0)))
+        c = T(0);
+}
+
+// C zeroed where gate, laid out like C, is not positive; for the paths that do not fuse it.
+template<typename T>
+void applyGate(T* C, ptrdiff_t rsC, ptrdiff_t csC, size_t M, size_t N, const T* gate) {
+    if (!gate)
+        return;
+    for (size_t j = 0; j < N; ++j)
+        for (size_t i = 0; i < M; ++i) {
+            const ptrdiff_t o = static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC;
+            if (!(gate[o] > T(0)))
+                C[o] = T(0);
+        }
+}
+
+// Calls fn.template operator()<n>() for a runtime width 1 <= n <= kSkinnyMax.
+template<typename Fn, size_t... Ns>
+void withWidth(size_t n, Fn&& fn, std::index_sequence<Ns...>) {
+    ((n == Ns + 1 ? (fn.template operator()<Ns + 1>(), true) : false) || ...);
+}
+
+// C (M x N) = A * B for column-contiguous A (A.rs == 1), with B stored row by row
+// (Bp[k * ldb + j]). Each packet of W rows keeps its N accumulators in registers while
+// streaming over the columns of A. A non-null epilogue replaces alpha and beta: C = A * B
+// + bias, then the ReLU, into column-contiguous C (rsC == 1).
+template<typename T, size_t N>
+void skinnyNColumnA(const GemmOperand<T>& A, const T* Bp, size_t ldb, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                    T alpha, T beta, const GemmEpilogue<T>* epilogue = nullptr) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    const size_t M = A.rows, K = A.cols;
+    const long blocks = static_cast<long>(M / W);
+    #pragma omp parallel for schedule(static) if (M * N * K >= kParallelMinWork)
+    for (long blk = 0; blk < blocks; ++blk) {
+        const size_t i0 = static_cast<size_t>(blk) * W;
+        const T* a = A.data + i0;
+        typename P::type acc[N];
+        for (size_t j = 0; j < N; ++j)
+            acc[j] = P::zero();
+        for (size_t k = 0; k < K; ++k) {
+            const typename P::type av = P::loadu(a + static_cast<ptrdiff_t>(k) * A.cs);
+            for (size_t j = 0; j < N; ++j)
+                acc[j] = P::fmadd(av, P::set1(Bp[k * ldb + j]), acc[j]);
+        }
+        T* c = C + static_cast<ptrdiff_t>(i0) * rsC;
+        for (size_t j = 0; j < N; ++j) {
+            if (epilogue) {
+                storeBiased(c + static_cast<ptrdiff_t>(j) * csC, acc[j], epilogue->bias ? epilogue->bias[j] : T(0),
+                            epilogue->relu);
+            } else if (rsC == 1) {
+                storeScaled(c + static_cast<ptrdiff_t>(j) * csC, acc[j], alpha, beta);
+            } else {
+                alignas(64) T lanes[W];
+                P::storeu(lanes, acc[j]);
+                for (size_t i = 0; i < W; ++i)
+                    storeScaled(c[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC], lanes[i], alpha, beta);
+            }
+        }
+    }
+    for (size_t i = static_cast<size_t>(blocks) * W; i < M; ++i) {
+        T acc[N] = {};
+        for (size_t k = 0; k < K; ++k) {
+            const T av = A.data[static_cast<ptrdiff_t>(i) + static_cast<ptrdiff_t>(k) * A.cs];
+            for (size_t j = 0; j < N; ++j)
+                acc[j] += av * Bp[k * ldb + j];
+        }
+        for (size_t j = 0; j < N; ++j) {
+            T& c = C[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC];
+            if (epilogue)
+                storeBiased(c, acc[j], epilogue->bias ? epilogue->bias[j] : T(0), epilogue->relu);
+            else
+                storeScaled(c, acc[j], alpha, beta);
+        }
+    }
+}
+
+// C (M x N) = A * B for row-contiguous A (A.cs == 1) and column-contiguous B (B.rs == 1):
+// N dot products per row of A, vectorized along K, two rows at a time when the
+// accumulators fit the register file.
+template<typename T, size_t N>
+void skinnyNRowA(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                 T alpha, T beta) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    constexpr size_t RT = 2 * N + 3 <= kVectorRegisters ? 2 : 1;
+    const size_t M = A.rows, K = A.cols;
+    const long tiles = static_cast<long>((M + RT - 1) / RT);
+    #pragma omp parallel for schedule(static) if (M * N * K >= kParallelMinWork)
+    for (long t = 0; t < tiles; ++t) {
+        const size_t i0 = static_cast<size_t>(t) * RT;
+        const size_t rows = std::min(RT, M - i0);
+        const T* a[RT];
+        for (size_t r = 0; r < RT; ++r)
+            a[r] = A.data + static_cast<ptrdiff_t>(i0 + std::min(r, rows - 1)) * A.rs;
+        typename P::type acc[RT][N];
+        for (size_t r = 0; r < RT; ++r)
+            for (size_t j = 0; j < N; ++j)
+                acc[r][j] = P::zero();
+        size_t k = 0;
+        for (; k + W <= K; k += W) {
+            typename P::type av[RT];
+            for (size_t r = 0; r < RT; ++r)
+                av[r] = P::loadu(a[r] + k);
+            for (size_t j = 0; j < N; ++j) {
+                const typename P::type bv = P::loadu(B.data + static_cast<ptrdiff_t>(j) * B.cs + k);
+                for (size_t r = 0; r < RT; ++r)
+                    acc[r][j] = P::fmadd(av[r], bv, acc[r][j]);
+            }
+        }
+        for (size_t r = 0; r < rows; ++r)
+            for (size_t j = 0; j < N; ++j) {
+                T sum = P::reduceAdd(acc[r][j]);
+                const T* b = B.data + static_cast<ptrdiff_t>(j) * B.cs;
+                for (size_t kk = k; kk < K; ++kk)
+                    sum += a[r][kk] * b[kk];
+                storeScaled(C[static_cast<ptrdiff_t>(i0 + r) * rsC + static_cast<ptrdiff_t>(j) * csC], sum, alpha, beta);
+            }
+    }
+}
+
+// Narrow-N product; returns false if neither operand layout suits the kernels.
+template<typename T>
+bool skinnyN(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+             T alpha, T beta) {
+    const size_t N = B.cols, K = A.cols;
+    if (A.rs == 1) {
+        // Row-contiguous B (row-major, or a packed panel) is read in place.
+        const T* Bp = B.data;
+        size_t ldb = static_cast<size_t>(B.rs);
+        if (B.cs != 1 || B.rs < static_cast<ptrdiff_t>(N)) {
+            thread_local PackBuffer<T> bBuf;
+            T* packed = bBuf.get(K * N);
+            for (size_t k = 0; k < K; ++k)
+                for (size_t j = 0; j < N; ++j)
+                    packed[k * N + j] = B.data[static_cast<ptrdiff_t>(k) * B.rs + static_cast<ptrdiff_t>(j) * B.cs];
+            Bp = packed;
+            ldb = N;
+        }
+        withWidth(N, [&]<size_t NN>() { skinnyNColumnA<T, NN>(A, Bp, ldb, C, rsC, csC, alpha, beta); },
+                  std::make_index_sequence<kSkinnyMax>());
+        return true;
+    }
+    if (A.cs == 1 && B.rs == 1) {
+        withWidth(N, [&]<size_t NN>() { skinnyNRowA<T, NN>(A, B, C, rsC, csC, alpha, beta); },
+                  std::make_index_sequence<kSkinnyMax>());
+        return true;
+    }
+    return false;
+}
+
+// C (M x N, column stride ldc) = A * B + bias, then the ReLU, for column-contiguous A and
+// B a single packed panel of exactly N columns. The width is a template argument rather
+// than dispatched per call, and the epilogue is fused into the stores instead of a second
+// pass over C as in gemmPrepacked. KernelTable::gemmPackedNarrow holds one per width.
+template<typename T, size_t N>
+void gemmPackedNarrow(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, size_t ldc,
+                      const GemmEpilogue<T>& epilogue) {
+    static_assert(N <= kSkinnyMax && N <= kPackedPanelWidth, "gemmPackedNarrow: B must be one narrow panel");
+    skinnyNColumnA<T, N>(A, B.data, kPackedPanelWidth, C, 1, static_cast<ptrdiff_t>(ldc), T(1), T(0), &epilogue);
+}
+
+// Narrow-K product, C = A * B with K <= kSkinnyMax: every column of C is a short linear
+// combination of the columns of A, which stay in cache while C is streamed once. A
+// non-null gate (laid out like C) zeroes C where it is not positive as C is stored.
+// Returns false if C has no contiguous dimension.
+template<typename T>
+bool skinnyK(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+             T alpha, T beta, const T* gate = nullptr) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    if (rsC != 1) {
+        if (csC != 1)
+            return false;
+        return skinnyK(B.transposed(), A.transposed(), C, csC, rsC, alpha, beta, gate);
+    }
+    const size_t M = A.rows, N = B.cols, K = A.cols;
+    const T* a = A.data;
+    ptrdiff_t lda = A.cs;
+    if (A.rs != 1) {
+        thread_local PackBuffer<T> aBuf;
+        T* Ap = aBuf.get(M * K);
+        for (size_t k = 0; k < K; ++k)
+            for (size_t i = 0; i < M; ++i)
+                Ap[k * M + i] = A.data[static_cast<ptrdiff_t>(i) * A.rs + static_cast<ptrdiff_t>(k) * A.cs];
+        a = Ap;
+        lda = static_cast<ptrdiff_t>(M);
+    }
+    // Two columns of C per step share every load of A: 4 x 2 independent accumulators.
+    const long pairs = static_cast<long>((N + 1) / 2);
+    #pragma omp parallel for schedule(static) if (M * N * K >= kParallelMinWork)
+    for (long jp = 0; jp < pairs; ++jp) {
+        const size_t j0 = static_cast<size_t>(jp) * 2;
+        const size_t nj = std::min<size_t>(2, N - j0);
+        T bk[2][kSkinnyMax];
+        for (size_t jj = 0; jj < 2; ++jj)
+            for (size_t k = 0; k < K; ++k)
+                bk[jj][k] = B.data[static_cast<ptrdiff_t>(j0 + std::min(jj, nj - 1)) * B.cs +
+                                   static_cast<ptrdiff_t>(k) * B.rs];
+        T* c[2] = { C + static_cast<ptrdiff_t>(j0) * csC, C + static_cast<ptrdiff_t>(j0 + nj - 1) * csC };
+        const T* g[2] = { gate ? gate + static_cast<ptrdiff_t>(j0) * csC : nullptr,
+                          gate ? gate + static_cast<ptrdiff_t>(j0 + nj - 1) * csC : nullptr };
+        size_t i = 0;
+        for (; i + 4 * W <= M; i += 4 * W) {
+            typename P::type acc[2][4];
+            for (size_t jj = 0; jj < 2; ++jj)
+                for (size_t u = 0; u < 4; ++u)
+                    acc[jj][u] = P::zero();
+            for (size_t k = 0; k < K; ++k) {
+                const T* ak = a + static_cast<ptrdiff_t>(k) * lda + i;
+                const typename P::type b0 = P::set1(bk[0][k]), b1 = P::set1(bk[1][k]);
+                for (size_t u = 0; u < 4; ++u) {
+                    const typename P::type av = P::loadu(ak + u * W);
+                    acc[0][u] = P::fmadd(av, b0, acc[0][u]);
+                    acc[1][u] = P::fmadd(av, b1, acc[1][u]);
+                }
+            }
+            for (size_t jj = 0; jj < nj; ++jj)
+                for (size_t u = 0; u < 4; ++u)
+                    storeScaled(c[jj] + i + u * W, acc[jj][u], alpha, beta, g[jj] ? g[jj] + i + u * W : nullptr);
+        }
+        for (; i + W <= M; i += W) {
+            typename P::type acc0 = P::zero(), acc1 = P::zero();
+            for (size_t k = 0; k < K; ++k) {
+                const typename P::type av = P::loadu(a + static_cast<ptrdiff_t>(k) * lda + i);
+                acc0 = P::fmadd(av, P::set1(bk[0][k]), acc0);
+                acc1 = P::fmadd(av, P::set1(bk[1][k]), acc1);
+            }
+            storeScaled(c[0] + i, acc0, alpha, beta, g[0] ? g[0] + i : nullptr);
+            if (nj == 2)
+                storeScaled(c[1] + i, acc1, alpha, beta, g[1] ? g[1] + i : nullptr);
+        }
+        for (; i < M; ++i)
+            for (size_t jj = 0; jj < nj; ++jj) {
+                T acc = T(0);
+                for (size_t k = 0; k < K; ++k)
+                    acc += a[static_cast<ptrdiff_t>(k) * lda + i] * bk[jj][k];
+                storeScaled(c[jj][i], acc, alpha, beta, g[jj] ? g[jj] + i : nullptr);
+            }
+    }
+    return true;
+}
+
+// The full GEMM for this ISA: shape-specific paths first, then the blocked loops with
+// the blocking from params. A non-null gate (laid out like C) zeroes C where it is not
+// positive, e.g. a ReLU backward on the product; the skinny-K and blocked paths apply it
+// as they store C, the others in a pass after the product.
+template<typename T>
+void gemmBlocked(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                 T alpha, T beta, const T* gate, const dispatch::GemmParams& params) {
+    using BK = Blocking<T>;
+    const size_t M = A.rows, N = B.cols, K = A.cols;
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0) {
+        for (size_t j = 0; j < N; ++j)
+            for (size_t i = 0; i < M; ++i) {
+                T& c = C[static_cast<ptrdiff_t>(i) * rsC + static_cast<ptrdiff_t>(j) * csC];
+                c = beta != T(0) ? beta * c : T(0);
+            }
+        applyGate(C, rsC, csC, M, N, gate);
+        return;
+    }
+    if (K == 1) {
+        outerProduct(A, B, C, rsC, csC, alpha, beta);
+        applyGate(C, rsC, csC, M, N, gate);
+        return;
+    }
+    if (M == 1 || N == 1) {
+        gemvPath(A, B, C, rsC, csC, alpha, beta);
+        applyGate(C, rsC, csC, M, N, gate);
+        return;
+    }
+    if ((N <= kSkinnyMax && skinnyN(A, B, C, rsC, csC, alpha, beta)) ||
+        (M <= kSkinnyMax && skinnyN(B.transposed(), A.transposed(), C, csC, rsC, alpha, beta))) {
+        applyGate(C, rsC, csC, M, N, gate);
+        return;
+    }
+    if (K <= kSkinnyMax && skinnyK(A, B, C, rsC, csC, alpha, beta, gate))
+        return;
+    // The microkernel stores full tiles directly only into column-contiguous C.
+    if (rsC != 1 && csC == 1) {
+        gemmBlocked(B.transposed(), A.transposed(), C, csC, rsC, alpha, beta, gate, params);
+        return;
+    }
+
+    const BlockSizes<T> bs(params);
+    thread_local PackBuffer<T> aBuf, bBuf;
+    T* Ap = aBuf.get(bs.mc * bs.kc);
+    T* Bp = bBuf.get(bs.kc * BlockSizes<T>::roundUp(std::min(N, bs.nc), BK::NR));
+    const bool parallel = M * N * K >= kParallelMinWork;
+
+    for (size_t jc = 0; jc < N; jc += bs.nc) {
+        const size_t nc = std::min(bs.nc, N - jc);
+        for (size_t pc = 0; pc < K; pc += bs.kc) {
+            const size_t kc = std::min(bs.kc, K - pc);
+            const T betaPc = pc == 0 ? beta : T(1);
+            const T* gatePc = pc + kc == K ? gate : nullptr;
+            packB(B.data + static_cast<ptrdiff_t>(pc) * B.rs + static_cast<ptrdiff_t>(jc) * B.cs,
+                  B.rs, B.cs, kc, nc, Bp, bs.threads);
+            for (size_t ic = 0; ic < M; ic += bs.mc) {
+                const size_t mc = std::min(bs.mc, M - ic);
+                packA(A.data + static_cast<ptrdiff_t>(ic) * A.rs + static_cast<ptrdiff_t>(pc) * A.cs,
+                      A.rs, A.cs, mc, kc, Ap, bs.threads);
+                const long nPanels = static_cast<long>((nc + BK::NR - 1) / BK::NR);
+                const long mPanels = static_cast<long>((mc + BK::MR - 1) / BK::MR);
+                #pragma omp parallel for collapse(2) schedule(static) if (parallel) num_threads(bs.threads)
+                for (long jr = 0; jr < nPanels; ++jr)
+                    for (long ir = 0; ir < mPanels; ++ir) {
+                        const size_t j = static_cast<size_t>(jr) * BK::NR, i = static_cast<size_t>(ir) * BK::MR;
+                        const ptrdiff_t o = static_cast<ptrdiff_t>(ic + i) * rsC + static_cast<ptrdiff_t>(jc + j) * csC;
+                        microKernel(kc, Ap + i * kc, Bp + j * kc, BK::NR, C + o, rsC, csC, std::min(BK::MR, mc - i),
+                                    std::min(BK::NR, nc - j), alpha, betaPc, static_cast<const T*>(nullptr), false,
+                                    gatePc ? gatePc + o : nullptr);
+                    }
+            }
+        }
+    }
+}
+
+// Strided view of panel p of a pre-packed operand (its real columns only).
+template<typename T>
+inline GemmOperand<T> panelOperand(const PackedPanels<T>& B, size_t p) {
+    const size_t j0 = p * kPackedPanelWidth;
+    return { B.data + p * B.panelStride, B.rows, std::min(kPackedPanelWidth, B.cols - j0),
+             static_cast<ptrdiff_t>(kPackedPanelWidth), 1 };
+}
+
+// The same as T: a bf16 panel is widened into buf first.
+template<typename T, typename S>
+inline GemmOperand<T> panelOperand(const PackedPanels<S>& B, size_t p, PackBuffer<T>& buf) {
+    if constexpr (std::is_same_v<S, T>) {
+        return panelOperand(B, p);
+    } else {
+        T* wide = buf.get(B.rows * kPackedPanelWidth);
+        widenPanels(B, p, p + 1, 0, B.rows, wide);
+        return { wide, B.rows, std::min(kPackedPanelWidth, B.cols - p * kPackedPanelWidth),
+                 static_cast<ptrdiff_t>(kPackedPanelWidth), 1 };
+    }
+}
+
+// c^T = a^T * B for a single row a against pre-packed B: row k of every panel is
+// contiguous, so each panel is one pass over K with kPackedPanelWidth accumulators.
+template<typename T, typename S>
+void gemvPacked(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t csC, T alpha, T beta,
+                const GemmEpilogue<T>& epilogue) {
+    constexpr size_t PW = kPackedPanelWidth;
+    const size_t K = B.rows;
+    const long panels = static_cast<long>((B.cols + PW - 1) / PW);
+    #pragma omp parallel for schedule(static) if (K * B.cols >= kParallelMinWork)
+    for (long p = 0; p < panels; ++p) {
+        const RawElement<S>* w = raw(B.data + static_cast<size_t>(p) * B.panelStride);
+        // Two interleaved accumulator sets halve the dependency chains along K.
+        T acc[2][PW] = {};
+        size_t k = 0;
+        for (; k + 2 <= K; k += 2)
+            for (size_t u = 0; u < 2; ++u) {
+                const T a = A.data[static_cast<ptrdiff_t>(k + u) * A.cs];
+                for (size_t j = 0; j < PW; ++j)
+                    acc[u][j] += a * widen<T>(w[(k + u) * PW + j]);
+            }
+        for (; k < K; ++k) {
+            const T a = A.data[static_cast<ptrdiff_t>(k) * A.cs];
+            for (size_t j = 0; j < PW; ++j)
+                acc[0][j] += a * widen<T>(w[k * PW + j]);
+        }
+        for (size_t j = 0; j < PW; ++j)
+            acc[0][j] += acc[1][j];
+        const size_t j0 = static_cast<size_t>(p) * PW, n = std::min(PW, B.cols - j0);
+        for (size_t j = 0; j < n; ++j) {
+            T& c = C[static_cast<ptrdiff_t>(j0 + j) * csC];
+            storeScaled(c, acc[0][j], alpha, beta);
+            if (epilogue.bias)
+                c += epilogue.bias[j0 + j];
+            if (epilogue.relu && !(c > T(0)))
+                c = T(0);
+        }
+    }
+}
+
+// The epilogue as a separate pass over C, for the paths that do not fuse it.
+template<typename T>
+void applyEpilogue(T* C, ptrdiff_t rsC, ptrdiff_t csC, size_t M, size_t N, const GemmEpilogue<T>& epilogue) {
+    if (!epilogue.bias && !epilogue.relu)
+        return;
+    for (size_t j = 0; j < N; ++j) {
+        const T b = epilogue.bias ? epilogue.bias[j] : T(0);
+        T* c = C + static_cast<ptrdiff_t>(j) * csC;
+        for (size_t i = 0; i < M; ++i) {
+            T& v = c[static_cast<ptrdiff_t>(i) * rsC];
+            v += b;
+            if (epilogue.relu && !(v > T(0)))
+                v = T(0);
+        }
+    }
+}
+
+// gemmBlocked for pre-packed B: the blocked loops hand the stored panels straight to the
+// microkernel, so only A is packed, and the epilogue is applied by the microkernel in the
+// last KC block. A single row of C, or B of one panel, goes to the row and narrow paths
+// instead. bf16 panels (S = Eigen::bfloat16) are widened to T one KC x NC block at a
+// time, which then serves every row block of A.
+template<typename T, typename S>
+void gemmPrepacked(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                   T alpha, T beta, const GemmEpilogue<T>& epilogue, const dispatch::GemmParams& params) {
+    using BK = Blocking<T>;
+    constexpr size_t PW = kPackedPanelWidth;
+    static_assert(PW % BK::NR == 0, "packed panels must split into microkernel panels");
+    const size_t M = A.rows, N = B.cols, K = A.cols;
+    if (M == 0 || N == 0)
+        return;
+    if (M == 1 && K > 0) {
+        gemvPacked(A, B, C, csC, alpha, beta, epilogue);
+        return;
+    }
+    const size_t panels = (N + PW - 1) / PW;
+    if (K <= 1 || panels == 1) {
+        thread_local PackBuffer<T> wide;
+        for (size_t p = 0; p < panels; ++p)
+            gemmBlocked(A, panelOperand(B, p, wide), C + static_cast<ptrdiff_t>(p * PW) * csC, rsC, csC, alpha, beta,
+                        static_cast<const T*>(nullptr), params);
+        applyEpilogue(C, rsC, csC, M, N, epilogue);
+        return;
+    }
+
+    const BlockSizes<T> bs(params);
+    thread_local PackBuffer<T> aBuf, bBuf;
+    T* Ap = aBuf.get(bs.mc * bs.kc);
+    const bool parallel = M * N * K >= kParallelMinWork;
+
+    for (size_t jc = 0; jc < N; jc += bs.nc) {
+        const size_t nc = std::min(bs.nc, N - jc);
+        const size_t q0 = jc / PW, q1 = (jc + nc + PW - 1) / PW;
+        for (size_t pc = 0; pc < K; pc += bs.kc) {
+            const size_t kc = std::min(bs.kc, K - pc);
+            const T betaPc = pc == 0 ? beta : T(1);
+            const bool last = pc + kc == K;
+            const T* bias = last ? epilogue.bias : nullptr;
+            T* wide = nullptr;
+            if constexpr (!std::is_same_v<S, T>) {
+                wide = bBuf.get((q1 - q0) * kc * PW);
+                widenPanels(B, q0, q1, pc, kc, wide);
+            }
+            for (size_t ic = 0; ic < M; ic += bs.mc) {
+                const size_t mc = std::min(bs.mc, M - ic);
+                packA(A.data + static_cast<ptrdiff_t>(ic) * A.rs + static_cast<ptrdiff_t>(pc) * A.cs,
+                      A.rs, A.cs, mc, kc, Ap, bs.threads);
+                const long nPanels = static_cast<long>((nc + BK::NR - 1) / BK::NR);
+                const long mPanels = static_cast<long>((mc + BK::MR - 1) / BK::MR);
+                #pragma omp parallel for collapse(2) schedule(static) if (parallel) num_threads(bs.threads)
+                for (long jr = 0; jr < nPanels; ++jr)
+                    for (long ir = 0; ir < mPanels; ++ir) {
+                        const size_t j = jc + static_cast<size_t>(jr) * BK::NR, i = static_cast<size_t>(ir) * BK::MR;
+                        const T* bp;
+                        if constexpr (std::is_same_v<S, T>)
+                            bp = B.data + (j / PW) * B.panelStride + pc * PW + j % PW;
+                        else
+                            bp = wide + (j / PW - q0) * kc * PW + j % PW;
+                        T* c = C + static_cast<ptrdiff_t>(ic + i) * rsC + static_cast<ptrdiff_t>(j) * csC;
+                        microKernel(kc, Ap + i * kc, bp, PW, c, rsC, csC, std::min(BK::MR, mc - i),
+                                    std::min(BK::NR, N - j), alpha, betaPc, bias ? bias + j : nullptr,
+                                    last && epilogue.relu);
+                    }
+            }
+        }
+    }
+}
+
+} // namespace SIMD_ISA
+} // namespace gemm_detail
+
+// C = alpha * A * B + beta * C, then zeroed where gate (laid out like C) is not positive,
+// i.e. the product followed by a ReLU backward with gate the ReLU output, with the given
+// blocking. float and double go through the kernels selected for the host CPU.
+template<typename T>
+void gemmGated(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC, const T* gate,
+               T alpha, T beta, const dispatch::GemmParams& params) {
+    if (A.cols != B.rows)
+        throw std::invalid_argument("gemm: inner dimensions do not match");
+    if constexpr (dispatch::hasKernels<T>)
+        dispatch::kernels<T>().gemm(A, B, C, rsC, csC, alpha, beta, gate, params);
+    else
+        gemm_detail::gemmBlocked(A, B, C, rsC, csC, alpha, beta, gate, params);
+}
+
+// C = alpha * A * B + beta * C, with C (A.rows x B.cols) at C[i * rsC + j * csC], using
+// the given blocking.
+template<typename T>
+void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+          T alpha, T beta, const dispatch::GemmParams& params) {
+    if (A.cols != B.rows)
+        throw std::invalid_argument("gemm: inner dimensions do not match");
+    gemmGated(A, B, C, rsC, csC, static_cast<const T*>(nullptr), alpha, beta, params);
+}
+
+// The same with the blocking tuned for this shape, if the host profile has one.
+template<typename T>
+void gemm(const GemmOperand<T>& A, const GemmOperand<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+          T alpha = T(1), T beta = T(0)) {
+    gemm(A, B, C, rsC, csC, alpha, beta, tuning::gemmParams(sizeof(T), A.rows, B.cols, A.cols));
+}
+
+// Eigen convenience overload: C = alpha * A * B + beta * C. C must already have the
+// right size; A and B may be any directly addressable expressions (blocks, .transpose()).
+template<typename DA, typename DB, typename DC>
+void gemm(const Eigen::DenseBase<DA>& A, const Eigen::DenseBase<DB>& B, Eigen::DenseBase<DC>& C,
+          typename DC::Scalar alpha = 1, typename DC::Scalar beta = 0) {
+    GemmOperand<typename DC::Scalar> c = gemmOperand(C);
+    if (c.rows != static_cast<size_t>(A.rows()) || c.cols != static_cast<size_t>(B.cols()))
+        throw std::invalid_argument("gemm: output has the wrong size");
+    gemm(gemmOperand(A), gemmOperand(B), C.derived().data(), c.rs, c.cs, alpha, beta);
+}
+
+// C = alpha * A * B + beta * C, then the epilogue, for pre-packed B (e.g.
+// PackedMatrix::view()). B may also be a bf16 copy of T = float or double weights
+// (mixed precision): the kernels widen it block by block and everything else stays in T.
+template<typename T, typename S>
+void gemm(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+          T alpha, T beta, const GemmEpilogue<T>& epilogue, const dispatch::GemmParams& params) {
+    static_assert(std::is_same_v<S, T> || std::is_same_v<S, Eigen::bfloat16>, "B holds T or bf16");
+    if (A.cols != B.rows)
+        throw std::invalid_argument("gemm: inner dimensions do not match");
+    if constexpr (dispatch::hasKernels<T> && std::is_same_v<S, T>)
+        dispatch::kernels<T>().gemmPacked(A, B, C, rsC, csC, alpha, beta, epilogue, params);
+    else if constexpr (dispatch::hasKernels<T>)
+        dispatch::kernels<T>().gemmPackedBf16(A, B, C, rsC, csC, alpha, beta, epilogue, params);
+    else
+        gemm_detail::gemmPrepacked(A, B, C, rsC, csC, alpha, beta, epilogue, params);
+}
+
+template<typename T, typename S>
+void gemm(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+          T alpha, T beta, const dispatch::GemmParams& params) {
+    gemm(A, B, C, rsC, csC, alpha, beta, GemmEpilogue<T>{}, params);
+}
+
+template<typename T, typename S>
+void gemm(const GemmOperand<T>& A, const PackedPanels<S>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+          T alpha = T(1), T beta = T(0), const GemmEpilogue<T>& epilogue = {}) {
+    gemm(A, B, C, rsC, csC, alpha, beta, epilogue, tuning::gemmParams(sizeof(T), A.rows, B.cols, A.cols));
+}
+
+template<typename DA, typename DC>
+void gemm(const Eigen::DenseBase<DA>& A, const PackedPanels<typename DC::Scalar>& B, Eigen::DenseBase<DC>& C,
+          typename DC::Scalar alpha = 1, typename DC::Scalar beta = 0) {
+    GemmOperand<typename DC::Scalar> c = gemmOperand(C);
+    if (c.rows != static_cast<size_t>(A.rows()) || c.cols != B.cols)
+        throw std::invalid_argument("gemm: output has the wrong size");
+    gemm(gemmOperand(A), B, C.derived().data(), c.rs, c.cs, alpha, beta);
+}
+
+// C = alpha * A * B^T + beta * C for pre-packed B, gated like gemmGated() if gate is
+// given. A single panel is a strided operand and is used in place; wider B is first
+// unpacked, as the panel layout has no transposed view that the kernels could stream.
+template<typename T>
+void gemmTransposed(const GemmOperand<T>& A, const PackedPanels<T>& B, T* C, ptrdiff_t rsC, ptrdiff_t csC,
+                    T alpha = T(1), T beta = T(0), const T* gate = nullptr) {
+    constexpr size_t PW = kPackedPanelWidth;
+    if (A.cols != B.cols)
+        throw std::invalid_argument("gemmTransposed: inner dimensions do not match");
+    const auto params = tuning::gemmParams(sizeof(T), A.rows, B.rows, A.cols);
+    if (B.cols <= PW) {
+        gemmGated(A, gemm_detail::panelOperand(B, 0).transposed(), C, rsC, csC, gate, alpha, beta, params);
+        return;
+    }
+    thread_local std::vector<T> unpacked;
+    unpacked.resize(B.rows * B.cols);
+    for (size_t j0 = 0; j0 < B.cols; j0 += PW) {
+        const T* panel = B.data + (j0 / PW) * B.panelStride;
+        const size_t n = std::min(PW, B.cols - j0);
+        for (size_t k = 0; k < B.rows; ++k)
+            std::copy_n(panel + k * PW, n, unpacked.data() + k * B.cols + j0);
+    }
+    const GemmOperand<T> bt{ unpacked.data(), B.cols, B.rows, 1, static_cast<ptrdiff_t>(B.cols) };
+    gemmGated(A, bt, C, rsC, csC, gate, alpha, beta, params);
+}
+
+template<typename DA, typename DC>
+void gemmTransposed(const Eigen::DenseBase<DA>& A, const PackedPanels<typename DC::Scalar>& B,
+                    Eigen::DenseBase<DC>& C, typename DC::Scalar alpha = 1, typename DC::Scalar beta = 0) {
+    GemmOperand<typename DC::Scalar> c = gemmOperand(C);
+    if (c.rows != static_cast<size_t>(A.rows()) || c.cols != B.rows)
+        throw std::invalid_argument("gemmTransposed: output has the wrong size");
+    gemmTransposed(gemmOperand(A), B, C.derived().data(), c.rs, c.cs, alpha, beta);
+}
+
+// A matrix kept permanently in the pre-packed panel layout, so a layer can hold its
+// weights the way gemm() consumes them instead of packing them on every call. The
+// optimizer updates it in place with addScaled() or updatePanels(); padding columns stay
+// zero. save() and load() store the panels as they are, for inference-only runs.
+template<typename T>
+class PackedMatrix {
+public:
+    static constexpr size_t kPanelWidth = kPackedPanelWidth;
+
+    PackedMatrix() : PackedMatrix(0, 0) {}
+    PackedMatrix(size_t rows, size_t cols)
+        : rows_(rows), cols_(cols), panels_({ (cols + kPanelWidth - 1) / kPanelWidth, rows, kPanelWidth }) {}
+    template<typename Derived>
+    explicit PackedMatrix(const Eigen::DenseBase<Derived>& m)
+        : PackedMatrix(static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols())) {
+        for (Eigen::Index j = 0; j < m.cols(); ++j)
+            for (Eigen::Index i = 0; i < m.rows(); ++i)
+                (*this)(static_cast<size_t>(i), static_cast<size_t>(j)) = m(i, j);
+    }
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    T& operator()(size_t i, size_t j) { return panels_.data()[offset(i, j)]; }
+    const T& operator()(size_t i, size_t j) const { return panels_.data()[offset(i, j)]; }
+
+    PackedPanels<T> view() const { return topRows(rows_); }
+    // The first n rows, e.g. the weights without a trailing bias row.
+    PackedPanels<T> topRows(size_t n) const { return { panels_.data(), n, cols_, rows_ * kPanelWidth }; }
+
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> toDense() const {
+        Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> m(rows_, cols_);
+        for (size_t j = 0; j < cols_; ++j)
+            for (size_t i = 0; i < rows_; ++i)
+                m(i, j) = (*this)(i, j);
+        return m;
+    }
+
+    // this += alpha * G for a row-major rows() x cols() matrix G with row stride ldg.
+    // Row i of a panel and the matching run of row i of G are both contiguous.
+    void addScaled(const T* g, size_t ldg, T alpha) {
+        const long panels = static_cast<long>(panels_.dim(0));
+        #pragma omp parallel for schedule(static) if (rows_ * cols_ >= (size_t(1) << 18))
+        for (long p = 0; p < panels; ++p) {
+            const size_t j0 = static_cast<size_t>(p) * kPanelWidth, n = std::min(kPanelWidth, cols_ - j0);
+            T* w = panels_.data() + static_cast<size_t>(p) * rows_ * kPanelWidth;
+            for (size_t i = 0; i < rows_; ++i) {
+                const T* gi = g + i * ldg + j0;
+                T* wi = w + i * kPanelWidth;
+                for (size_t j = 0; j < n; ++j)
+                    wi[j] += alpha * gi[j];
+            }
+        }
+    }
+
+    // The same restricted to some rows: row rows[r] += alpha * G[r, :] for r < count, e.g.
+    // the weight rows of the input features present in a sparse batch.
+    void addScaledRows(const T* g, size_t ldg, const int32_t* rows, size_t count, T alpha) {
+        const long panels = static_cast<long>(panels_.dim(0));
+        #pragma omp parallel for schedule(static) if (count * cols_ >= (size_t(1) << 18))
+        for (long p = 0; p < panels; ++p) {
+            const size_t j0 = static_cast<size_t>(p) * kPanelWidth, n = std::min(kPanelWidth, cols_ - j0);
+            T* w = panels_.data() + static_cast<size_t>(p) * rows_ * kPanelWidth;
+            for (size_t r = 0; r < count; ++r) {
+                const T* gi = g + r * ldg + j0;
+                T* wi = w + static_cast<size_t>(rows[r]) * kPanelWidth;
+                for (size_t j = 0; j < n; ++j)
+                    wi[j] += alpha * gi[j];
+            }
+        }
+    }
+
+    // Runs an elementwise update over the panels, in parallel for large matrices:
+    // update(w, offset, gp, rows, n) per panel, where w = data() + offset holds its rows x n
+    // real columns with row stride kPanelWidth and gp the matching columns of the
+    // row-major G (its row stride is the caller's). State kept in the panel layout
+    // (storageSize() elements) shares the offsets.
+    template<typename Update>
+    void updatePanels(const T* g, Update&& update) {
+        const long panels = static_cast<long>(panels_.dim(0));
+        #pragma omp parallel for schedule(static) if (rows_ * cols_ >= (size_t(1) << 18))
+        for (long p = 0; p < panels; ++p) {
+            const size_t j0 = static_cast<size_t>(p) * kPanelWidth, n = std::min(kPanelWidth, cols_ - j0);
+            const size_t offset = static_cast<size_t>(p) * rows_ * kPanelWidth;
+            update(panels_.data() + offset, offset, g + j0, rows_, n);
+        }
+    }
+    // The panel storage: storageSize() elements, padding included. Two matrices of the
+    // same shape share the layout, e.g. the weights and a bf16 working copy of them.
+    T* data() { return panels_.data(); }
+    const T* data() const { return panels_.data(); }
+    size_t storageSize() const { return panels_.numElements(); }
+
+    void save(std::ostream& out) const {
+        const uint32_t header[4] = { kMagic, static_cast<uint32_t>(sizeof(T)), static_cast<uint32_t>(kPanelWidth), 0 };
+        const uint64_t dims[2] = { rows_, cols_ };
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+        out.write(reinterpret_cast<const char*>(panels_.data()),
+                  static_cast<std::streamsize>(panels_.numElements() * sizeof(T)));
+        if (!out)
+            throw std::runtime_error("PackedMatrix: write failed");
+    }
+    static PackedMatrix load(std::istream& in) {
+        uint32_t header[4];
+        uint64_t dims[2];
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+        if (!in || header[0] != kMagic)
+            throw std::runtime_error("PackedMatrix: not a packed matrix file");
+        if (header[1] != sizeof(T) || header[2] != kPanelWidth)
+            throw std::runtime_error("PackedMatrix: element type or panel width mismatch");
+        PackedMatrix m(static_cast<size_t>(dims[0]), static_cast<size_t>(dims[1]));
+        in.read(reinterpret_cast<char*>(m.panels_.data()),
+                static_cast<std::streamsize>(m.panels_.numElements() * sizeof(T)));
+        if (!in)
+            throw std::runtime_error("PackedMatrix: truncated file");
+        return m;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x4b504e4e; // "NNPK"
+
+    size_t offset(size_t i, size_t j) const {
+        return (j / kPanelWidth) * rows_ * kPanelWidth + i * kPanelWidth + j % kPanelWidth;
+    }
+
+    size_t rows_, cols_;
+    Tensor<T> panels_; // panels x rows x kPanelWidth
+};
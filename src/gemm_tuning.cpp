@@ -0,0 +1,280 @@
+#include "gemm_tuning.hpp"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include "gemm.hpp"
+
+namespace tuning {
+
+using dispatch::GemmParams;
+
+namespace {
+
+const char* typeName(size_t elementBytes) { return elementBytes == 4 ? "f32" : "f64"; }
+
+// "gemm <isa> <f32|f64> <m> <n> <k> <mc> <kc> <nc> <threads>"
+struct Entry {
+    std::string isa;
+    GemmShape shape;
+    GemmParams params;
+};
+
+bool parseEntry(const std::string& line, Entry& e) {
+    std::istringstream in(line);
+    std::string tag, type;
+    if (!(in >> tag >> e.isa >> type >> e.shape.m >> e.shape.n >> e.shape.k >> e.params.mc >> e.params.kc >>
+          e.params.nc >> e.params.threads) || tag != "gemm" || (type != "f32" && type != "f64"))
+        return false;
+    e.shape.elementBytes = type == "f32" ? 4 : 8;
+    std::string rest;
+    return !(in >> rest);
+}
+
+bool isComment(const std::string& line) {
+    return line.find_first_not_of(" \t") == std::string::npos || line[line.find_first_not_of(" \t")] == '#';
+}
+
+GemmProfile& profileStorage() {
+    static GemmProfile profile = [] {
+        try {
+            return GemmProfile::load(defaultProfilePath(), dispatch::activeIsa());
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: ignoring GEMM profile: " << e.what() << "\n";
+            return GemmProfile();
+        }
+    }();
+    return profile;
+}
+
+} // namespace
+
+const GemmParams* GemmProfile::find(const GemmShape& shape) const {
+    auto it = entries_.find(shape);
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+void GemmProfile::merge(const GemmProfile& other) {
+    for (const auto& [shape, params] : other.entries_)
+        entries_[shape] = params;
+}
+
+GemmProfile GemmProfile::load(const std::string& path, dispatch::Isa isa) {
+    GemmProfile profile;
+    std::ifstream file(path);
+    if (!file)
+        return profile;
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); ++lineNo) {
+        if (isComment(line))
+            continue;
+        Entry e;
+        if (!parseEntry(line, e))
+            throw std::runtime_error(path + ":" + std::to_string(lineNo) + ": malformed GEMM profile entry");
+        if (e.isa == dispatch::isaName(isa))
+            profile.set(e.shape, e.params);
+    }
+    return profile;
+}
+
+void GemmProfile::save(const std::string& path, dispatch::Isa isa) const {
+    std::vector<std::string> kept;
+    {
+        std::ifstream old(path);
+        std::string line;
+        Entry e;
+        while (std::getline(old, line))
+            if (!isComment(line) && parseEntry(line, e) && e.isa != dispatch::isaName(isa))
+                kept.push_back(line);
+    }
+    const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent);
+    std::ofstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot write GEMM profile: " + path);
+    file << "# nn_trainer GEMM profile: gemm <isa> <f32|f64> <m> <n> <k> <mc> <kc> <nc> <threads>\n";
+    for (const std::string& line : kept)
+        file << line << "\n";
+    for (const auto& [shape, p] : entries_)
+        file << "gemm " << dispatch::isaName(isa) << " " << typeName(shape.elementBytes) << " " << shape.m << " "
+             << shape.n << " " << shape.k << " " << p.mc << " " << p.kc << " " << p.nc << " " << p.threads << "\n";
+}
+
+std::string defaultProfilePath() {
+    if (const char* path = std::getenv("NN_GEMM_PROFILE"))
+        return path;
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    std::string dir;
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"))
+        dir = cache;
+    else if (const char* home = std::getenv("HOME"))
+        dir = std::string(home) + "/.cache";
+    else
+        dir = ".";
+    return dir + "/nn_trainer/gemm-" + host + ".profile";
+}
+
+const GemmProfile& activeProfile() { return profileStorage(); }
+
+void setActiveProfile(GemmProfile profile) { profileStorage() = std::move(profile); }
+
+GemmParams gemmParams(size_t elementBytes, size_t m, size_t n, size_t k) {
+    const GemmProfile& profile = profileStorage();
+    if (profile.empty())
+        return {};
+    const GemmParams* p = profile.find({ m, n, k, elementBytes });
+    return p ? *p : GemmParams{};
+}
+
+namespace {
+
+// Best of three mean run times in seconds, each over enough runs to last ~10 ms.
+double timeRuns(const std::function<void()>& run) {
+    using Clock = std::chrono::steady_clock;
+    run();
+    auto t0 = Clock::now();
+    run();
+    const double once = std::chrono::duration<double>(Clock::now() - t0).count();
+    const int reps = std::clamp(static_cast<int>(0.01 / std::max(once, 1e-7)), 1, 1000);
+    double best = std::numeric_limits<double>::infinity();
+    for (int trial = 0; trial < 3; ++trial) {
+        t0 = Clock::now();
+        for (int r = 0; r < reps; ++r)
+            run();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - t0).count() / reps);
+    }
+    return best;
+}
+
+// Candidate sizes up to the first one that covers the whole dimension.
+std::vector<size_t> upTo(std::initializer_list<size_t> sizes, size_t dim) {
+    std::vector<size_t> out;
+    for (size_t s : sizes) {
+        out.push_back(s);
+        if (s >= dim)
+            break;
+    }
+    return out;
+}
+
+std::vector<size_t> threadCounts() {
+    const size_t max = static_cast<size_t>(gemm_detail::maxThreads());
+    std::vector<size_t> out;
+    for (size_t t = 1; t < max; t *= 2)
+        out.push_back(t);
+    if (max > 1)
+        out.push_back(max);
+    return out;
+}
+
+// Coordinate search from the defaults: sweep one parameter at a time, keep the best,
+// and repeat the sweep once.
+GemmParams tuneShape(const GemmShape& s, const std::function<void(const GemmParams&)>& run,
+                     double& bestTime) {
+    const size_t wide = std::max(s.m, s.n);
+    struct Axis {
+        size_t GemmParams::*field;
+        std::vector<size_t> values;
+    };
+    const Axis axes[] = {
+        { &GemmParams::kc, upTo({ 64, 128, 192, 256, 384, 512 }, s.k) },
+        { &GemmParams::mc, upTo({ 32, 48, 64, 96, 128, 192, 256, 384 }, wide) },
+        { &GemmParams::nc, upTo({ 128, 256, 512, 1024, 2048, 4096 }, wide) },
+    };
+    GemmParams best;
+    bestTime = timeRuns([&] { run(best); });
+    for (int round = 0; round < 2; ++round) {
+        for (const Axis& axis : axes)
+            for (size_t v : axis.values) {
+                GemmParams p = best;
+                p.*axis.field = v;
+                const double t = timeRuns([&] { run(p); });
+                if (t < bestTime) {
+                    bestTime = t;
+                    best = p;
+                }
+            }
+        for (size_t threads : threadCounts()) {
+            GemmParams p = best;
+            p.threads = static_cast<int>(threads);
+            const double t = timeRuns([&] { run(p); });
+            if (t < bestTime) {
+                bestTime = t;
+                best = p;
+            }
+        }
+    }
+    return best;
+}
+
+template<typename T>
+GemmProfile tuneLayerGemmsFor(size_t batch, size_t inputs, size_t hidden, size_t outputs, std::ostream& log) {
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    GemmProfile profile;
+    const size_t layers[][2] = { { inputs, hidden }, { hidden, outputs } };
+    for (const auto& [in, out] : layers) {
+        // The operands of FullyConnected: inputs with a ones column, (in + 1) x out packed
+        // weights, and a row-major weight gradient.
+        const Eigen::Index rows = static_cast<Eigen::Index>(batch), k = static_cast<Eigen::Index>(in + 1),
+                           n = static_cast<Eigen::Index>(out);
+        Matrix x = Matrix::Random(rows, k), grad = Matrix::Random(rows, n), y(rows, n);
+        PackedMatrix<T> w(Matrix::Random(k, n));
+        RowMajorMatrix gradWeights(k, n);
+        const GemmOperand<T> xt = gemmOperand(x.transpose());
+        struct Case {
+            const char* name;
+            GemmShape shape;
+            std::function<void(const GemmParams&)> run;
+        };
+        const Case cases[] = {
+            { "forward", { batch, out, in + 1, sizeof(T) },
+              [&](const GemmParams& p) {
+                  gemm(gemmOperand(x), w.view(), y.data(), 1, rows, T(1), T(0), p);
+              } },
+            { "weight gradient", { in + 1, out, batch, sizeof(T) },
+              [&](const GemmParams& p) {
+                  gemm(xt, gemmOperand(grad), gradWeights.data(), n, 1, T(1), T(0), p);
+              } },
+        };
+        for (const Case& c : cases) {
+            // Narrow shapes take the dedicated kernels, which have nothing to tune.
+            if (std::min({ c.shape.m, c.shape.n, c.shape.k }) <= gemm_detail::kSkinnyMax)
+                continue;
+            const double defaultTime = timeRuns([&] { c.run({}); });
+            double tunedTime;
+            const GemmParams best = tuneShape(c.shape, c.run, tunedTime);
+            log << " " << c.name << " " << c.shape.m << "x" << c.shape.n << "x" << c.shape.k << ": default "
+                << defaultTime * 1e3 << " ms, tuned " << tunedTime * 1e3 << " ms (mc " << best.mc << ", kc "
+                << best.kc << ", nc " << best.nc << ", threads " << best.threads << ")\n";
+            // Keep only clear wins over the defaults.
+            if (tunedTime < 0.97 * defaultTime)
+                profile.set(c.shape, best);
+        }
+    }
+    return profile;
+}
+
+} // namespace
+
+GemmProfile tuneLayerGemms(size_t batch, size_t inputs, size_t hidden, size_t outputs, std::ostream& log,
+                           size_t elementBytes) {
+    if (elementBytes == sizeof(float))
+        return tuneLayerGemmsFor<float>(batch, inputs, hidden, outputs, log);
+    return tuneLayerGemmsFor<double>(batch, inputs, hidden, outputs, log);
+}
+
+} // namespace tuning
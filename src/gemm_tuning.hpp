@@ -0,0 +1,61 @@
+#pragma once
+#include <compare>
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+#include "dispatch.hpp"
+
+// Per-host GEMM tuning. The cache blocking (MC, KC, NC) and thread count of the blocked
+// GEMM loops can be overridden per problem shape by a profile file, written by
+// tuneLayerGemms() (nn_trainer --autotune) for the layer shapes of a network and loaded
+// on first use. NN_GEMM_PROFILE names the file, otherwise it is
+// ~/.cache/nn_trainer/gemm-<hostname>.profile. Entries are recorded per ISA level, as
+// the best blocking depends on the microkernel's tile shape.
+
+namespace tuning {
+
+struct GemmShape {
+    size_t m, n, k;
+    size_t elementBytes;
+
+    auto operator<=>(const GemmShape&) const = default;
+};
+
+class GemmProfile {
+public:
+    void set(const GemmShape& shape, const dispatch::GemmParams& params) { entries_[shape] = params; }
+    const dispatch::GemmParams* find(const GemmShape& shape) const;
+    void merge(const GemmProfile& other);
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    // Entries recorded for `isa`; a missing file gives an empty profile, a malformed one
+    // throws std::runtime_error.
+    static GemmProfile load(const std::string& path, dispatch::Isa isa);
+    // Replaces the file's entries for `isa`, keeping those of other levels.
+    void save(const std::string& path, dispatch::Isa isa) const;
+
+private:
+    std::map<GemmShape, dispatch::GemmParams> entries_;
+};
+
+std::string defaultProfilePath();
+
+// Profile used by gemm(), loaded from defaultProfilePath() for the active ISA level on
+// first use. Only replace it while no GEMM is running.
+const GemmProfile& activeProfile();
+void setActiveProfile(GemmProfile profile);
+
+// Tuned parameters for an m x n x k product, or the defaults (all zero).
+dispatch::GemmParams gemmParams(size_t elementBytes, size_t m, size_t n, size_t k);
+
+// Benchmarks candidate blockings and thread counts for the GEMMs of an
+// inputs -> hidden -> outputs network of FullyConnected layers at this batch size, with
+// the operand layouts the layers use, and returns the shapes where tuning beats the
+// defaults. Progress is reported to log. elementBytes picks double or float operands.
+GemmProfile tuneLayerGemms(size_t batch, size_t inputs, size_t hidden, size_t outputs, std::ostream& log,
+                           size_t elementBytes = sizeof(double));
+
+} // namespace tuning
@@ -0,0 +1,52 @@
+// Kernel table for one ISA level. CMakeLists.txt compiles this file once per level with
+// the matching -m flags and -DSIMD_ISA=<level>; dispatch.cpp picks a table at runtime.
+//
+// Only code inside the SIMD_ISA inline namespaces may be instantiated here: anything
+// else (Eigen, Tensor, std algorithms on our types) would be compiled with this level's
+// instructions and could be merged by the linker into the portable code paths.
+
+#include "dispatch.hpp"
+#include "gemm.hpp"
+#include "matvec.hpp"
+#include "optimizers.hpp"
+#include "quantized.hpp"
+#include "relu.hpp"
+#include "softmax.hpp"
+#include "sparse.hpp"
+#include "tensor_convert.hpp"
+
+#include <utility>
+
+namespace dispatch {
+inline namespace SIMD_ISA {
+
+template<typename T, size_t... N>
+constexpr KernelTable<T> makeTable(Isa isa, std::index_sequence<N...>) {
+    return { isa,
+             &gemm_detail::gemmBlocked<T>,
+             &gemm_detail::gemmPrepacked<T, T>,
+             &gemm_detail::gemmPrepacked<T, Eigen::bfloat16>,
+             { &gemm_detail::gemmPackedNarrow<T, N + 1>... },
+             &sparse_detail::sparseTimesPacked<T, T>,
+             &sparse_detail::sparseTimesPacked<T, Eigen::bfloat16>,
+             &sparse_detail::sparseRowsTimesDense<T>,
+             &matvec_detail::gemvBatched<T>,
+             &matvec_detail::gemvTransposed<T>,
+             &softmax_detail::forwardRows<T>,
+             &softmax_detail::crossEntropyRows<T>,
+             &relu_detail::forward<T>,
+             &relu_detail::backward<T>,
+             &optimizer_detail::momentumStep<T>,
+             &optimizer_detail::adamStep<T>,
+             &convert_detail::pixelsToReal<T>,
+             &convert_detail::realToBf16<T>,
+             &quant_detail::gemmU8S8 };
+}
+
+extern const KernelTable<float> kTableF32 = makeTable<float>(Isa::KERNEL_ISA_LEVEL,
+                                                             std::make_index_sequence<kNarrowWidths>());
+extern const KernelTable<double> kTableF64 = makeTable<double>(Isa::KERNEL_ISA_LEVEL,
+                                                              std::make_index_sequence<kNarrowWidths>());
+
+} // namespace SIMD_ISA
+} // namespace dispatch
@@ -1,22 +1,23 @@
 #pragma once
 #include <Eigen/Dense>
-#include <cmath>
+#include "backend.hpp"
 
-#ifndef EPSILON
-#define EPSILON 1e-10
-#endif
-
-class CrossEntropyLoss {
+// Softmax and cross-entropy fused into one layer on the logits: forward computes the
+// mean loss and the gradient (softmax - label) / N together in a single pass over the
+// rows, without forming the probabilities or taking the log of each one.
+template<typename T = double>
+class SoftmaxCrossEntropyLoss {
 public:
-    CrossEntropyLoss() = default;
-    double forward(const Eigen::MatrixXd &pred, const Eigen::MatrixXd &label) {
-        cache_ = pred;
-        double loss = - (label.array() * (pred.array() + EPSILON).log()).sum();
-        return loss / static_cast<double>(pred.rows());
-    }
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &label) {
-        return (cache_ - label) / static_cast<double>(cache_.rows());
+    explicit SoftmaxCrossEntropyLoss(const Backend<T> &backend = defaultBackend<T>()) : backend_(&backend) {}
+    T forward(const MatrixX<T> &logits, const MatrixX<T> &label) {
+        grad_.resize(logits.rows(), logits.cols());
+        const T scale = T(1) / static_cast<T>(logits.rows());
+        return backend_->softmaxCrossEntropy(logits.data(), label.data(), grad_.data(), logits.rows(),
+                                             logits.cols(), logits.rows(), scale) * scale;
     }
+    // The gradient w.r.t. the logits from the last forward.
+    const MatrixX<T> &backward() const { return grad_; }
 private:
-    Eigen::MatrixXd cache_;
+    const Backend<T> *backend_;
+    MatrixX<T> grad_;
 };
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "tensor.hpp"  // the revised tensor.hpp above
+#include "dispatch.hpp"
+#include "simd.hpp"
+#include <algorithm>
 #include <cstdlib>     // for std::exit
 
-template<typename ComponentType>
+template<typename ComponentType, AllocatorPolicy Alloc = HeapAllocator>
 class Vector
 {
 public:
@@ -20,13 +23,17 @@ public:
     ComponentType&       operator()(size_t idx);
 
     // Direct access to underlying tensor
-    Tensor<ComponentType>& tensor();
+    Tensor<ComponentType, Alloc>& tensor();
+    const Tensor<ComponentType, Alloc>& tensor() const;
+
+    ComponentType*       data() { return tensor_.data(); }
+    const ComponentType* data() const { return tensor_.data(); }
 
 private:
-    Tensor<ComponentType> tensor_;
+    Tensor<ComponentType, Alloc> tensor_;
 };
 
-template<typename ComponentType>
+template<typename ComponentType, AllocatorPolicy Alloc = HeapAllocator>
 class Matrix
 {
 public:
@@ -43,58 +50,71 @@ public:
     const ComponentType& operator()(size_t row, size_t col) const;
     ComponentType&       operator()(size_t row, size_t col);
 
-    Tensor<ComponentType>& tensor();
+    Tensor<ComponentType, Alloc>& tensor();
+    const Tensor<ComponentType, Alloc>& tensor() const;
+
+    // Row-major storage, row stride cols()
+    ComponentType*       data() { return tensor_.data(); }
+    const ComponentType* data() const { return tensor_.data(); }
 
 private:
-    Tensor<ComponentType> tensor_;
+    Tensor<ComponentType, Alloc> tensor_;
 };
 
 //-----------------------------------------
 // Implementations: Vector
 //-----------------------------------------
-template<typename ComponentType>
-Vector<ComponentType>::Vector(size_t size)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc>::Vector(size_t size)
     : tensor_({size})
 {
 }
 
-template<typename ComponentType>
-Vector<ComponentType>::Vector(size_t size, const ComponentType& fillValue)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc>::Vector(size_t size, const ComponentType& fillValue)
     : tensor_({size}, fillValue)
 {
 }
 
-template<typename ComponentType>
-Vector<ComponentType>::Vector(const std::string& filename)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc>::Vector(const std::string& filename)
 {
-    tensor_ = readTensorFromFile<ComponentType>(filename);
-    if (tensor_.rank() != 1)
+    Tensor<ComponentType> loaded = readTensorFromFile<ComponentType>(filename);
+    if (loaded.rank() != 1)
     {
         std::cerr << "Error: loaded tensor is not rank-1.\n";
         std::exit(1);
     }
+    tensor_ = Tensor<ComponentType, Alloc>(loaded.shape());
+    std::copy_n(loaded.data(), loaded.numElements(), tensor_.data());
 }
 
-template<typename ComponentType>
-size_t Vector<ComponentType>::size() const
+template<typename ComponentType, AllocatorPolicy Alloc>
+size_t Vector<ComponentType, Alloc>::size() const
 {
     return tensor_.numElements();
 }
 
-template<typename ComponentType>
-const ComponentType& Vector<ComponentType>::operator()(size_t idx) const
+template<typename ComponentType, AllocatorPolicy Alloc>
+const ComponentType& Vector<ComponentType, Alloc>::operator()(size_t idx) const
 {
-    return tensor_({idx});
+    return tensor_.data()[idx];
 }
 
-template<typename ComponentType>
-ComponentType& Vector<ComponentType>::operator()(size_t idx)
+template<typename ComponentType, AllocatorPolicy Alloc>
+ComponentType& Vector<ComponentType, Alloc>::operator()(size_t idx)
 {
-    return tensor_({idx});
+    return tensor_.data()[idx];
 }
 
-template<typename ComponentType>
-Tensor<ComponentType>& Vector<ComponentType>::tensor()
+template<typename ComponentType, AllocatorPolicy Alloc>
+Tensor<ComponentType, Alloc>& Vector<ComponentType, Alloc>::tensor()
+{
+    return tensor_;
+}
+
+template<typename ComponentType, AllocatorPolicy Alloc>
+const Tensor<ComponentType, Alloc>& Vector<ComponentType, Alloc>::tensor() const
 {
     return tensor_;
 }
@@ -102,65 +122,259 @@ Tensor<ComponentType>& Vector<ComponentType>::tensor()
 //-----------------------------------------
 // Implementations: Matrix
 //-----------------------------------------
-template<typename ComponentType>
-Matrix<ComponentType>::Matrix(size_t rows, size_t cols)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Matrix<ComponentType, Alloc>::Matrix(size_t rows, size_t cols)
     : tensor_({rows, cols})
 {
 }
 
-template<typename ComponentType>
-Matrix<ComponentType>::Matrix(size_t rows, size_t cols, const ComponentType& fillValue)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Matrix<ComponentType, Alloc>::Matrix(size_t rows, size_t cols, const ComponentType& fillValue)
     : tensor_({rows, cols}, fillValue)
 {
 }
 
-template<typename ComponentType>
-Matrix<ComponentType>::Matrix(const std::string& filename)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Matrix<ComponentType, Alloc>::Matrix(const std::string& filename)
 {
-    tensor_ = readTensorFromFile<ComponentType>(filename);
-    if (tensor_.rank() != 2)
+    Tensor<ComponentType> loaded = readTensorFromFile<ComponentType>(filename);
+    if (loaded.rank() != 2)
     {
         std::cerr << "Error: loaded tensor is not rank-2.\n";
         std::exit(1);
     }
+    tensor_ = Tensor<ComponentType, Alloc>(loaded.shape());
+    std::copy_n(loaded.data(), loaded.numElements(), tensor_.data());
+}
+
+template<typename ComponentType, AllocatorPolicy Alloc>
+size_t Matrix<ComponentType, Alloc>::rows() const
+{
+    return tensor_.dim(0);
 }
 
-template<typename ComponentType>
-size_t Matrix<ComponentType>::rows() const
+template<typename ComponentType, AllocatorPolicy Alloc>
+size_t Matrix<ComponentType, Alloc>::cols() const
 {
-    return tensor_.shape()[0];
+    return tensor_.dim(1);
 }
 
-template<typename ComponentType>
-size_t Matrix<ComponentType>::cols() const
+template<typename ComponentType, AllocatorPolicy Alloc>
+const ComponentType& Matrix<ComponentType, Alloc>::operator()(size_t row, size_t col) const
 {
-    return tensor_.shape()[1];
+    return tensor_.data()[row * cols() + col];
 }
 
-template<typename ComponentType>
-const ComponentType& Matrix<ComponentType>::operator()(size_t row, size_t col) const
+template<typename ComponentType, AllocatorPolicy Alloc>
+ComponentType& Matrix<ComponentType, Alloc>::operator()(size_t row, size_t col)
 {
-    return tensor_({row, col});
+    return tensor_.data()[row * cols() + col];
 }
 
-template<typename ComponentType>
-ComponentType& Matrix<ComponentType>::operator()(size_t row, size_t col)
+template<typename ComponentType, AllocatorPolicy Alloc>
+Tensor<ComponentType, Alloc>& Matrix<ComponentType, Alloc>::tensor()
 {
-    return tensor_({row, col});
+    return tensor_;
 }
 
-template<typename ComponentType>
-Tensor<ComponentType>& Matrix<ComponentType>::tensor()
+template<typename ComponentType, AllocatorPolicy Alloc>
+const Tensor<ComponentType, Alloc>& Matrix<ComponentType, Alloc>::tensor() const
 {
     return tensor_;
 }
 
+//-----------------------------------------
+// MatVec kernels
+//-----------------------------------------
+namespace matvec_detail
+{
+inline namespace SIMD_ISA
+{
+// Register tile: kRowTile matrix rows against kVecTile vectors, so every packet loaded
+// from A or x feeds several FMAs.
+inline constexpr size_t kRowTile = 4;
+inline constexpr size_t kVecTile = 4;
+// Rows per parallel work item; columns per cache block, sized so a kRowTile x block
+// tile of A stays in L1 while all vectors stream past it.
+inline constexpr size_t kRowBlock = 64;
+inline constexpr size_t kColBlockBytes = 8 * 1024;
+// Columns per parallel work item of the transposed kernel.
+inline constexpr size_t kColBlockT = 256;
+// Below this many multiply-adds the kernels stay single-threaded.
+inline constexpr size_t kParallelMinWork = size_t(1) << 18;
+
+// Y[v * ldy + r] (+)= dot(A[r, c0:c1], X[v, c0:c1]) for r < NR, v < NV.
+template<size_t NR, size_t NV, typename T>
+void dotTile(const T* A, size_t lda, const T* X, size_t ldx, T* Y, size_t ldy,
+             size_t c0, size_t c1, bool accumulate)
+{
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    typename P::type s[NR][NV];
+    for (size_t i = 0; i < NR; ++i)
+        for (size_t v = 0; v < NV; ++v)
+            s[i][v] = P::zero();
+    size_t c = c0;
+    for (; c + W <= c1; c += W)
+    {
+        typename P::type xv[NV];
+        for (size_t v = 0; v < NV; ++v)
+            xv[v] = P::loadu(X + v * ldx + c);
+        for (size_t i = 0; i < NR; ++i)
+        {
+            typename P::type a = P::loadu(A + i * lda + c);
+            for (size_t v = 0; v < NV; ++v)
+                s[i][v] = P::fmadd(a, xv[v], s[i][v]);
+        }
+    }
+    for (size_t i = 0; i < NR; ++i)
+        for (size_t v = 0; v < NV; ++v)
+        {
+            T t = P::reduceAdd(s[i][v]);
+            for (size_t k = c; k < c1; ++k)
+                t += A[i * lda + k] * X[v * ldx + k];
+            T& y = Y[v * ldy + i];
+            y = accumulate ? y + t : t;
+        }
+}
+
+// Rows [r0, r1) of A against all nvec vectors for one column block.
+template<typename T>
+void gemvBlock(const T* A, size_t lda, const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy,
+               size_t r0, size_t r1, size_t c0, size_t c1, bool accumulate)
+{
+    size_t r = r0;
+    for (; r + kRowTile <= r1; r += kRowTile)
+    {
+        size_t v = 0;
+        for (; v + kVecTile <= nvec; v += kVecTile)
+            dotTile<kRowTile, kVecTile>(A + r * lda, lda, X + v * ldx, ldx, Y + v * ldy + r, ldy, c0, c1, accumulate);
+        for (; v < nvec; ++v)
+            dotTile<kRowTile, 1>(A + r * lda, lda, X + v * ldx, ldx, Y + v * ldy + r, ldy, c0, c1, accumulate);
+    }
+    for (; r < r1; ++r)
+    {
+        size_t v = 0;
+        for (; v + kVecTile <= nvec; v += kVecTile)
+            dotTile<1, kVecTile>(A + r * lda, lda, X + v * ldx, ldx, Y + v * ldy + r, ldy, c0, c1, accumulate);
+        for (; v < nvec; ++v)
+            dotTile<1, 1>(A + r * lda, lda, X + v * ldx, ldx, Y + v * ldy + r, ldy, c0, c1, accumulate);
+    }
+}
+
+// Y[v, :] = A * X[v, :] for v < nvec. A is row-major rows x cols with row stride lda,
+// X holds one vector of length cols per row (stride ldx), Y one result of length rows
+// per row (stride ldy). The matrix is streamed once for all vectors.
+template<typename T>
+void gemvBatched(const T* A, size_t rows, size_t cols, size_t lda,
+                 const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy)
+{
+    if (cols == 0)
+    {
+        for (size_t v = 0; v < nvec; ++v)
+            for (size_t r = 0; r < rows; ++r)
+                Y[v * ldy + r] = T(0);
+        return;
+    }
+    const size_t colBlock = std::max<size_t>(kColBlockBytes / sizeof(T), 1);
+    const long numRowBlocks = static_cast<long>((rows + kRowBlock - 1) / kRowBlock);
+    const bool parallel = rows * cols * nvec >= kParallelMinWork && numRowBlocks > 1;
+    #pragma omp parallel for schedule(static) if (parallel)
+    for (long b = 0; b < numRowBlocks; ++b)
+    {
+        size_t r0 = static_cast<size_t>(b) * kRowBlock;
+        size_t r1 = std::min(rows, r0 + kRowBlock);
+        for (size_t c0 = 0; c0 < cols; c0 += colBlock)
+            gemvBlock(A, lda, X, nvec, ldx, Y, ldy, r0, r1, c0, std::min(cols, c0 + colBlock), c0 != 0);
+    }
+}
+
+// y = A * x for a row-major rows x cols matrix with row stride lda.
+template<typename T>
+void gemv(const T* A, size_t rows, size_t cols, size_t lda, const T* x, T* y)
+{
+    gemvBatched(A, rows, cols, lda, x, 1, cols, y, rows);
+}
+
+// y = A^T * x without forming A^T: y accumulates x[r] * A[r, :] over the rows of A,
+// four rows per pass over a column block of y.
+template<typename T>
+void gemvTransposed(const T* A, size_t rows, size_t cols, size_t lda, const T* x, T* y)
+{
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    const long numColBlocks = static_cast<long>((cols + kColBlockT - 1) / kColBlockT);
+    const bool parallel = rows * cols >= kParallelMinWork && numColBlocks > 1;
+    #pragma omp parallel for schedule(static) if (parallel)
+    for (long b = 0; b < numColBlocks; ++b)
+    {
+        size_t c0 = static_cast<size_t>(b) * kColBlockT;
+        size_t c1 = std::min(cols, c0 + kColBlockT);
+        for (size_t c = c0; c < c1; ++c)
+            y[c] = T(0);
+        size_t r = 0;
+        for (; r + kRowTile <= rows; r += kRowTile)
+        {
+            const T* a0 = A + r * lda;
+            const T* a1 = a0 + lda;
+            const T* a2 = a1 + lda;
+            const T* a3 = a2 + lda;
+            typename P::type x0 = P::set1(x[r]), x1 = P::set1(x[r + 1]),
+                             x2 = P::set1(x[r + 2]), x3 = P::set1(x[r + 3]);
+            size_t c = c0;
+            for (; c + W <= c1; c += W)
+            {
+                typename P::type acc = P::loadu(y + c);
+                acc = P::fmadd(P::loadu(a0 + c), x0, acc);
+                acc = P::fmadd(P::loadu(a1 + c), x1, acc);
+                acc = P::fmadd(P::loadu(a2 + c), x2, acc);
+                acc = P::fmadd(P::loadu(a3 + c), x3, acc);
+                P::storeu(y + c, acc);
+            }
+            for (; c < c1; ++c)
+                y[c] += a0[c] * x[r] + a1[c] * x[r + 1] + a2[c] * x[r + 2] + a3[c] * x[r + 3];
+        }
+        for (; r < rows; ++r)
+        {
+            const T* a = A + r * lda;
+            typename P::type xr = P::set1(x[r]);
+            size_t c = c0;
+            for (; c + W <= c1; c += W)
+                P::storeu(y + c, P::fmadd(P::loadu(a + c), xr, P::loadu(y + c)));
+            for (; c < c1; ++c)
+                y[c] += a[c] * x[r];
+        }
+    }
+}
+} // namespace SIMD_ISA
+} // namespace matvec_detail
+
 //-----------------------------------------
 // MatVec multiplication
 //-----------------------------------------
-template<typename ComponentType>
-Vector<ComponentType> matvec(const Matrix<ComponentType>& mat,
-                             const Vector<ComponentType>& vec)
+// float and double use the kernels selected for the host CPU (dispatch.hpp).
+template<typename T>
+void gemvBatched(const T* A, size_t rows, size_t cols, size_t lda,
+                 const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy)
+{
+    if constexpr (dispatch::hasKernels<T>)
+        dispatch::kernels<T>().gemvBatched(A, rows, cols, lda, X, nvec, ldx, Y, ldy);
+    else
+        matvec_detail::gemvBatched(A, rows, cols, lda, X, nvec, ldx, Y, ldy);
+}
+
+template<typename T>
+void gemvTransposed(const T* A, size_t rows, size_t cols, size_t lda, const T* x, T* y)
+{
+    if constexpr (dispatch::hasKernels<T>)
+        dispatch::kernels<T>().gemvTransposed(A, rows, cols, lda, x, y);
+    else
+        matvec_detail::gemvTransposed(A, rows, cols, lda, x, y);
+}
+
+template<typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc> matvec(const Matrix<ComponentType, Alloc>& mat,
+                                    const Vector<ComponentType, Alloc>& vec)
 {
     if (mat.cols() != vec.size())
     {
@@ -168,14 +382,41 @@ Vector<ComponentType> matvec(const Matrix<ComponentType>& mat,
         std::exit(1);
     }
 
-    Vector<ComponentType> out(mat.rows(), ComponentType(0));
+    Vector<ComponentType, Alloc> out(mat.rows());
+    gemvBatched(mat.data(), mat.rows(), mat.cols(), mat.cols(), vec.data(), 1, mat.cols(), out.data(), mat.rows());
+    return out;
+}
 
-    for (size_t row = 0; row < mat.rows(); row++)
+// Row b of the result is mat * (row b of vecs): vecs is batch x mat.cols(), the result
+// batch x mat.rows(). The matrix is read once for the whole batch.
+template<typename ComponentType, AllocatorPolicy Alloc>
+Matrix<ComponentType, Alloc> matvecBatched(const Matrix<ComponentType, Alloc>& mat,
+                                           const Matrix<ComponentType, Alloc>& vecs)
+{
+    if (mat.cols() != vecs.cols())
     {
-        for (size_t col = 0; col < mat.cols(); col++)
-        {
-            out(row) += mat(row, col) * vec(col);
-        }
+        std::cerr << "Error: dimension mismatch in matvecBatched.\n";
+        std::exit(1);
     }
+
+    Matrix<ComponentType, Alloc> out(vecs.rows(), mat.rows());
+    gemvBatched(mat.data(), mat.rows(), mat.cols(), mat.cols(),
+                vecs.data(), vecs.rows(), vecs.cols(), out.data(), mat.rows());
+    return out;
+}
+
+// mat^T * vec, computed from the row-major matrix without transposing it.
+template<typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc> matvecTransposed(const Matrix<ComponentType, Alloc>& mat,
+                                              const Vector<ComponentType, Alloc>& vec)
+{
+    if (mat.rows() != vec.size())
+    {
+        std::cerr << "Error: dimension mismatch in matvecTransposed.\n";
+        std::exit(1);
+    }
+
+    Vector<ComponentType, Alloc> out(mat.cols());
+    gemvTransposed(mat.data(), mat.rows(), mat.cols(), mat.cols(), vec.data(), out.data());
     return out;
 }
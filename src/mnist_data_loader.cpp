@@ -1,4 +1,5 @@
 #include "mnist_data_loader.hpp"
+#include "tensor_convert.hpp"
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -6,24 +7,28 @@
 #include <cstring>
 
 // Define the constructor.
-MNISTDataLoader::MNISTDataLoader(const std::string &imageFile, const std::string &labelFile, size_t batchSize)
+template<typename T>
+MNISTDataLoader<T>::MNISTDataLoader(const std::string &imageFile, const std::string &labelFile, size_t batchSize)
     : imageFilePath(imageFile), labelFilePath(labelFile), batchSize(batchSize),
       numImages(0), numRows(0), numCols(0), numLabels(0)
 {
     // The constructor initializes file paths, batch size, and numeric properties to zero.
 }
 // Define reverseInt as a static member function.
-int MNISTDataLoader::reverseInt(int i) {
+template<typename T>
+int MNISTDataLoader<T>::reverseInt(int i) {
     unsigned char c1 = i & 0xFF, c2 = (i >> 8) & 0xFF, c3 = (i >> 16) & 0xFF, c4 = (i >> 24) & 0xFF;
     return (int(c1) << 24) + (int(c2) << 16) + (int(c3) << 8) + c4;
 }
 
-void MNISTDataLoader::loadDataset() {
+template<typename T>
+void MNISTDataLoader<T>::loadDataset() {
     loadImages();
     loadLabels();
 }
 
-void MNISTDataLoader::loadImages() {
+template<typename T>
+void MNISTDataLoader<T>::loadImages() {
     std::ifstream in(imageFilePath, std::ios::binary);
     if (!in.is_open())
         throw std::runtime_error("Cannot open image file: " + imageFilePath);
@@ -46,25 +51,21 @@ void MNISTDataLoader::loadImages() {
               << ", Rows: " << numRows << ", Cols: " << numCols << "\n";
 
     size_t imgSize = numRows * numCols;
-    Eigen::MatrixXd imageMatrix(batchSize, imgSize);
-    size_t fillCount = 0;
-    std::vector<unsigned char> imgBin(imgSize);
-
-    for (size_t i = 0; i < numImages; ++i) {
-        in.read(reinterpret_cast<char*>(imgBin.data()), imgSize);
-        for (size_t j = 0; j < imgSize; ++j)
-            imageMatrix(fillCount, j) = static_cast<double>(imgBin[j]) / 255.0;
-        fillCount++;
-
-        if (fillCount == batchSize || i == numImages - 1) {
-            imageBatches.push_back(imageMatrix.topRows(fillCount));
-            fillCount = 0;
-        }
+    // One read and one vectorized conversion per batch; rows are images.
+    std::vector<unsigned char> batchBin(batchSize * imgSize);
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> batchMatrix(batchSize, imgSize);
+
+    for (size_t first = 0; first < numImages; first += batchSize) {
+        size_t count = std::min(batchSize, numImages - first);
+        in.read(reinterpret_cast<char*>(batchBin.data()), count * imgSize);
+        convertPixels(batchBin.data(), batchMatrix.data(), count * imgSize);
+        imageBatches.push_back(batchMatrix.topRows(count));
     }
     in.close();
 }
 
-void MNISTDataLoader::loadLabels() {
+template<typename T>
+void MNISTDataLoader<T>::loadLabels() {
     std::ifstream in(labelFilePath, std::ios::binary);
     if (!in.is_open())
         throw std::runtime_error("Cannot open label file: " + labelFilePath);
@@ -81,14 +82,14 @@ void MNISTDataLoader::loadLabels() {
     std::cout << "Label File: " << labelFilePath << "\n"
               << "Number of Labels: " << numLabels << "\n";
 
-    Eigen::MatrixXd labelMatrix(batchSize, 10);
+    Matrix labelMatrix(batchSize, 10);
     labelMatrix.setZero();
     size_t fillCount = 0;
 
     for (size_t i = 0; i < numLabels; ++i) {
         unsigned char label = 0;
         in.read(reinterpret_cast<char*>(&label), 1);
-        labelMatrix(fillCount, label) = 1.0;
+        labelMatrix(fillCount, label) = T(1);
         fillCount++;
 
         if (fillCount == batchSize || i == numLabels - 1) {
@@ -100,25 +101,56 @@ void MNISTDataLoader::loadLabels() {
     in.close();
 }
 
-Eigen::MatrixXd MNISTDataLoader::getImageBatch(size_t index) const {
+template<typename T>
+typename MNISTDataLoader<T>::Matrix MNISTDataLoader<T>::getImageBatch(size_t index) const {
     if (index >= imageBatches.size())
         throw std::runtime_error("Image batch index out of range");
     return imageBatches[index];
 }
 
-Eigen::MatrixXd MNISTDataLoader::getLabelBatch(size_t index) const {
+template<typename T>
+typename MNISTDataLoader<T>::Matrix MNISTDataLoader<T>::getLabelBatch(size_t index) const {
     if (index >= labelBatches.size())
         throw std::runtime_error("Label batch index out of range");
     return labelBatches[index];
 }
 
-size_t MNISTDataLoader::getNumBatches() const {
+template<typename T>
+size_t MNISTDataLoader<T>::getNumBatches() const {
     return imageBatches.size(); // Assumes images and labels have the same number of batches.
 }
 
+template<typename T>
+std::vector<int32_t> MNISTDataLoader<T>::liveFeatures() const {
+    const Eigen::Index features = imageBatches.empty() ? 0 : imageBatches.front().cols();
+    std::vector<int32_t> live;
+    for (Eigen::Index j = 0; j < features; ++j) {
+        bool nonzero = false;
+        for (size_t b = 0; b < imageBatches.size() && !nonzero; ++b)
+            nonzero = (imageBatches[b].col(j).array() != T(0)).any();
+        if (nonzero)
+            live.push_back(static_cast<int32_t>(j));
+    }
+    return live;
+}
+
+template<typename T>
+void MNISTDataLoader<T>::keepFeatures(const std::vector<int32_t> &features) {
+    for (Matrix &batch : imageBatches) {
+        Matrix kept(batch.rows(), static_cast<Eigen::Index>(features.size()));
+        for (size_t i = 0; i < features.size(); ++i) {
+            if (features[i] < 0 || features[i] >= batch.cols())
+                throw std::runtime_error("Feature index out of range");
+            kept.col(static_cast<Eigen::Index>(i)) = batch.col(features[i]);
+        }
+        batch = std::move(kept);
+    }
+}
+
 // --- Static Methods for Single Sample Reading ---
 
-Eigen::MatrixXd MNISTDataLoader::readSingleImage(const std::string &filename, int imageIndex) {
+template<typename T>
+RowMajorMatrixXd MNISTDataLoader<T>::readSingleImage(const std::string &filename, int imageIndex) {
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open())
         throw std::runtime_error("Cannot open image file: " + filename);
@@ -139,19 +171,16 @@ Eigen::MatrixXd MNISTDataLoader::readSingleImage(const std::string &filename, in
 
     size_t imgSize = static_cast<size_t>(numRows) * numCols;
     file.seekg(16 + imageIndex * imgSize, std::ios::beg);
-    Eigen::MatrixXd imageMat(numRows, numCols);
-    for (int r = 0; r < numRows; ++r) {
-        for (int c = 0; c < numCols; ++c) {
-            unsigned char pixel = 0;
-            file.read(reinterpret_cast<char*>(&pixel), 1);
-            imageMat(r, c) = static_cast<double>(pixel) / 255.0;
-        }
-    }
+    std::vector<unsigned char> imgBin(imgSize);
+    file.read(reinterpret_cast<char*>(imgBin.data()), imgSize);
+    RowMajorMatrixXd imageMat(numRows, numCols);
+    convertPixels(imgBin.data(), imageMat.data(), imgSize);
     file.close();
     return imageMat;
 }
 
-Eigen::MatrixXd MNISTDataLoader::readSingleLabel(const std::string &filename, int labelIndex) {
+template<typename T>
+Eigen::MatrixXd MNISTDataLoader<T>::readSingleLabel(const std::string &filename, int labelIndex) {
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open())
         throw std::runtime_error("Cannot open label file: " + filename);
@@ -177,3 +206,50 @@ Eigen::MatrixXd MNISTDataLoader::readSingleLabel(const std::string &filename, in
     file.close();
     return labelMat;
 }
+
+template<typename T>
+RawImages MNISTDataLoader<T>::readRawImages(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Cannot open image file: " + filename);
+
+    int magic = 0, numImages = 0, numRows = 0, numCols = 0;
+    file.read(reinterpret_cast<char*>(&magic), 4); magic = reverseInt(magic);
+    if (magic != 2051)
+        throw std::runtime_error("Invalid MNIST image file (magic != 2051)");
+    file.read(reinterpret_cast<char*>(&numImages), 4); numImages = reverseInt(numImages);
+    file.read(reinterpret_cast<char*>(&numRows), 4); numRows = reverseInt(numRows);
+    file.read(reinterpret_cast<char*>(&numCols), 4); numCols = reverseInt(numCols);
+
+    RawImages images;
+    images.count = static_cast<size_t>(numImages);
+    images.size = static_cast<size_t>(numRows) * numCols;
+    images.pixels.resize(images.count * images.size);
+    file.read(reinterpret_cast<char*>(images.pixels.data()), images.pixels.size());
+    if (!file)
+        throw std::runtime_error("Truncated MNIST image file: " + filename);
+    return images;
+}
+
+template<typename T>
+std::vector<uint8_t> MNISTDataLoader<T>::readRawLabels(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Cannot open label file: " + filename);
+
+    int magic = 0, numLabels = 0;
+    file.read(reinterpret_cast<char*>(&magic), 4); magic = reverseInt(magic);
+    if (magic != 2049)
+        throw std::runtime_error("Invalid MNIST label file (magic != 2049)");
+    file.read(reinterpret_cast<char*>(&numLabels), 4); numLabels = reverseInt(numLabels);
+
+    std::vector<uint8_t> labels(static_cast<size_t>(numLabels));
+    file.read(reinterpret_cast<char*>(labels.data()), labels.size());
+    if (!file)
+        throw std::runtime_error("Truncated MNIST label file: " + filename);
+    return labels;
+}
+
+template class MNISTDataLoader<double>;
+template class MNISTDataLoader<float>;
+template class MNISTDataLoader<Eigen::bfloat16>;
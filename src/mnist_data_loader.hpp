@@ -1,22 +1,45 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <Eigen/Dense>
 
+// Row-major so that single images can be handed to Tensor::adopt() without a copy.
+using RowMajorMatrixXd = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+// Images as stored in an IDX file: count rows of size bytes.
+struct RawImages {
+    std::vector<uint8_t> pixels;
+    size_t count = 0, size = 0;
+};
+
+// Batches are stored in the scalar type T of the network (double or float), or in
+// Eigen::bfloat16 for mixed precision; the single sample readers always return double.
+template<typename T = double>
 class MNISTDataLoader {
 public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
     // Existing constructor and batch loading methods…
     MNISTDataLoader(const std::string &imageFile, const std::string &labelFile, size_t batchSize);
 
     void loadDataset();
     // Batch getters...
-    Eigen::MatrixXd getImageBatch(size_t index) const;
-    Eigen::MatrixXd getLabelBatch(size_t index) const;
+    Matrix getImageBatch(size_t index) const;
+    Matrix getLabelBatch(size_t index) const;
     size_t getNumBatches() const;
 
+    // Input features (pixels) that are nonzero in at least one loaded image, ascending.
+    std::vector<int32_t> liveFeatures() const;
+    // Compacts every image batch to the listed feature columns, in that order.
+    void keepFeatures(const std::vector<int32_t> &features);
+
     // --- NEW STATIC METHODS FOR SINGLE SAMPLE READING ---
-    static Eigen::MatrixXd readSingleImage(const std::string &filename, int imageIndex);
+    static RowMajorMatrixXd readSingleImage(const std::string &filename, int imageIndex);
     static Eigen::MatrixXd readSingleLabel(const std::string &filename, int labelIndex);
+    // Whole files, unconverted: the pixel bytes and the label digits (int8 inference).
+    static RawImages readRawImages(const std::string &filename);
+    static std::vector<uint8_t> readRawLabels(const std::string &filename);
 
 private:
     std::string imageFilePath;
@@ -26,8 +49,8 @@ private:
     size_t numImages, numRows, numCols;
     size_t numLabels;
 
-    std::vector<Eigen::MatrixXd> imageBatches;
-    std::vector<Eigen::MatrixXd> labelBatches;
+    std::vector<Matrix> imageBatches;
+    std::vector<Matrix> labelBatches;
 
     // Make reverseInt static so it can be used in static methods.
     static int reverseInt(int i);
@@ -35,3 +58,7 @@ private:
     void loadImages();
     void loadLabels();
 };
+
+extern template class MNISTDataLoader<double>;
+extern template class MNISTDataLoader<float>;
+extern template class MNISTDataLoader<Eigen::bfloat16>;
@@ -8,68 +8,128 @@
 #include <numeric>
 #include <algorithm>
 #include <random>
+#include <type_traits>
+#include <optional>
+#include <utility>
 
+#include "backend.hpp"
 #include "loss.hpp"
 #include "optimizers.hpp"
-#include "relu.hpp"
 #include "softmax.hpp"
 #include "fullyconnected.hpp"
 #include "mnist_data_loader.hpp"  // Integrated loader for images & labels
+#include "sequential.hpp"
 
+// The topology compiled into StaticNetwork for --network=static (the hidden size of the
+// project configs).
+using MnistTopology = Sequential<Dense<784, 500>, ReLU, Dense<500, 10>, SoftmaxCE>;
+
+// The whole network in scalar type T: double, or float for twice the SIMD width and half
+// the memory traffic. Hyperparameters and the initial weights do not depend on T. A
+// storage type S other than T (Eigen::bfloat16 with T = float, mixed precision) holds the
+// dataset and the weights the forward products read, see FullyConnected; each batch is
+// widened to T as it is used.
+//
+// network = "static" runs the shape on StaticNetwork<T, MnistTopology> when it matches
+// (hidden size 500, S == T); the pixels are then not compacted, as its input width is
+// fixed, and the runtime-sized layers are not built. Otherwise, and by default, they are
+// used.
+template<typename T = double, typename S = T>
 class NeuralNetwork {
 public:
     NeuralNetwork(double lr, int epochs, int batch, int hidden,
                   std::string trainData, std::string trainLabels,
                   std::string testData, std::string testLabels,
-                  std::string logPath)
+                  std::string logPath, const std::string &backend = "optimized",
+                  const std::string &optimizer = "sgd", const std::string &network = "runtime")
         : learning_rate(lr), num_epochs(epochs), batch_size(batch), hidden_size(hidden),
           train_data_path(trainData), train_labels_path(trainLabels),
           test_data_path(testData), test_labels_path(testLabels),
-          log_file_path(logPath), input_size(784),
-          fc1(input_size, hidden_size), fc2(hidden_size, 10),
-          sgd(lr) {}
+          log_file_path(logPath), input_size(784), backend_(makeBackend<T>(backend)),
+          softmax(*backend_), loss_(*backend_), optimizer_(makeOptimizer<T>(optimizer, lr)) {
+        if (network != "runtime" && network != "static")
+            throw std::invalid_argument("Unknown network '" + network + "' (expected runtime or static)");
+        if (network == "static") {
+            if (std::is_same_v<S, T> && static_cast<size_t>(hidden) == MnistTopology::widths[1])
+                static_ = std::make_unique<StaticNetwork<T, MnistTopology>>(*backend_);
+            else
+                std::cout << "No compiled topology for 784 -> " << hidden << " -> 10 in this precision;"
+                          << " using the runtime network\n";
+        }
+        if (!static_) {
+            fc1.emplace(input_size, hidden_size, *backend_);
+            fc2.emplace(hidden_size, 10, *backend_);
+            fc1->setSparseInput(true);
+            fc1->setRelu(true);
+        }
+    }
 
-    void train() {
+    const char *backendName() const { return backend_->name(); }
+    const char *networkName() const { return static_ ? "static (784 -> 500 -> 10)" : "runtime"; }
+    const char *optimizerName() const { return optimizer_->name(); }
+
+    // Returns the training time in seconds.
+    double train() {
         auto start = std::chrono::steady_clock::now();
         // Use the integrated data loader for training data.
-        MNISTDataLoader trainLoader(train_data_path, train_labels_path, batch_size);
+        MNISTDataLoader<S> trainLoader(train_data_path, train_labels_path, batch_size);
         trainLoader.loadDataset();
+        compactInputs(trainLoader);
         size_t numBatches = trainLoader.getNumBatches();
         for (int epoch = 0; epoch < num_epochs; ++epoch) {
             std::cout << "Epoch " << epoch << " / " << num_epochs << "\n";
             std::vector<size_t> indices(numBatches);
             std::iota(indices.begin(), indices.end(), 0);
             std::shuffle(indices.begin(), indices.end(), std::default_random_engine(epoch));
+            double lossSum = 0.0;
             for (auto idx : indices) {
-                Eigen::MatrixXd images = trainLoader.getImageBatch(idx);
-                Eigen::MatrixXd labels = trainLoader.getLabelBatch(idx);
-                Eigen::MatrixXd predictions = forward(images);
-                double loss = loss_.forward(predictions, labels);
-                Eigen::MatrixXd dLoss = loss_.backward(labels);
-                backward(dLoss);
+                MatrixX<T> images = widen(trainLoader.getImageBatch(idx));
+                MatrixX<T> labels = widen(trainLoader.getLabelBatch(idx));
+                if (static_) {
+                    lossSum += static_cast<double>(static_->trainStep(images, labels, *optimizer_));
+                    continue;
+                }
+                lossSum += static_cast<double>(loss_.forward(forward(images), labels));
+                backward(loss_.backward());
             }
+            std::cout << "Mean loss: " << lossSum / static_cast<double>(numBatches) << "\n";
         }
         auto end = std::chrono::steady_clock::now();
         std::chrono::duration<double> elapsed = end - start;
         std::cout << "Total training time: " << elapsed.count() << " seconds\n";
+        return elapsed.count();
     }
 
-void test() {
+// Returns the test accuracy in percent; predictions() holds the predicted digits.
+double test() {
     // Use the integrated data loader for test data.
-    MNISTDataLoader testLoader(test_data_path, test_labels_path, batch_size);
+    MNISTDataLoader<S> testLoader(test_data_path, test_labels_path, batch_size);
     testLoader.loadDataset();
+    if (inputs_compacted)
+        testLoader.keepFeatures(input_features);
     std::ostringstream buffer;
     int total = 0, correct = 0;
+    std::optional<FrozenFullyConnected<T, S>> frozen1, frozen2;
+    if (!static_) {
+        frozen1 = fc1->freeze();
+        frozen2 = fc2->freeze();
+    }
+    predictions_.clear();
+    std::chrono::duration<double> inference{ 0.0 };
     for (size_t b = 0; b < testLoader.getNumBatches(); ++b) {
         // Print the header with the exact expected text:
         buffer << "Current batch: " << b << "\n";
-        Eigen::MatrixXd images = testLoader.getImageBatch(b);
-        Eigen::MatrixXd predictions = forward(images);
-        Eigen::MatrixXd labels = testLoader.getLabelBatch(b);
+        MatrixX<T> images = widen(testLoader.getImageBatch(b));
+        const auto start = std::chrono::steady_clock::now();
+        const MatrixX<T> &predictions =
+            softmax.forward(static_ ? MatrixX<T>(static_->forward(images)) : frozen2->forward(frozen1->forward(images)));
+        inference += std::chrono::steady_clock::now() - start;
+        MatrixX<T> labels = widen(testLoader.getLabelBatch(b));
         for (int i = 0; i < predictions.rows(); ++i) {
             Eigen::Index pred, actual;
             predictions.row(i).maxCoeff(&pred);
             labels.row(i).maxCoeff(&actual);
+            predictions_.push_back(static_cast<int>(pred));
             buffer << " - image " << (b * batch_size + i)
                    << ": Prediction=" << pred << ". Label=" << actual << "\n";
             ++total;
@@ -77,35 +137,82 @@ void test() {
                 ++correct;
         }
     }
+    const double accuracy = 100.0 * correct / total;
+    inference_seconds = inference.count();
     std::ofstream logFile(log_file_path);
     if (!logFile.is_open()) {
         std::cerr << "Error: Cannot open log file: " << log_file_path << "\n";
-        return;
+        return accuracy;
     }
     logFile << buffer.str();
     logFile.close();
-    std::cout << "Test accuracy: " << 100.0 * correct / total << "%\n";
+    std::cout << "Test accuracy: " << accuracy << "%\n";
+    return accuracy;
 }
+    const std::vector<int> &predictions() const { return predictions_; }
+    // Time the last test() spent in the forward passes, without loading the data.
+    double inferenceSeconds() const { return inference_seconds; }
 
-    Eigen::MatrixXd forward(const Eigen::MatrixXd &input) {
-        Eigen::MatrixXd a1 = fc1.forward(input);
-        Eigen::MatrixXd r = relu.forward(a1);
-        Eigen::MatrixXd a2 = fc2.forward(r);
-        return softmax.forward(a2);
+    // The trained weights of layer 0 (fc1) or 1 (fc2) as FullyConnected::weights(), for
+    // exporting them (e.g. to QuantizedNetwork). fc1's inputs are inputFeatures() of the
+    // inputSize() pixels once training has dropped the dead ones.
+    MatrixX<T> layerWeights(size_t layer) const {
+        if (static_)
+            return static_->weights(layer);
+        return layer == 0 ? fc1->weights() : fc2->weights();
     }
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &gradLoss) {
-        Eigen::MatrixXd grad2 = fc2.backward(gradLoss, sgd);
-        Eigen::MatrixXd gradRelu = relu.backward(grad2);
-        return fc1.backward(gradRelu, sgd);
+    const std::vector<int32_t> &inputFeatures() const { return input_features; }
+    size_t inputSize() const { return static_cast<size_t>(input_size); }
+
+    // The logits; softmax is fused into the loss. fc1 is Linear+ReLU. The layers read
+    // their inputs in place during backward, so input must outlive it; the hidden
+    // activation is fc1's own output.
+    const MatrixX<T> &forward(const MatrixX<T> &input) {
+        const MatrixX<T> &hidden = fc1->forward(input);
+        return fc2->forward(hidden);
+    }
+    // fc2 takes its input gradient straight through fc1's ReLU.
+    void backward(const MatrixX<T> &gradLoss) {
+        using InputGrad = typename FullyConnected<T, S>::InputGrad;
+        const MatrixX<T> &grad1 = fc2->backward(gradLoss, *optimizer_, InputGrad::ThroughRelu);
+        fc1->backward(grad1, *optimizer_, InputGrad::None, true);
     }
 
 private:
-    double learning_rate;
+    static MatrixX<T> widen(MatrixX<S> &&batch) {
+        if constexpr (std::is_same_v<S, T>)
+            return std::move(batch);
+        else
+            return batch.template cast<T>();
+    }
+
+    // Pixels that are zero in every training image are dropped from fc1 (or the static
+    // network's first layer) and from all batches, train and test alike. They would never
+    // contribute nor learn in training, so this only shrinks the first layer; at test time
+    // their untrained weights are gone.
+    void compactInputs(MNISTDataLoader<S> &trainLoader) {
+        if (!inputs_compacted) {
+            input_features = trainLoader.liveFeatures();
+            if (static_)
+                static_->keepInputs(input_features);
+            else
+                fc1->keepInputs(input_features);
+            inputs_compacted = true;
+            std::cout << "Live input features: " << input_features.size() << " of " << input_size << "\n";
+        }
+        trainLoader.keepFeatures(input_features);
+    }
+
+    double learning_rate, inference_seconds = 0.0;
     int num_epochs, batch_size, hidden_size, input_size;
     std::string train_data_path, train_labels_path, test_data_path, test_labels_path, log_file_path;
-    FullyConnected fc1, fc2;
-    Relu relu;
-    Softmax softmax;
-    CrossEntropyLoss loss_;
-    SGD sgd;
+    std::vector<int32_t> input_features;
+    std::vector<int> predictions_;
+    bool inputs_compacted = false;
+    std::unique_ptr<Backend<T>> backend_;
+    std::optional<FullyConnected<T, S>> fc1, fc2;    // unset when static_ runs the network
+    Softmax<T> softmax;
+    SoftmaxCrossEntropyLoss<T> loss_;
+    std::unique_ptr<Optimizer<T>> optimizer_;
+    std::unique_ptr<StaticNetwork<T, MnistTopology>> static_;
 };
@@ -2,17 +2,221 @@
 #include <Eigen/Dense>
 #include <random>
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-class SGD {
+#include "backend.hpp"
+#include "dispatch.hpp"
+#include "gemm.hpp"
+#include "simd.hpp"
+
+// Coefficients of one optimizer step, see MomentumSGD and Adam below.
+template<typename T>
+struct MomentumStep {
+    T lr, momentum;
+    bool nesterov;
+};
+
+// stepSize = lr / (1 - beta1^t) and invSqrtCorrection = 1 / sqrt(1 - beta2^t) fold in the
+// bias corrections; decay = 1 - lr * weightDecay scales the parameter first (AdamW).
+template<typename T>
+struct AdamStep {
+    T beta1, beta2, eps, stepSize, invSqrtCorrection, decay;
+};
+
+namespace optimizer_detail {
+inline namespace SIMD_ISA {
+
+// v = momentum * v + g, then p -= lr * v, or p -= lr * (g + momentum * v) for Nesterov.
+template<typename T>
+void momentumStep(T* p, T* v, const T* g, size_t rows, size_t n, size_t ldp, size_t ldg,
+                  const MomentumStep<T>& step) {
+    using P = simd::Packet<T>;
+    const typename P::type lr = P::set1(-step.lr), mu = P::set1(step.momentum);
+    for (size_t i = 0; i < rows; ++i, p += ldp, v += ldp, g += ldg) {
+        size_t j = 0;
+        for (; j + P::size <= n; j += P::size) {
+            const typename P::type gj = P::loadu(g + j), vj = P::fmadd(mu, P::loadu(v + j), gj);
+            P::storeu(v + j, vj);
+            P::storeu(p + j, P::fmadd(lr, step.nesterov ? P::fmadd(mu, vj, gj) : vj, P::loadu(p + j)));
+        }
+        for (; j < n; ++j) {
+            v[j] = step.momentum * v[j] + g[j];
+            p[j] -= step.lr * (step.nesterov ? g[j] + step.momentum * v[j] : v[j]);
+        }
+    }
+}
+
+// m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2, then
+// p = decay * p - stepSize * m / (sqrt(v) * invSqrtCorrection + eps).
+template<typename T>
+void adamStep(T* p, T* m, T* v, const T* g, size_t rows, size_t n, size_t ldp, size_t ldg,
+              const AdamStep<T>& step) {
+    using P = simd::Packet<T>;
+    const typename P::type b1 = P::set1(step.beta1), b2 = P::set1(step.beta2), c1 = P::set1(1 - step.beta1),
+                           c2 = P::set1(1 - step.beta2), eps = P::set1(step.eps), lr = P::set1(-step.stepSize),
+                           corr = P::set1(step.invSqrtCorrection), decay = P::set1(step.decay);
+    for (size_t i = 0; i < rows; ++i, p += ldp, m += ldp, v += ldp, g += ldg) {
+        size_t j = 0;
+        for (; j + P::size <= n; j += P::size) {
+            const typename P::type gj = P::loadu(g + j);
+            const typename P::type mj = P::fmadd(b1, P::loadu(m + j), P::mul(c1, gj));
+            const typename P::type vj = P::fmadd(b2, P::loadu(v + j), P::mul(c2, P::mul(gj, gj)));
+            P::storeu(m + j, mj);
+            P::storeu(v + j, vj);
+            const typename P::type denom = P::fmadd(P::sqrt(vj), corr, eps);
+            P::storeu(p + j, P::fmadd(lr, P::div(mj, denom), P::mul(decay, P::loadu(p + j))));
+        }
+        for (; j < n; ++j) {
+            m[j] = step.beta1 * m[j] + (1 - step.beta1) * g[j];
+            v[j] = step.beta2 * v[j] + (1 - step.beta2) * g[j] * g[j];
+            p[j] = step.decay * p[j] - step.stepSize * m[j] / (std::sqrt(v[j]) * step.invSqrtCorrection + step.eps);
+        }
+    }
+}
+
+} // namespace SIMD_ISA
+} // namespace optimizer_detail
+
+// Updates a layer's parameters in place from their gradients: the packed weights from a
+// row-major gradient of the same shape (row stride ldg) and the bias. Stateful
+// optimizers keep their state per parameter, keyed by its address and laid out like its
+// storage (the weights' panels), and update parameter and state together in one pass of
+// a dispatched SIMD kernel, split across threads by panel.
+template<typename T = double>
+class Optimizer {
 public:
-    explicit SGD(double lr = 0.001) : lr_(lr) {}
-    Eigen::MatrixXd updateWeights(const Eigen::MatrixXd &weights, const Eigen::MatrixXd &grad) const {
-        return weights - lr_ * grad;
+    explicit Optimizer(double lr) : lr_(lr) {}
+    virtual ~Optimizer() = default;
+    virtual const char *name() const = 0;
+    double learningRate() const { return lr_; }
+    // Whether updateWeightRows() may stand in for updateWeights() with a gradient that is
+    // zero outside the listed rows. Not so with state, which moves every parameter.
+    virtual bool sparseUpdates() const { return false; }
+    virtual void updateWeights(PackedMatrix<T> &weights, const T *grad, size_t ldg) = 0;
+    // Row r of the row-major grad belongs to weight row rows[r]; the others are untouched.
+    virtual void updateWeightRows(PackedMatrix<T> &, const T *, size_t, const std::vector<int32_t> &) {
+        throw std::runtime_error(std::string(name()) + ": the optimizer cannot update single weight rows");
     }
-private:
+    // bias[0, n) from grad[0, n); state is keyed by the bias pointer.
+    virtual void updateBias(T *bias, const T *grad, size_t n) = 0;
+    void updateBias(RowVectorX<T> &bias, const RowVectorX<T> &grad) {
+        updateBias(bias.data(), grad.data(), static_cast<size_t>(bias.size()));
+    }
+
+protected:
+    struct ParamState {
+        std::vector<T> first, second; // e.g. velocity, or Adam's moments
+        long steps = 0;
+    };
+    // Zero state of `size` elements for a new parameter, or one whose size changed.
+    ParamState &state(const void *param, size_t size, bool second) {
+        ParamState &s = state_[param];
+        if (s.first.size() != size) {
+            s.first.assign(size, T(0));
+            s.second.assign(second ? size : 0, T(0));
+            s.steps = 0;
+        }
+        return s;
+    }
+
     double lr_;
+
+private:
+    std::unordered_map<const void *, ParamState> state_;
+};
+
+template<typename T = double>
+class SGD : public Optimizer<T> {
+public:
+    explicit SGD(double lr = 0.001) : Optimizer<T>(lr) {}
+    const char *name() const override { return "sgd"; }
+    bool sparseUpdates() const override { return true; }
+    void updateWeights(PackedMatrix<T> &weights, const T *grad, size_t ldg) override {
+        weights.addScaled(grad, ldg, static_cast<T>(-this->lr_));
+    }
+    void updateWeightRows(PackedMatrix<T> &weights, const T *grad, size_t ldg,
+                          const std::vector<int32_t> &rows) override {
+        weights.addScaledRows(grad, ldg, rows.data(), rows.size(), static_cast<T>(-this->lr_));
+    }
+    void updateBias(T *bias, const T *grad, size_t n) override {
+        using Vector = Eigen::Matrix<T, 1, Eigen::Dynamic>;
+        Eigen::Map<Vector>(bias, n).noalias() -= static_cast<T>(this->lr_) * Eigen::Map<const Vector>(grad, n);
+    }
+};
+
+// SGD with heavy-ball or Nesterov momentum, as torch.optim.SGD (velocity starts at zero).
+template<typename T = double>
+class MomentumSGD : public Optimizer<T> {
+public:
+    explicit MomentumSGD(double lr = 0.001, double momentum = 0.9, bool nesterov = false)
+        : Optimizer<T>(lr), step_{ static_cast<T>(lr), static_cast<T>(momentum), nesterov } {}
+    const char *name() const override { return step_.nesterov ? "nesterov" : "momentum"; }
+    void updateWeights(PackedMatrix<T> &weights, const T *grad, size_t ldg) override {
+        T *velocity = this->state(&weights, weights.storageSize(), false).first.data();
+        const auto kernel = dispatch::kernels<T>().momentumStep;
+        weights.updatePanels(grad, [&](T *w, size_t offset, const T *g, size_t rows, size_t n) {
+            kernel(w, velocity + offset, g, rows, n, PackedMatrix<T>::kPanelWidth, ldg, step_);
+        });
+    }
+    void updateBias(T *bias, const T *grad, size_t n) override {
+        dispatch::kernels<T>().momentumStep(bias, this->state(bias, n, false).first.data(), grad, 1, n, n, n, step_);
+    }
+private:
+    MomentumStep<T> step_;
 };
 
+// Adam with bias-corrected moments; a nonzero weightDecay makes it AdamW, which decays
+// the parameters directly instead of adding to the gradient.
+template<typename T = double>
+class Adam : public Optimizer<T> {
+public:
+    explicit Adam(double lr = 0.001, double weightDecay = 0.0, double beta1 = 0.9, double beta2 = 0.999,
+                  double eps = 1e-8)
+        : Optimizer<T>(lr), weightDecay_(weightDecay), beta1_(beta1), beta2_(beta2), eps_(eps) {}
+    const char *name() const override { return weightDecay_ != 0.0 ? "adamw" : "adam"; }
+    void updateWeights(PackedMatrix<T> &weights, const T *grad, size_t ldg) override {
+        auto &s = this->state(&weights, weights.storageSize(), true);
+        const AdamStep<T> step = nextStep(s.steps);
+        T *m = s.first.data(), *v = s.second.data();
+        const auto kernel = dispatch::kernels<T>().adamStep;
+        weights.updatePanels(grad, [&](T *w, size_t offset, const T *g, size_t rows, size_t n) {
+            kernel(w, m + offset, v + offset, g, rows, n, PackedMatrix<T>::kPanelWidth, ldg, step);
+        });
+    }
+    void updateBias(T *bias, const T *grad, size_t n) override {
+        auto &s = this->state(bias, n, true);
+        dispatch::kernels<T>().adamStep(bias, s.first.data(), s.second.data(), grad, 1, n, n, n, nextStep(s.steps));
+    }
+private:
+    // The coefficients are computed in double and rounded once.
+    AdamStep<T> nextStep(long &steps) const {
+        const double t = static_cast<double>(++steps), lr = this->lr_;
+        return { static_cast<T>(beta1_), static_cast<T>(beta2_), static_cast<T>(eps_),
+                 static_cast<T>(lr / (1.0 - std::pow(beta1_, t))),
+                 static_cast<T>(1.0 / std::sqrt(1.0 - std::pow(beta2_, t))), static_cast<T>(1.0 - lr * weightDecay_) };
+    }
+
+    double weightDecay_, beta1_, beta2_, eps_;
+};
+
+// sgd, momentum, nesterov (momentum 0.9, as the PyTorch reference), adam or adamw
+// (weight decay 0.01), all at learning rate lr.
+template<typename T = double>
+std::unique_ptr<Optimizer<T>> makeOptimizer(const std::string &name, double lr) {
+    if (name == "sgd")
+        return std::make_unique<SGD<T>>(lr);
+    if (name == "momentum" || name == "nesterov")
+        return std::make_unique<MomentumSGD<T>>(lr, 0.9, name == "nesterov");
+    if (name == "adam" || name == "adamw")
+        return std::make_unique<Adam<T>>(lr, name == "adamw" ? 0.01 : 0.0);
+    throw std::invalid_argument("Unknown optimizer '" + name + "' (expected sgd, momentum, nesterov, adam or adamw)");
+}
+
 inline Eigen::MatrixXd heUniformInit(int outDim, int inDim, unsigned int seed = 1337) {
     std::mt19937 rng(seed);
     double limit = std::sqrt(6.0 / static_cast<double>(inDim));
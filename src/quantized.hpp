@@ -0,0 +1,258 @@
+#pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "dispatch.hpp"
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "tensor.hpp"
+
+// int8 post-training quantization of the trained network for inference. Weights are
+// rounded symmetrically to 7-bit integers (|q| <= kQuantWeightMax) with one scale per
+// output column or per matrix; activations are unsigned bytes with zero point 0, which
+// the raw pixels (scale 1/255) and the ReLU outputs of the hidden layer already are. A
+// layer is then a u8 x s8 product summed exactly in int32 (simd::DotU8S8), rescaled to
+// float by its epilogue.
+
+inline constexpr size_t kQuantPanelWidth = 16;
+inline constexpr int kQuantWeightMax = 63;
+
+enum class WeightScales { PerTensor, PerChannel };
+
+// Non-owning view of s8 weights packed by QuantizedMatrix. Panel p holds columns
+// 16p..16p+15 in groups of four rows: group g stores, per column, the weights of rows
+// 4g..4g+3 next to each other (64 bytes per group). Rows are padded with zeros to a
+// multiple of four and columns to the panel width.
+struct QuantizedPanels {
+    const int8_t* data;
+    size_t rows, cols;
+};
+
+// Applied to the int32 product: y = scale[j] * acc + bias[j], stored as float to out
+// (row-major, row stride ldo) or, if outU8 is set, clamped to [0, 255] (which includes
+// the ReLU) and rounded to the nearest byte.
+struct QuantEpilogue {
+    const float* scale;
+    const float* bias;
+    float* out;
+    uint8_t* outU8;
+    size_t ldo;
+};
+
+namespace quant_detail {
+inline namespace SIMD_ISA {
+
+inline constexpr size_t kRowBlock = 4;
+// Rows of A (~100 KB of pixels) kept in L2 while all panels pass over them.
+inline constexpr size_t kRowChunk = 128;
+
+// Bytes 4g..k-1 of row a as one 32-bit group, zero-padded.
+inline uint32_t byteGroup(const uint8_t* a, size_t g, size_t k) {
+    uint32_t v = 0;
+    for (size_t t = 0; 4 * g + t < k; ++t)
+        v |= static_cast<uint32_t>(a[4 * g + t]) << (8 * t);
+    return v;
+}
+
+// acc = rows (kRowBlock u8 rows of length k) times one panel, as int32. Each group of
+// weights is loaded once for all rows; a partial last group is assembled bytewise.
+inline void tile(const uint8_t* const* rows, const int8_t* panel, size_t k,
+                 int32_t (&acc)[kRowBlock][kQuantPanelWidth]) {
+    using D = simd::DotU8S8;
+    constexpr size_t V = kQuantPanelWidth / D::lanes;
+    typename D::type sum[kRowBlock][V];
+    for (size_t r = 0; r < kRowBlock; ++r)
+        for (size_t v = 0; v < V; ++v)
+            sum[r][v] = D::zero();
+    const auto step = [&](const int8_t* w, const uint32_t (&a)[kRowBlock]) {
+        typename D::type b[V];
+        for (size_t v = 0; v < V; ++v)
+            b[v] = D::loadu(w + 4 * D::lanes * v);
+        for (size_t r = 0; r < kRowBlock; ++r) {
+            const typename D::type x = D::set1(a[r]);
+            for (size_t v = 0; v < V; ++v)
+                sum[r][v] = D::dot(sum[r][v], x, b[v]);
+        }
+    };
+    uint32_t a[kRowBlock];
+    const size_t full = k / 4;
+    for (size_t g = 0; g < full; ++g, panel += 4 * kQuantPanelWidth) {
+        for (size_t r = 0; r < kRowBlock; ++r)
+            std::memcpy(&a[r], rows[r] + 4 * g, sizeof(uint32_t));
+        step(panel, a);
+    }
+    if (k % 4) {
+        for (size_t r = 0; r < kRowBlock; ++r)
+            a[r] = byteGroup(rows[r], full, k);
+        step(panel, a);
+    }
+    for (size_t r = 0; r < kRowBlock; ++r)
+        for (size_t v = 0; v < V; ++v)
+            D::storeu(acc[r] + D::lanes * v, sum[r][v]);
+}
+
+// Row r of a tile through the epilogue: n <= kQuantPanelWidth sums for columns j0..,
+// stored at offset o. Both loops are simple enough to be vectorized.
+inline void store(const int32_t* acc, size_t n, size_t j0, size_t o, const QuantEpilogue& epilogue) {
+    const float* scale = epilogue.scale + j0;
+    const float* bias = epilogue.bias + j0;
+    if (epilogue.outU8) {
+        uint8_t* out = epilogue.outU8 + o;
+        for (size_t j = 0; j < n; ++j) {
+            const float y = scale[j] * static_cast<float>(acc[j]) + bias[j];
+            out[j] = static_cast<uint8_t>(std::min(std::max(y, 0.0f), 255.0f) + 0.5f);
+        }
+    } else {
+        float* out = epilogue.out + o;
+        for (size_t j = 0; j < n; ++j)
+            out[j] = scale[j] * static_cast<float>(acc[j]) + bias[j];
+    }
+}
+
+// The epilogue applied to A * B for row-major u8 A (M x B.rows, row stride lda). Row
+// chunks are split across threads together with the panels.
+inline void gemmU8S8(const uint8_t* A, size_t M, size_t lda, const QuantizedPanels& B,
+                     const QuantEpilogue& epilogue) {
+    const size_t panels = (B.cols + kQuantPanelWidth - 1) / kQuantPanelWidth;
+    const size_t panelBytes = (B.rows + 3) / 4 * 4 * kQuantPanelWidth;
+    const size_t chunks = (M + kRowChunk - 1) / kRowChunk;
+    #pragma omp parallel for collapse(2) schedule(static) if (M * B.rows * B.cols >= gemm_detail::kParallelMinWork)
+    for (size_t c = 0; c < chunks; ++c) {
+        for (size_t p = 0; p < panels; ++p) {
+            const size_t j0 = p * kQuantPanelWidth, n = std::min(kQuantPanelWidth, B.cols - j0);
+            const size_t end = std::min(M, (c + 1) * kRowChunk);
+            for (size_t i0 = c * kRowChunk; i0 < end; i0 += kRowBlock) {
+                // Missing rows of the last block repeat its last row; their sums are dropped.
+                const size_t m = std::min(kRowBlock, end - i0);
+                const uint8_t* rows[kRowBlock];
+                for (size_t r = 0; r < kRowBlock; ++r)
+                    rows[r] = A + (i0 + std::min(r, m - 1)) * lda;
+                alignas(64) int32_t acc[kRowBlock][kQuantPanelWidth];
+                tile(rows, B.data + p * panelBytes, B.rows, acc);
+                for (size_t r = 0; r < m; ++r)
+                    store(acc[r], n, j0, (i0 + r) * epilogue.ldo + j0, epilogue);
+            }
+        }
+    }
+}
+
+} // namespace SIMD_ISA
+} // namespace quant_detail
+
+// Weights quantized to s8 in the QuantizedPanels layout, w(i, j) ~ scales()[j] * q(i, j).
+// The scale is max |w| / kQuantWeightMax, over column j (PerChannel) or over the whole
+// matrix (PerTensor).
+class QuantizedMatrix {
+public:
+    QuantizedMatrix() = default;
+    QuantizedMatrix(const Eigen::MatrixXd& w, WeightScales scales)
+        : rows_(static_cast<size_t>(w.rows())), cols_(static_cast<size_t>(w.cols())),
+          groups_((rows_ + 3) / 4), scales_(cols_),
+          panels_({ (cols_ + kQuantPanelWidth - 1) / kQuantPanelWidth * groups_ * 4 * kQuantPanelWidth }) {
+        const double tensorMax = w.cwiseAbs().maxCoeff();
+        for (size_t j = 0; j < cols_; ++j) {
+            const double absMax = scales == WeightScales::PerChannel ? w.col(j).cwiseAbs().maxCoeff() : tensorMax;
+            const double scale = absMax > 0.0 ? absMax / kQuantWeightMax : 1.0;
+            scales_[j] = static_cast<float>(scale);
+            for (size_t i = 0; i < rows_; ++i) {
+                const double q = std::round(w(i, j) / scale);
+                panels_.data()[offset(i, j)] =
+                    static_cast<int8_t>(std::clamp(q, double(-kQuantWeightMax), double(kQuantWeightMax)));
+            }
+        }
+    }
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    const std::vector<float>& scales() const { return scales_; }
+    int8_t operator()(size_t i, size_t j) const { return panels_.data()[offset(i, j)]; }
+    QuantizedPanels view() const { return { panels_.data(), rows_, cols_ }; }
+
+private:
+    size_t offset(size_t i, size_t j) const {
+        return ((j / kQuantPanelWidth * groups_ + i / 4) * kQuantPanelWidth + j % kQuantPanelWidth) * 4 + i % 4;
+    }
+
+    size_t rows_ = 0, cols_ = 0, groups_ = 0;
+    std::vector<float> scales_;
+    Tensor<int8_t> panels_;
+};
+
+// The trained 784 -> hidden (Linear+ReLU) -> 10 network in int8, run on raw pixels.
+// fc1's rows are put back at their pixel positions (zeros for pixels the network dropped,
+// see NeuralNetwork::compactInputs), so the IDX bytes are the first layer's input as they
+// are. The hidden activation is quantized to u8 with the scale max(h) / 255 over a
+// calibration set, computed by the double network; the logits come out as float.
+class QuantizedNetwork {
+public:
+    // w1 and w2 as FullyConnected::weights() ((in + 1) x out, bias in the last row); the
+    // rows of w1 are the input pixels listed in features, among inputSize. calibration
+    // holds count images of inputSize bytes.
+    QuantizedNetwork(const Eigen::MatrixXd& w1, const Eigen::MatrixXd& w2, const std::vector<int32_t>& features,
+                     size_t inputSize, const uint8_t* calibration, size_t count, WeightScales scales)
+        : inputSize_(inputSize), hiddenSize_(static_cast<size_t>(w1.cols())) {
+        const Eigen::Index in = w1.rows() - 1;
+        if (static_cast<size_t>(in) != features.size() || w2.rows() - 1 != w1.cols())
+            throw std::invalid_argument("QuantizedNetwork: layer shapes do not match");
+        if (count == 0)
+            throw std::invalid_argument("QuantizedNetwork: empty calibration set");
+
+        Eigen::MatrixXd W1 = Eigen::MatrixXd::Zero(static_cast<Eigen::Index>(inputSize), w1.cols());
+        for (Eigen::Index i = 0; i < in; ++i)
+            W1.row(features[i]) = w1.row(i);
+        const Eigen::RowVectorXd b1 = w1.bottomRows<1>(), b2 = w2.bottomRows<1>();
+
+        Eigen::MatrixXd X(static_cast<Eigen::Index>(count), static_cast<Eigen::Index>(inputSize));
+        for (size_t s = 0; s < count; ++s)
+            for (size_t i = 0; i < inputSize; ++i)
+                X(s, i) = calibration[s * inputSize + i] / 255.0;
+        const double hiddenMax = ((X * W1).rowwise() + b1).cwiseMax(0.0).maxCoeff();
+        hiddenScale_ = hiddenMax > 0.0 ? hiddenMax / 255.0 : 1.0;
+
+        fc1_ = QuantizedMatrix(W1, scales);
+        fc2_ = QuantizedMatrix(w2.topRows(w2.rows() - 1), scales);
+        for (size_t j = 0; j < hiddenSize_; ++j) {
+            scale1_.push_back(static_cast<float>(fc1_.scales()[j] / (255.0 * hiddenScale_)));
+            bias1_.push_back(static_cast<float>(b1[j] / hiddenScale_));
+        }
+        for (size_t j = 0; j < fc2_.cols(); ++j) {
+            scale2_.push_back(static_cast<float>(hiddenScale_ * fc2_.scales()[j]));
+            bias2_.push_back(static_cast<float>(b2[j]));
+        }
+    }
+
+    size_t outputSize() const { return fc2_.cols(); }
+    double hiddenScale() const { return hiddenScale_; }
+
+    // Logits of count images of inputSize bytes, row-major count x outputSize(). The
+    // hidden activations are per call, so concurrent calls on one network are safe.
+    void logits(const uint8_t* pixels, size_t count, float* out) const {
+        const auto kernel = dispatch::kernels<float>().gemmU8S8;
+        std::vector<uint8_t> hidden(count * hiddenSize_);
+        kernel(pixels, count, inputSize_, fc1_.view(), { scale1_.data(), bias1_.data(), nullptr, hidden.data(),
+                                                         hiddenSize_ });
+        kernel(hidden.data(), count, hiddenSize_, fc2_.view(), { scale2_.data(), bias2_.data(), out, nullptr,
+                                                                 outputSize() });
+    }
+    std::vector<int> predict(const uint8_t* pixels, size_t count) const {
+        std::vector<float> out(count * outputSize());
+        logits(pixels, count, out.data());
+        std::vector<int> predicted(count);
+        for (size_t s = 0; s < count; ++s) {
+            const float* row = out.data() + s * outputSize();
+            predicted[s] = static_cast<int>(std::max_element(row, row + outputSize()) - row);
+        }
+        return predicted;
+    }
+
+private:
+    size_t inputSize_, hiddenSize_;
+    double hiddenScale_ = 1.0;
+    QuantizedMatrix fc1_, fc2_;
+    std::vector<float> scale1_, bias1_, scale2_, bias2_;
+};
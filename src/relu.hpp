@@ -1,16 +1,32 @@
 #pragma once
-#include <Eigen/Dense>
+#include <cstddef>
 
-class Relu {
-public:
-    Relu() = default;
-    Eigen::MatrixXd forward(const Eigen::MatrixXd &input) {
-        cache_ = input;
-        return input.cwiseMax(0.0);
-    }
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &grad) {
-        return grad.array() * (cache_.array() > 0.0).cast<double>().array();
-    }
-private:
-    Eigen::MatrixXd cache_;
-};
+#include "simd.hpp"
+
+namespace relu_detail {
+inline namespace SIMD_ISA {
+
+// out = max(in, 0) over n contiguous elements.
+template<typename T>
+void forward(const T* in, T* out, size_t n) {
+    using P = simd::Packet<T>;
+    size_t i = 0;
+    for (; i + P::size <= n; i += P::size)
+        P::storeu(out + i, P::max(P::loadu(in + i), P::zero()));
+    for (; i < n; ++i)
+        out[i] = in[i] > T(0) ? in[i] : T(0);
+}
+
+// out = grad where act > 0, else 0.
+template<typename T>
+void backward(const T* grad, const T* act, T* out, size_t n) {
+    using P = simd::Packet<T>;
+    size_t i = 0;
+    for (; i + P::size <= n; i += P::size)
+        P::storeu(out + i, P::selectPositive(P::loadu(act + i), P::loadu(grad + i)));
+    for (; i < n; ++i)
+        out[i] = act[i] > T(0) ? grad[i] : T(0);
+}
+
+} // namespace SIMD_ISA
+} // namespace relu_detail
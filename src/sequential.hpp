@@ -0,0 +1,364 @@
+#pragma once
+#include <Eigen/Dense>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "backend.hpp"
+#include "fullyconnected.hpp"
+#include "gemm.hpp"
+#include "optimizers.hpp"
+#include "sparse.hpp"
+
+// Compile-time network topology, e.g.
+//
+//   using Mlp = Sequential<Dense<784, 500>, ReLU, Dense<500, 10>, SoftmaxCE>;
+//
+// checked when it is instantiated (widths chain, a ReLU follows a Dense, the loss comes
+// last), and StaticNetwork<T, Mlp>, which trains and runs it with every width a template
+// argument: the layers are a std::tuple walked by folds over index sequences instead of
+// a runtime list, activations and gradients are fixed-width Eigen blocks of two buffers
+// with a compile-time number of columns, and biases and weight gradients are fixed-size
+// Eigen matrices where they fit Eigen's static allocation limit. A Dense of at most
+// dispatch::kNarrowWidths outputs (the 10 logits) calls the GEMM kernel compiled for its
+// width directly, with the bias fused into the stores; every other product is the same
+// Backend call FullyConnected makes, with the shapes passed at runtime.
+//
+// Only that narrow forward is faster: it saves the per-call dispatch and the separate
+// bias pass, about 1-2 us per batch (10-30% of the 500 -> 10 product at batches up to
+// 100 in double, within noise in float). The 784 -> 500 layer dominates the step, so the
+// static network trains no measurably faster than the runtime one; it is mainly a
+// checked description of the topology. NeuralNetwork (--network=static) uses it when the
+// configured shape has a compiled topology; FullyConnected and the runtime sizes remain
+// for every other shape and for mixed precision.
+
+template<size_t In, size_t Out>
+struct Dense {
+    static_assert(In > 0 && Out > 0, "Dense: a layer needs inputs and outputs");
+};
+// ReLU on the preceding Dense, fused into its GEMM epilogue.
+struct ReLU {};
+// Softmax + cross-entropy on the logits of the last Dense; training only, forward()
+// returns the logits.
+struct SoftmaxCE {};
+
+namespace sequential_detail {
+
+template<typename L>
+struct LayerInfo {
+    static constexpr bool dense = false, relu = std::is_same_v<L, ReLU>, loss = std::is_same_v<L, SoftmaxCE>;
+    static constexpr size_t in = 0, out = 0;
+};
+template<size_t In, size_t Out>
+struct LayerInfo<Dense<In, Out>> {
+    static constexpr bool dense = true, relu = false, loss = false;
+    static constexpr size_t in = In, out = Out;
+};
+
+// Column-major for a single column (Eigen has no row-major column vectors).
+template<size_t Rows, size_t Cols>
+inline constexpr int kRowMajorOptions = Cols == 1 && Rows != 1 ? Eigen::ColMajor : Eigen::RowMajor;
+
+// Rows x Cols of T with fixed size if it fits the static allocation limit, on the heap
+// (sized by the owner) otherwise; row-major.
+template<typename T, size_t Rows, size_t Cols>
+using FixedIfSmall = std::conditional_t<
+    Rows * Cols * sizeof(T) <= EIGEN_STACK_ALLOCATION_LIMIT,
+    Eigen::Matrix<T, static_cast<int>(Rows), static_cast<int>(Cols), kRowMajorOptions<Rows, Cols>>,
+    Eigen::Matrix<T, Rows == 1 ? 1 : Eigen::Dynamic, Eigen::Dynamic, kRowMajorOptions<Rows, Cols>>>;
+
+template<typename M>
+void allocate(M &m, size_t rows, size_t cols) {
+    if constexpr (M::SizeAtCompileTime == Eigen::Dynamic)
+        m.resize(static_cast<Eigen::Index>(rows), static_cast<Eigen::Index>(cols));
+}
+
+} // namespace sequential_detail
+
+template<typename... Layers>
+struct Sequential {
+private:
+    template<typename L>
+    using Info = sequential_detail::LayerInfo<L>;
+    static constexpr size_t kLayers = sizeof...(Layers);
+    static constexpr std::array<bool, kLayers> kDenseAt{ Info<Layers>::dense... }, kReluAt{ Info<Layers>::relu... },
+                                               kLossAt{ Info<Layers>::loss... };
+    static constexpr std::array<size_t, kLayers> kIn{ Info<Layers>::in... }, kOut{ Info<Layers>::out... };
+
+    static constexpr bool widthsChain() {
+        size_t width = 0;
+        for (size_t i = 0; i < kLayers; ++i) {
+            if (!kDenseAt[i])
+                continue;
+            if (width != 0 && kIn[i] != width)
+                return false;
+            width = kOut[i];
+        }
+        return true;
+    }
+    static constexpr bool reluAfterDense() {
+        for (size_t i = 0; i < kLayers; ++i)
+            if (kReluAt[i] && (i == 0 || !kDenseAt[i - 1]))
+                return false;
+        return true;
+    }
+    static constexpr bool lossLastOnly() {
+        for (size_t i = 0; i + 1 < kLayers; ++i)
+            if (kLossAt[i])
+                return false;
+        return kLayers > 0 && kLossAt[kLayers - 1];
+    }
+
+    static_assert(((Info<Layers>::dense || Info<Layers>::relu || Info<Layers>::loss) && ...),
+                  "Sequential: layers are Dense<In, Out>, ReLU or SoftmaxCE");
+    static_assert(kLayers > 0 && kDenseAt[0], "Sequential: the first layer must be a Dense");
+    static_assert(widthsChain(), "Sequential: each Dense must take the outputs of the previous one");
+    static_assert(reluAfterDense(), "Sequential: a ReLU must directly follow a Dense");
+    static_assert(lossLastOnly(), "Sequential: SoftmaxCE must be the last layer, and only that");
+
+public:
+    // Number of Dense layers, the widths from the input to the logits, and whether Dense
+    // layer l is followed by a ReLU.
+    static constexpr size_t kDense = (size_t(Info<Layers>::dense) + ...);
+    static constexpr std::array<size_t, kDense + 1> widths = [] {
+        std::array<size_t, kDense + 1> w{};
+        for (size_t i = 0, l = 0; i < kLayers; ++i) {
+            if (kDenseAt[i]) {
+                w[l] = kIn[i];
+                w[++l] = kOut[i];
+            }
+        }
+        return w;
+    }();
+    static constexpr std::array<bool, kDense> relu = [] {
+        std::array<bool, kDense> r{};
+        for (size_t i = 0, l = 0; i < kLayers; ++i) {
+            if (kDenseAt[i])
+                ++l;
+            else if (kReluAt[i])
+                r[l - 1] = true;
+        }
+        return r;
+    }();
+    static constexpr size_t inputs = widths.front(), outputs = widths.back();
+};
+
+// A Dense layer of StaticNetwork: the counterpart of FullyConnected<T> with the widths as
+// template arguments, sharing its backward steps (dense_detail). It works on column-major
+// batches (row stride 1, column stride the batch size) in the network's buffers. With
+// Sparse (the first layer, fed raw pixels) sparse batches take the CSR path as in
+// FullyConnected::setSparseInput, and keepInputs can drop dead inputs, so the input
+// width of that layer is a runtime size of at most In.
+template<typename T, size_t In, size_t Out, bool Relu, bool Sparse>
+class StaticDense {
+    static constexpr int kInputCols = Sparse ? Eigen::Dynamic : static_cast<int>(In);
+
+public:
+    using Input = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, kInputCols>>;
+    using Grad = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, static_cast<int>(Out)>>;
+
+    // The initial weights are those of FullyConnected<T>(In, Out), bias zero.
+    StaticDense() : weights_(In, Out) {
+        const Eigen::MatrixXd w = heUniformInit(In, Out);
+        for (size_t j = 0; j < Out; ++j)
+            for (size_t i = 0; i < In; ++i)
+                weights_(i, j) = static_cast<T>(w(i, j));
+        sequential_detail::allocate(bias_, 1, Out);
+        sequential_detail::allocate(gradBias_, 1, Out);
+        sequential_detail::allocate(gradWeights_, In, Out);
+        bias_.setZero();
+    }
+
+    size_t inputs() const { return weights_.rows(); }
+
+    // Weights as an (inputs() + 1) x Out matrix whose last row is the bias.
+    MatrixX<T> weights() const {
+        MatrixX<T> w(inputs() + 1, Out);
+        w.topRows(inputs()) = weights_.toDense();
+        w.template bottomRows<1>() = bias_;
+        return w;
+    }
+
+    // FullyConnected::keepInputs: only the listed inputs (ascending) remain.
+    void keepInputs(const std::vector<int32_t> &inputs) {
+        static_assert(Sparse, "StaticDense: only the first layer drops inputs");
+        PackedMatrix<T> kept(inputs.size(), Out);
+        for (size_t j = 0; j < Out; ++j)
+            for (size_t i = 0; i < inputs.size(); ++i)
+                kept(i, j) = weights_(static_cast<size_t>(inputs[i]), j);
+        weights_ = std::move(kept);
+        gradWeights_.resize(static_cast<Eigen::Index>(inputs.size()), Eigen::NoChange);
+    }
+
+    // out (batch x Out) = in * W + b, then the ReLU. A narrow layer (the logits) calls the
+    // backend's kernel compiled for Out, if it has one, instead of gemmPacked; a single row
+    // or column stays on gemmPacked's matrix-vector paths, so the results match
+    // FullyConnected bit for bit.
+    void forward(const Input &in, T *out, const Backend<T> &backend) {
+        const size_t batch = static_cast<size_t>(in.rows());
+        const GemmEpilogue<T> epilogue{ bias_.data(), Relu };
+        sparseBatch_ = false;
+        if constexpr (Sparse) {
+            inputT_ = CsrMatrix<T>::fromDense(in.data(), inputs(), batch, batch);
+            sparseBatch_ = inputT_.density() <= kSparseInputMaxDensity;
+        }
+        if (sparseBatch_) {
+            backend.sparseGemmPacked(inputT_.transposed().view(), weights_.view(), out, batch, epilogue);
+            return;
+        }
+        if constexpr (Out > 1 && Out <= dispatch::kNarrowWidths) {
+            const dispatch::NarrowGemm<T> narrow = batch > 1 ? backend.narrowGemmPacked(Out) : nullptr;
+            if (narrow) {
+                narrow(gemmOperand(in), weights_.view(), out, batch, epilogue);
+                return;
+            }
+        }
+        backend.gemmPacked(gemmOperand(in), weights_.view(), out, 1, batch, T(1), T(0), epilogue);
+    }
+
+    // Updates the parameters from grad, the gradient w.r.t. the output of the last
+    // forward (already through this layer's ReLU). If inputGrad is given, it receives the
+    // gradient w.r.t. in, zeroed where the gate (the ReLU output that in is) is not positive.
+    void backward(const Input &in, const Grad &grad, T *inputGrad, const T *gate, Optimizer<T> &optimizer,
+                  const Backend<T> &backend) {
+        const size_t batch = static_cast<size_t>(grad.rows());
+        dense_detail::weightGradient(backend, gemmOperand(in), sparseBatch_ ? &inputT_ : nullptr, grad.data(), batch,
+                                     Out, gradWeights_.data(), activeRows_);
+        backend.columnSums(grad.data(), batch, Out, batch, gradBias_.data());
+        if (inputGrad)
+            backend.gemmPackedTransposed(gemmOperand(grad), weights_.view(), inputGrad, 1, batch, T(1), T(0), gate);
+        dense_detail::updateWeights(optimizer, weights_, gradWeights_, sparseBatch_, activeRows_);
+        optimizer.updateBias(bias_.data(), gradBias_.data(), Out);
+    }
+
+private:
+    // The first layer's rows follow keepInputs.
+    using GradWeights = std::conditional_t<
+        Sparse, Eigen::Matrix<T, Eigen::Dynamic, static_cast<int>(Out), sequential_detail::kRowMajorOptions<In, Out>>,
+        sequential_detail::FixedIfSmall<T, In, Out>>;
+
+    PackedMatrix<T> weights_;
+    sequential_detail::FixedIfSmall<T, 1, Out> bias_, gradBias_;
+    GradWeights gradWeights_;
+    bool sparseBatch_ = false;
+    CsrMatrix<T> inputT_;
+    std::vector<int32_t> activeRows_;
+};
+
+// Trains and runs a Sequential topology in scalar type T, see the top of this file. The
+// output of Dense layer l is columns offset(l) .. offset(l) + widths[l + 1] of the
+// activation buffer (batch rows, a compile-time number of columns); the gradient w.r.t.
+// it sits at the same columns of the gradient buffer. The first layer takes the
+// sparse-input path and may drop dead inputs (keepInputs).
+template<typename T, typename Topology>
+class StaticNetwork {
+    static constexpr size_t L = Topology::kDense;
+    static constexpr auto W = Topology::widths;
+
+    template<size_t l>
+    using Layer = StaticDense<T, W[l], W[l + 1], Topology::relu[l], l == 0>;
+    template<size_t... l>
+    static std::tuple<Layer<l>...> makeLayers(std::index_sequence<l...>);
+    using Layers = decltype(makeLayers(std::make_index_sequence<L>{}));
+
+    static constexpr std::array<size_t, L + 1> kOffset = [] {
+        std::array<size_t, L + 1> o{};
+        for (size_t l = 0; l < L; ++l)
+            o[l + 1] = o[l] + W[l + 1];
+        return o;
+    }();
+
+public:
+    explicit StaticNetwork(const Backend<T> &backend = defaultBackend<T>()) : backend_(&backend) {}
+
+    // The input columns forward expects: Topology::inputs, or fewer after keepInputs.
+    size_t inputs() const { return std::get<0>(layers_).inputs(); }
+    // Drops all inputs but the listed ones (ascending) from the first layer, as
+    // FullyConnected::keepInputs; batches then carry only those columns.
+    void keepInputs(const std::vector<int32_t> &inputs) { std::get<0>(layers_).keepInputs(inputs); }
+
+    // The weights of Dense layer l as FullyConnected::weights() returns them.
+    MatrixX<T> weights(size_t l) const {
+        if (l >= L)
+            throw std::out_of_range("StaticNetwork: no layer " + std::to_string(l));
+        MatrixX<T> w;
+        [&]<size_t... i>(std::index_sequence<i...>) {
+            ((i == l ? (w = std::get<i>(layers_).weights(), 0) : 0), ...);
+        }(std::make_index_sequence<L>{});
+        return w;
+    }
+
+    // The logits (batch x outputs), valid until the next forward. input (batch x inputs())
+    // must stay alive until the following backward.
+    auto forward(const MatrixX<T> &input) {
+        if (static_cast<size_t>(input.cols()) != inputs())
+            throw std::invalid_argument("StaticNetwork: expected " + std::to_string(inputs()) +
+                                        " input columns, got " + std::to_string(input.cols()));
+        input_ = &input;
+        const Eigen::Index batch = input.rows();
+        if (activations_.rows() != batch) {
+            activations_.resize(batch, Eigen::NoChange);
+            grads_.resize(batch, Eigen::NoChange);
+        }
+        [&]<size_t... l>(std::index_sequence<l...>) {
+            (std::get<l>(layers_).forward(layerInput<l>(), block<l>(activations_).data(), *backend_), ...);
+        }(std::make_index_sequence<L>{});
+        return std::as_const(activations_).template middleCols<W[L]>(static_cast<Eigen::Index>(kOffset[L - 1]));
+    }
+
+    // One SGD-style step on a batch: forward, softmax + cross-entropy against the one-hot
+    // labels, backward with the parameters updated by the optimizer. Returns the mean loss.
+    T trainStep(const MatrixX<T> &input, const MatrixX<T> &labels, Optimizer<T> &optimizer) {
+        forward(input);
+        const size_t batch = static_cast<size_t>(input.rows());
+        if (static_cast<size_t>(labels.rows()) != batch || static_cast<size_t>(labels.cols()) != Topology::outputs)
+            throw std::invalid_argument("StaticNetwork: labels do not match the batch");
+        const T scale = T(1) / static_cast<T>(batch);
+        const T loss = backend_->softmaxCrossEntropy(block<L - 1>(activations_).data(), labels.data(),
+                                                     block<L - 1>(grads_).data(), batch, Topology::outputs, batch,
+                                                     scale) * scale;
+        [&]<size_t... i>(std::index_sequence<i...>) {
+            (backwardLayer<L - 1 - i>(optimizer), ...);
+        }(std::make_index_sequence<L>{});
+        return loss;
+    }
+
+private:
+    // Columns of layer l's output in buf, as a fixed-width block.
+    template<size_t l, typename M>
+    static auto block(M &buf) {
+        return buf.template middleCols<W[l + 1]>(static_cast<Eigen::Index>(kOffset[l]));
+    }
+    template<size_t l>
+    typename Layer<l>::Input layerInput() const {
+        const Eigen::Index batch = activations_.rows();
+        if constexpr (l == 0)
+            return typename Layer<l>::Input(input_->data(), batch, input_->cols());
+        else
+            return typename Layer<l>::Input(block<l - 1>(activations_).data(), batch, static_cast<Eigen::Index>(W[l]));
+    }
+    // The input gradient is only formed above the first layer; through a ReLU, it is
+    // gated by the ReLU output (this layer's input) as it is stored.
+    template<size_t l>
+    void backwardLayer(Optimizer<T> &optimizer) {
+        const typename Layer<l>::Grad grad(block<l>(grads_).data(), grads_.rows(), static_cast<Eigen::Index>(W[l + 1]));
+        T *inputGrad = nullptr;
+        const T *gate = nullptr;
+        if constexpr (l > 0) {
+            inputGrad = block<l - 1>(grads_).data();
+            if constexpr (Topology::relu[l - 1])
+                gate = block<l - 1>(activations_).data();
+        }
+        std::get<l>(layers_).backward(layerInput<l>(), grad, inputGrad, gate, optimizer, *backend_);
+    }
+
+    const Backend<T> *backend_;
+    Layers layers_;
+    const MatrixX<T> *input_ = nullptr;
+    Eigen::Matrix<T, Eigen::Dynamic, static_cast<int>(kOffset[L])> activations_, grads_;
+};
@@ -0,0 +1,496 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+// Minimal packet abstraction for the hand-written kernels (matvec, GEMM, ...).
+// simd::Packet<T> picks the widest vector unit the translation unit is compiled for;
+// types without a specialization fall back to a one-lane scalar "packet", so kernels
+// written against this interface compile and stay correct everywhere.
+//
+// The kernels are compiled once per ISA level (src/kernels_isa.cpp) and selected at
+// runtime (src/dispatch.hpp). Everything that depends on the packet width therefore
+// lives in an inline namespace named by SIMD_ISA, which keeps the per-ISA copies of
+// the same template distinct at link time. Ordinary translation units use "base".
+#ifndef SIMD_ISA
+#define SIMD_ISA base
+#endif
+
+namespace simd {
+inline namespace SIMD_ISA {
+
+template<typename T>
+struct Packet {
+    using type = T;
+    static constexpr size_t size = 1;
+    static type zero() { return T(0); }
+    static type set1(T v) { return v; }
+    static type loadu(const T* p) { return *p; }
+    static void storeu(T* p, type v) { *p = v; }
+    static type loadBytes(const uint8_t* p) { return static_cast<T>(*p); }
+    static type gather(const T* base, const int32_t* idx) { return base[idx[0]]; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type fmadd(type a, type b, type c) { return a * b + c; }
+    static type max(type a, type b) { return a > b ? a : b; }
+    static type min(type a, type b) { return a < b ? a : b; }
+    static type selectPositive(type cond, type v) { return cond > T(0) ? v : T(0); }
+    static T reduceAdd(type v) { return v; }
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2)), for positive normal x.
+    static type frexp(type x, type& e) {
+        int n;
+        T m = std::frexp(x, &n);
+        if (m < T(0.70710678118654752440)) {
+            m += m;
+            --n;
+        }
+        e = static_cast<T>(n);
+        return m;
+    }
+};
+
+#if defined(__AVX512F__)
+
+template<>
+struct Packet<double> {
+    using type = __m512d;
+    static constexpr size_t size = 8;
+    static type zero() { return _mm512_setzero_pd(); }
+    static type set1(double v) { return _mm512_set1_pd(v); }
+    static type loadu(const double* p) { return _mm512_loadu_pd(p); }
+    static void storeu(double* p, type v) { _mm512_storeu_pd(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    static type gather(const double* base, const int32_t* idx) {
+        return _mm512_i32gather_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), base, 8);
+    }
+    static type add(type a, type b) { return _mm512_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm512_div_pd(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_pd(a); }
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+    static type max(type a, type b) { return _mm512_max_pd(a, b); }
+    static type min(type a, type b) { return _mm512_min_pd(a, b); }
+    static type round(type a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    // x * 2^n for integral n in the normal exponent range: n + 1.5 * 2^52 holds n in its
+    // low mantissa bits, which are moved into the exponent field.
+    static type ldexp(type x, type n) {
+        __m512i bits = _mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(0x1.8p52)));
+        bits = _mm512_slli_epi64(_mm512_add_epi64(bits, _mm512_set1_epi64(1023)), 52);
+        return _mm512_mul_pd(x, _mm512_castsi512_pd(bits));
+    }
+    // The inverse, as in the scalar packet: adding the offset from the bits of sqrt(1/2) to
+    // those of 1 moves the exponent step to sqrt(1/2), and the exponent is read back into a
+    // double through the 1.5 * 2^52 trick.
+    static type frexp(type x, type& e) {
+        const __m512i bits = _mm512_castpd_si512(x);
+        const __m512i k = _mm512_srli_epi64(_mm512_add_epi64(bits, _mm512_set1_epi64(0x00095f619980c433)), 52);
+        e = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(k, _mm512_set1_epi64(0x4338000000000000))),
+                          _mm512_set1_pd(0x1.8p52 + 1023));
+        return _mm512_castsi512_pd(_mm512_add_epi64(_mm512_sub_epi64(bits, _mm512_slli_epi64(k, 52)),
+                                                     _mm512_set1_epi64(0x3ff0000000000000)));
+    }
+    static type selectPositive(type cond, type v) {
+        return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(cond, _mm512_setzero_pd(), _CMP_GT_OQ), v);
+    }
+    static double reduceAdd(type v) { return _mm512_reduce_add_pd(v); }
+};
+
+template<>
+struct Packet<float> {
+    using type = __m512;
+    static constexpr size_t size = 16;
+    static type zero() { return _mm512_setzero_ps(); }
+    static type set1(float v) { return _mm512_set1_ps(v); }
+    static type loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static void storeu(float* p, type v) { _mm512_storeu_ps(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+    }
+    static type gather(const float* base, const int32_t* idx) {
+        return _mm512_i32gather_ps(_mm512_loadu_si512(idx), base, 4);
+    }
+    static type add(type a, type b) { return _mm512_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm512_div_ps(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_ps(a); }
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+    static type max(type a, type b) { return _mm512_max_ps(a, b); }
+    static type min(type a, type b) { return _mm512_min_ps(a, b); }
+    static type round(type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type ldexp(type x, type n) {
+        __m512i bits = _mm512_castps_si512(_mm512_add_ps(n, _mm512_set1_ps(0x1.8p23f)));
+        bits = _mm512_slli_epi32(_mm512_add_epi32(bits, _mm512_set1_epi32(127)), 23);
+        return _mm512_mul_ps(x, _mm512_castsi512_ps(bits));
+    }
+    static type frexp(type x, type& e) {
+        const __m512i bits = _mm512_castps_si512(x);
+        const __m512i k = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_set1_epi32(0x004afb0d)), 23);
+        e = _mm512_sub_ps(_mm512_castsi512_ps(_mm512_or_si512(k, _mm512_set1_epi32(0x4b400000))),
+                          _mm512_set1_ps(0x1.8p23f + 127));
+        return _mm512_castsi512_ps(_mm512_add_epi32(_mm512_sub_epi32(bits, _mm512_slli_epi32(k, 23)),
+                                                     _mm512_set1_epi32(0x3f800000)));
+    }
+    static type selectPositive(type cond, type v) {
+        return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(cond, _mm512_setzero_ps(), _CMP_GT_OQ), v);
+    }
+    static float reduceAdd(type v) { return _mm512_reduce_add_ps(v); }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+template<>
+struct Packet<double> {
+    using type = __m256d;
+    static constexpr size_t size = 4;
+    static type zero() { return _mm256_setzero_pd(); }
+    static type set1(double v) { return _mm256_set1_pd(v); }
+    static type loadu(const double* p) { return _mm256_loadu_pd(p); }
+    static void storeu(double* p, type v) { _mm256_storeu_pd(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        int32_t b;
+        std::memcpy(&b, p, 4);
+        return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(b)));
+    }
+    static type gather(const double* base, const int32_t* idx) {
+        return _mm256_i32gather_pd(base, _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx)), 8);
+    }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+    static type max(type a, type b) { return _mm256_max_pd(a, b); }
+    static type min(type a, type b) { return _mm256_min_pd(a, b); }
+    static type round(type a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type ldexp(type x, type n) {
+        __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(0x1.8p52)));
+        bits = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+        return _mm256_mul_pd(x, _mm256_castsi256_pd(bits));
+    }
+    static type frexp(type x, type& e) {
+        const __m256i bits = _mm256_castpd_si256(x);
+        const __m256i k = _mm256_srli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(0x00095f619980c433)), 52);
+        e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(k, _mm256_set1_epi64x(0x4338000000000000))),
+                          _mm256_set1_pd(0x1.8p52 + 1023));
+        return _mm256_castsi256_pd(_mm256_add_epi64(_mm256_sub_epi64(bits, _mm256_slli_epi64(k, 52)),
+                                                     _mm256_set1_epi64x(0x3ff0000000000000)));
+    }
+    static type selectPositive(type cond, type v) {
+        return _mm256_and_pd(_mm256_cmp_pd(cond, _mm256_setzero_pd(), _CMP_GT_OQ), v);
+    }
+    static double reduceAdd(type v) {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+};
+
+template<>
+struct Packet<float> {
+    using type = __m256;
+    static constexpr size_t size = 8;
+    static type zero() { return _mm256_setzero_ps(); }
+    static type set1(float v) { return _mm256_set1_ps(v); }
+    static type loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static void storeu(float* p, type v) { _mm256_storeu_ps(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    static type gather(const float* base, const int32_t* idx) {
+        return _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 4);
+    }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type ldexp(type x, type n) {
+        __m256i bits = _mm256_castps_si256(_mm256_add_ps(n, _mm256_set1_ps(0x1.8p23f)));
+        bits = _mm256_slli_epi32(_mm256_add_epi32(bits, _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(x, _mm256_castsi256_ps(bits));
+    }
+    static type frexp(type x, type& e) {
+        const __m256i bits = _mm256_castps_si256(x);
+        const __m256i k = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_set1_epi32(0x004afb0d)), 23);
+        e = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(k, _mm256_set1_epi32(0x4b400000))),
+                          _mm256_set1_ps(0x1.8p23f + 127));
+        return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_sub_epi32(bits, _mm256_slli_epi32(k, 23)),
+                                                     _mm256_set1_epi32(0x3f800000)));
+    }
+    static type selectPositive(type cond, type v) {
+        return _mm256_and_ps(_mm256_cmp_ps(cond, _mm256_setzero_ps(), _CMP_GT_OQ), v);
+    }
+    static float reduceAdd(type v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+    }
+};
+
+#elif defined(__SSE4_2__)
+
+// 128-bit packets without FMA: fmadd is a separate multiply and add.
+template<>
+struct Packet<double> {
+    using type = __m128d;
+    static constexpr size_t size = 2;
+    static type zero() { return _mm_setzero_pd(); }
+    static type set1(double v) { return _mm_set1_pd(v); }
+    static type loadu(const double* p) { return _mm_loadu_pd(p); }
+    static void storeu(double* p, type v) { _mm_storeu_pd(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        uint16_t b;
+        std::memcpy(&b, p, 2);
+        return _mm_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(b)));
+    }
+    static type gather(const double* base, const int32_t* idx) { return _mm_set_pd(base[idx[1]], base[idx[0]]); }
+    static type add(type a, type b) { return _mm_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm_div_pd(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_pd(a); }
+    static type fmadd(type a, type b, type c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static type max(type a, type b) { return _mm_max_pd(a, b); }
+    static type min(type a, type b) { return _mm_min_pd(a, b); }
+    static type round(type a) { return _mm_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type ldexp(type x, type n) {
+        __m128i bits = _mm_castpd_si128(_mm_add_pd(n, _mm_set1_pd(0x1.8p52)));
+        bits = _mm_slli_epi64(_mm_add_epi64(bits, _mm_set1_epi64x(1023)), 52);
+        return _mm_mul_pd(x, _mm_castsi128_pd(bits));
+    }
+    static type frexp(type x, type& e) {
+        const __m128i bits = _mm_castpd_si128(x);
+        const __m128i k = _mm_srli_epi64(_mm_add_epi64(bits, _mm_set1_epi64x(0x00095f619980c433)), 52);
+        e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(k, _mm_set1_epi64x(0x4338000000000000))),
+                          _mm_set1_pd(0x1.8p52 + 1023));
+        return _mm_castsi128_pd(_mm_add_epi64(_mm_sub_epi64(bits, _mm_slli_epi64(k, 52)),
+                                                     _mm_set1_epi64x(0x3ff0000000000000)));
+    }
+    static type selectPositive(type cond, type v) { return _mm_and_pd(_mm_cmpgt_pd(cond, _mm_setzero_pd()), v); }
+    static double reduceAdd(type v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+};
+
+template<>
+struct Packet<float> {
+    using type = __m128;
+    static constexpr size_t size = 4;
+    static type zero() { return _mm_setzero_ps(); }
+    static type set1(float v) { return _mm_set1_ps(v); }
+    static type loadu(const float* p) { return _mm_loadu_ps(p); }
+    static void storeu(float* p, type v) { _mm_storeu_ps(p, v); }
+    static type loadBytes(const uint8_t* p) {
+        int32_t b;
+        std::memcpy(&b, p, 4);
+        return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(b)));
+    }
+    static type gather(const float* base, const int32_t* idx) {
+        return _mm_set_ps(base[idx[3]], base[idx[2]], base[idx[1]], base[idx[0]]);
+    }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_ps(a); }
+    static type fmadd(type a, type b, type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+    static type min(type a, type b) { return _mm_min_ps(a, b); }
+    static type round(type a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type ldexp(type x, type n) {
+        __m128i bits = _mm_castps_si128(_mm_add_ps(n, _mm_set1_ps(0x1.8p23f)));
+        bits = _mm_slli_epi32(_mm_add_epi32(bits, _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(x, _mm_castsi128_ps(bits));
+    }
+    static type frexp(type x, type& e) {
+        const __m128i bits = _mm_castps_si128(x);
+        const __m128i k = _mm_srli_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0x004afb0d)), 23);
+        e = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(k, _mm_set1_epi32(0x4b400000))),
+                          _mm_set1_ps(0x1.8p23f + 127));
+        return _mm_castsi128_ps(_mm_add_epi32(_mm_sub_epi32(bits, _mm_slli_epi32(k, 23)),
+                                                     _mm_set1_epi32(0x3f800000)));
+    }
+    static type selectPositive(type cond, type v) { return _mm_and_ps(_mm_cmpgt_ps(cond, _mm_setzero_ps()), v); }
+    static float reduceAdd(type v) {
+        __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+    }
+};
+
+#endif
+
+// Products of unsigned and signed bytes for the int8 kernels (quantized.hpp). Each 32-bit
+// lane of a vector holds four bytes; dot(acc, a, b) adds the four products of a's u8
+// bytes with b's s8 bytes to the lane's int32 in acc. Without VNNI this is maddubs,
+// which sums pairs into saturating int16, then madd against ones; the weights are kept
+// within 7 bits so that the pairs never saturate and every level gets the same integers.
+#if defined(__AVX512BW__)
+
+struct DotU8S8 {
+    using type = __m512i;
+    static constexpr size_t lanes = 16;
+    static type zero() { return _mm512_setzero_si512(); }
+    static type set1(uint32_t group) { return _mm512_set1_epi32(static_cast<int>(group)); }
+    static type loadu(const int8_t* p) { return _mm512_loadu_si512(p); }
+    static void storeu(int32_t* p, type v) { _mm512_storeu_si512(p, v); }
+    static type dot(type acc, type a, type b) {
+#if defined(__AVX512VNNI__)
+        return _mm512_dpbusd_epi32(acc, a, b);
+#else
+        return _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_maddubs_epi16(a, b), _mm512_set1_epi16(1)));
+#endif
+    }
+};
+
+#elif defined(__AVX2__)
+
+struct DotU8S8 {
+    using type = __m256i;
+    static constexpr size_t lanes = 8;
+    static type zero() { return _mm256_setzero_si256(); }
+    static type set1(uint32_t group) { return _mm256_set1_epi32(static_cast<int>(group)); }
+    static type loadu(const int8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void storeu(int32_t* p, type v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    static type dot(type acc, type a, type b) {
+        return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)));
+    }
+};
+
+#elif defined(__SSE4_2__)
+
+struct DotU8S8 {
+    using type = __m128i;
+    static constexpr size_t lanes = 4;
+    static type zero() { return _mm_setzero_si128(); }
+    static type set1(uint32_t group) { return _mm_set1_epi32(static_cast<int>(group)); }
+    static type loadu(const int8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void storeu(int32_t* p, type v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    static type dot(type acc, type a, type b) {
+        return _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(a, b), _mm_set1_epi16(1)));
+    }
+};
+
+#else
+
+struct DotU8S8 {
+    using type = int32_t;
+    static constexpr size_t lanes = 1;
+    static type zero() { return 0; }
+    static type set1(uint32_t group) { return static_cast<type>(group); }
+    static type loadu(const int8_t* p) {
+        type v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static void storeu(int32_t* p, type v) { *p = v; }
+    static type dot(type acc, type a, type b) {
+        uint8_t ua[4];
+        int8_t sb[4];
+        std::memcpy(ua, &a, 4);
+        std::memcpy(sb, &b, 4);
+        for (int i = 0; i < 4; ++i)
+            acc += ua[i] * sb[i];
+        return acc;
+    }
+};
+
+#endif
+
+// Elementwise e^x for float/double packets (Cephes-style: x = n ln2 + r, e^x = 2^n e^r
+// with a rational (double) or polynomial (float) approximation of e^r). Inputs are
+// clamped to the range where the result is a finite normal number (scaled as 2e^r * 2^(n-1)
+// so that n may reach the top exponent); one-lane packets use std::exp.
+template<typename T>
+typename Packet<T>::type exp(typename Packet<T>::type x) {
+    using P = Packet<T>;
+    if constexpr (P::size == 1) {
+        return std::exp(x);
+    } else if constexpr (sizeof(T) == 8) {
+        x = P::min(P::max(x, P::set1(-707.7)), P::set1(709.78));
+        const typename P::type n = P::round(P::mul(x, P::set1(1.4426950408889634)));
+        typename P::type r = P::fmadd(n, P::set1(-6.93145751953125e-1), x);
+        r = P::fmadd(n, P::set1(-1.42860682030941723212e-6), r);
+        const typename P::type rr = P::mul(r, r);
+        typename P::type p = P::fmadd(rr, P::set1(1.26177193074810590878e-4), P::set1(3.02994407707441961300e-2));
+        p = P::mul(r, P::fmadd(rr, p, P::set1(9.99999999999999999910e-1)));
+        typename P::type q = P::fmadd(rr, P::set1(3.00198505138664455042e-6), P::set1(2.52448340349684104739e-3));
+        q = P::fmadd(rr, q, P::set1(2.27265548208155028766e-1));
+        q = P::fmadd(rr, q, P::set1(2.00000000000000000009e0));
+        const typename P::type e = P::fmadd(P::set1(4.0), P::div(p, P::sub(q, p)), P::set1(2.0));
+        return P::ldexp(e, P::sub(n, P::set1(1.0)));
+    } else {
+        x = P::min(P::max(x, P::set1(-86.6f)), P::set1(88.72f));
+        const typename P::type n = P::round(P::mul(x, P::set1(1.44269504088896341f)));
+        typename P::type r = P::fmadd(n, P::set1(-0.693359375f), x);
+        r = P::fmadd(n, P::set1(2.12194440e-4f), r);
+        typename P::type p = P::fmadd(r, P::set1(1.9875691500e-4f), P::set1(1.3981999507e-3f));
+        p = P::fmadd(r, p, P::set1(8.3334519073e-3f));
+        p = P::fmadd(r, p, P::set1(4.1665795894e-2f));
+        p = P::fmadd(r, p, P::set1(1.6666665459e-1f));
+        p = P::fmadd(r, p, P::set1(5.0000001201e-1f));
+        const typename P::type e = P::add(P::fmadd(P::mul(r, r), p, r), P::set1(1.0f));
+        return P::ldexp(P::add(e, e), P::sub(n, P::set1(1.0f)));
+    }
+}
+
+// Elementwise natural log for float/double packets, for positive normal inputs (Cephes:
+// x = m 2^e with m in [sqrt(1/2), sqrt(2)), log x = e ln2 + log1p(m - 1) with a rational
+// (double) or polynomial (float) approximation of log1p); one-lane packets use std::log.
+template<typename T>
+typename Packet<T>::type log(typename Packet<T>::type x) {
+    using P = Packet<T>;
+    if constexpr (P::size == 1) {
+        return std::log(x);
+    } else if constexpr (sizeof(T) == 8) {
+        typename P::type e;
+        const typename P::type f = P::sub(P::frexp(x, e), P::set1(1.0));
+        const typename P::type ff = P::mul(f, f);
+        typename P::type p = P::fmadd(f, P::set1(1.01875663804580931796e-4), P::set1(4.97494994976747001425e-1));
+        p = P::fmadd(f, p, P::set1(4.70579119878881725854e0));
+        p = P::fmadd(f, p, P::set1(1.44989225341610930846e1));
+        p = P::fmadd(f, p, P::set1(1.79368678507819816313e1));
+        p = P::fmadd(f, p, P::set1(7.70838733755885391666e0));
+        typename P::type q = P::add(f, P::set1(1.12873587189167450590e1));
+        q = P::fmadd(f, q, P::set1(4.52279145837532221105e1));
+        q = P::fmadd(f, q, P::set1(8.29875266912776603211e1));
+        q = P::fmadd(f, q, P::set1(7.11544750618563894466e1));
+        q = P::fmadd(f, q, P::set1(2.31251620126765340583e1));
+        typename P::type y = P::mul(P::mul(f, ff), P::div(p, q));
+        y = P::fmadd(e, P::set1(-2.121944400546905827679e-4), y);
+        y = P::fmadd(ff, P::set1(-0.5), y);
+        return P::fmadd(e, P::set1(0.693359375), P::add(f, y));
+    } else {
+        typename P::type e;
+        const typename P::type f = P::sub(P::frexp(x, e), P::set1(1.0f));
+        const typename P::type ff = P::mul(f, f);
+        typename P::type p = P::fmadd(f, P::set1(7.0376836292e-2f), P::set1(-1.1514610310e-1f));
+        p = P::fmadd(f, p, P::set1(1.1676998740e-1f));
+        p = P::fmadd(f, p, P::set1(-1.2420140846e-1f));
+        p = P::fmadd(f, p, P::set1(1.4249322787e-1f));
+        p = P::fmadd(f, p, P::set1(-1.6668057665e-1f));
+        p = P::fmadd(f, p, P::set1(2.0000714765e-1f));
+        p = P::fmadd(f, p, P::set1(-2.4999993993e-1f));
+        p = P::fmadd(f, p, P::set1(3.3333331174e-1f));
+        typename P::type y = P::mul(P::mul(f, ff), p);
+        y = P::fmadd(e, P::set1(-2.12194440e-4f), y);
+        y = P::fmadd(ff, P::set1(-0.5f), y);
+        return P::fmadd(e, P::set1(0.693359375f), P::add(f, y));
+    }
+}
+
+} // namespace SIMD_ISA
+} // namespace simd
@@ -1,24 +1,115 @@
 #pragma once
 #include <Eigen/Dense>
+#include <cmath>
 #include <iostream>
 
+#include "backend.hpp"
+#include "dispatch.hpp"
+#include "simd.hpp"
+
+namespace softmax_detail {
+inline namespace SIMD_ISA {
+
+// Row-wise softmax of a column-major rows x cols matrix (column stride ld). Rows are
+// processed a packet at a time, so each column is one contiguous load; in == out is allowed.
+template<typename T>
+void forwardRows(const T* in, T* out, size_t rows, size_t cols, size_t ld) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    size_t i = 0;
+    for (; i + W <= rows; i += W) {
+        typename P::type m = P::loadu(in + i);
+        for (size_t j = 1; j < cols; ++j)
+            m = P::max(m, P::loadu(in + j * ld + i));
+        typename P::type s = P::zero();
+        for (size_t j = 0; j < cols; ++j) {
+            const typename P::type e = simd::exp<T>(P::sub(P::loadu(in + j * ld + i), m));
+            P::storeu(out + j * ld + i, e);
+            s = P::add(s, e);
+        }
+        for (size_t j = 0; j < cols; ++j)
+            P::storeu(out + j * ld + i, P::div(P::loadu(out + j * ld + i), s));
+    }
+    for (; i < rows; ++i) {
+        T m = in[i];
+        for (size_t j = 1; j < cols; ++j)
+            m = in[j * ld + i] > m ? in[j * ld + i] : m;
+        T s = T(0);
+        for (size_t j = 0; j < cols; ++j) {
+            out[j * ld + i] = std::exp(in[j * ld + i] - m);
+            s += out[j * ld + i];
+        }
+        for (size_t j = 0; j < cols; ++j)
+            out[j * ld + i] /= s;
+    }
+}
+
+// Fused softmax + cross-entropy over the rows of column-major logits z (column stride
+// ld) and labels y: grad = scale * (softmax(z) - y), and the return value is the summed
+// loss -sum y * log softmax(z), taken as sum(y) * logsumexp(z) - sum(y * z) so no log of
+// a probability is needed. Rows go a packet at a time; a row block's columns stay in L1
+// between the max, exp and gradient passes, so z, y and grad each stream through once.
+template<typename T>
+T crossEntropyRows(const T* z, const T* y, T* grad, size_t rows, size_t cols, size_t ld, T scale) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    const typename P::type vs = P::set1(scale);
+    typename P::type loss = P::zero();
+    size_t i = 0;
+    for (; i + W <= rows; i += W) {
+        typename P::type m = P::loadu(z + i);
+        for (size_t j = 1; j < cols; ++j)
+            m = P::max(m, P::loadu(z + j * ld + i));
+        typename P::type s = P::zero(), ySum = P::zero(), yz = P::zero();
+        for (size_t j = 0; j < cols; ++j) {
+            const typename P::type zj = P::loadu(z + j * ld + i), yj = P::loadu(y + j * ld + i);
+            const typename P::type e = simd::exp<T>(P::sub(zj, m));
+            P::storeu(grad + j * ld + i, e);
+            s = P::add(s, e);
+            ySum = P::add(ySum, yj);
+            yz = P::fmadd(yj, zj, yz);
+        }
+        for (size_t j = 0; j < cols; ++j) {
+            const typename P::type p = P::div(P::loadu(grad + j * ld + i), s);
+            P::storeu(grad + j * ld + i, P::mul(P::sub(p, P::loadu(y + j * ld + i)), vs));
+        }
+        const typename P::type lse = P::add(m, simd::log<T>(s));
+        loss = P::add(loss, P::sub(P::mul(ySum, lse), yz));
+    }
+    T total = P::reduceAdd(loss);
+    for (; i < rows; ++i) {
+        T m = z[i];
+        for (size_t j = 1; j < cols; ++j)
+            m = z[j * ld + i] > m ? z[j * ld + i] : m;
+        T s = T(0), ySum = T(0), yz = T(0);
+        for (size_t j = 0; j < cols; ++j) {
+            grad[j * ld + i] = std::exp(z[j * ld + i] - m);
+            s += grad[j * ld + i];
+            ySum += y[j * ld + i];
+            yz += y[j * ld + i] * z[j * ld + i];
+        }
+        for (size_t j = 0; j < cols; ++j)
+            grad[j * ld + i] = (grad[j * ld + i] / s - y[j * ld + i]) * scale;
+        total += ySum * (m + std::log(s)) - yz;
+    }
+    return total;
+}
+
+} // namespace SIMD_ISA
+} // namespace softmax_detail
+
+// Row-wise softmax of the logits, for inference; training goes through the fused
+// SoftmaxCrossEntropyLoss. forward returns a buffer reused by the next call.
+template<typename T = double>
 class Softmax {
 public:
-    Softmax() = default;
-    Eigen::MatrixXd forward(const Eigen::MatrixXd &input) {
-        cache_ = input;
-        Eigen::VectorXd rowMax = input.rowwise().maxCoeff();
-        Eigen::MatrixXd shifted = input.array().colwise() - rowMax.array();
-        Eigen::MatrixXd expTensor = shifted.array().exp();
-        Eigen::VectorXd rowSum = expTensor.rowwise().sum();
-        output_ = (expTensor.array().colwise() / rowSum.array()).matrix();
+    explicit Softmax(const Backend<T> &backend = defaultBackend<T>()) : backend_(&backend) {}
+    const MatrixX<T> &forward(const MatrixX<T> &input) {
+        output_.resize(input.rows(), input.cols());
+        backend_->softmaxRows(input.data(), output_.data(), input.rows(), input.cols(), input.rows());
         return output_;
     }
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &grad) {
-        Eigen::VectorXd sumWeighted = (grad.array() * output_.array()).rowwise().sum();
-        Eigen::MatrixXd sumMat = sumWeighted.replicate(1, grad.cols());
-        return output_.array() * (grad.array() - sumMat.array());
-    }
 private:
-    Eigen::MatrixXd cache_, output_;
+    const Backend<T> *backend_;
+    MatrixX<T> output_;
 };
@@ -0,0 +1,508 @@
+#pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "gemm.hpp"
+#include "matvec.hpp"
+#include "simd.hpp"
+
+// Sparse matrices for pruned weights. CsrMatrix is plain compressed sparse row storage;
+// BlockSparseMatrix keeps dense kBlockRows x BlockCols tiles so the inner loop is ordinary
+// packet FMAs instead of gathers, at the price of storing the zeros inside kept tiles.
+// Both convert from a dense matrix by magnitude threshold (entries with |a| <= threshold
+// are dropped) and provide y = A * x plus the batched form Y[v, :] = A * X[v, :] used by
+// matvecBatched(), parallelized over rows with OpenMP.
+//
+// CsrMatrix also carries sparse layer inputs, e.g. MNIST batches (~80% zero pixels): the
+// dispatched kernels below multiply a CSR batch by pre-packed weights and, from its
+// transpose (a column-major batch read row-major, one CSR row per input feature), form
+// the weight-gradient rows of the features present, touching only the nonzeros.
+
+// Non-owning CSR view, as passed to the dispatched kernels.
+template<typename T>
+struct SparseRows {
+    const size_t* rowPtr;
+    const int32_t* colIdx;
+    const T* values;
+    size_t rows, cols;
+};
+
+namespace sparse_detail {
+inline namespace SIMD_ISA {
+
+// C (X.rows x B.cols, column-major with leading dimension ldc) = X * B plus the epilogue,
+// for CSR X and pre-packed B with B.rows == X.cols. Each row of C is accumulated in registers, two
+// panels at a time, from one row of B per stored entry; a group of panels (~150 KB for
+// 785 rows of doubles) stays in L2 while all rows of X are walked. A bf16 copy of B is
+// widened to T one group at a time into a buffer that stays there instead.
+template<typename T, typename S>
+void sparseTimesPacked(const SparseRows<T>& X, const PackedPanels<S>& B, T* C, size_t ldc,
+                       const GemmEpilogue<T>& epilogue) {
+    constexpr size_t PW = kPackedPanelWidth;
+    constexpr size_t kPanels = 2;
+    const size_t panels = (B.cols + PW - 1) / PW;
+    const long groups = static_cast<long>((panels + kPanels - 1) / kPanels);
+    thread_local gemm_detail::PackBuffer<T> wideBuf;
+    #pragma omp parallel for schedule(static) if (X.rowPtr[X.rows] * B.cols >= gemm_detail::kParallelMinWork)
+    for (long g = 0; g < groups; ++g) {
+        const size_t p0 = static_cast<size_t>(g) * kPanels, np = std::min(kPanels, panels - p0);
+        const size_t j0 = p0 * PW, n = std::min(np * PW, B.cols - j0);
+        const T* w0;
+        size_t stride;
+        if constexpr (std::is_same_v<S, T>) {
+            w0 = B.data + p0 * B.panelStride;
+            stride = B.panelStride;
+        } else {
+            T* wide = wideBuf.get(np * B.rows * PW);
+            gemm_detail::widenPanels(B, p0, p0 + np, 0, B.rows, wide);
+            w0 = wide;
+            stride = B.rows * PW;
+        }
+        // A missing second panel repeats the first; its sums are discarded.
+        const T* w1 = np > 1 ? w0 + stride : w0;
+        for (size_t r = 0; r < X.rows; ++r) {
+            // Two accumulator sets over alternate entries hide the FMA latency.
+            T acc0[kPanels * PW] = {}, acc1[kPanels * PW] = {};
+            const size_t begin = X.rowPtr[r], end = X.rowPtr[r + 1];
+            size_t e = begin;
+            for (; e + 2 <= end; e += 2) {
+                const T v0 = X.values[e], v1 = X.values[e + 1];
+                const T* a0 = w0 + static_cast<size_t>(X.colIdx[e]) * PW;
+                const T* a1 = w0 + static_cast<size_t>(X.colIdx[e + 1]) * PW;
+                const T* b0 = w1 + static_cast<size_t>(X.colIdx[e]) * PW;
+                const T* b1 = w1 + static_cast<size_t>(X.colIdx[e + 1]) * PW;
+                for (size_t j = 0; j < PW; ++j) {
+                    acc0[j] += v0 * a0[j];
+                    acc0[PW + j] += v0 * b0[j];
+                    acc1[j] += v1 * a1[j];
+                    acc1[PW + j] += v1 * b1[j];
+                }
+            }
+            if (e < end) {
+                const T v = X.values[e];
+                const T* a = w0 + static_cast<size_t>(X.colIdx[e]) * PW;
+                const T* b = w1 + static_cast<size_t>(X.colIdx[e]) * PW;
+                for (size_t j = 0; j < PW; ++j) {
+                    acc0[j] += v * a[j];
+                    acc0[PW + j] += v * b[j];
+                }
+            }
+            for (size_t j = 0; j < n; ++j) {
+                const T c = acc0[j] + acc1[j] + (epilogue.bias ? epilogue.bias[j0 + j] : T(0));
+                C[(j0 + j) * ldc + r] = epilogue.relu && !(c > T(0)) ? T(0) : c;
+            }
+        }
+    }
+}
+
+// out[i, 0:n] = sum over the stored entries (c, v) of row rows[i] of X of v * G[c, 0:n],
+// for row-major G (row stride ldg) and out (row stride n): the listed rows of X * G. With
+// X the transposed input of a layer and G its output gradient these are the weight
+// gradient rows of the input features in rows. G is walked in column strips narrow
+// enough to stay in L1 while every listed row accumulates its strip in registers.
+template<typename T>
+void sparseRowsTimesDense(const SparseRows<T>& X, const int32_t* rows, size_t count, const T* G, size_t ldg,
+                          size_t n, T* out) {
+    using P = simd::Packet<T>;
+    constexpr size_t W = P::size;
+    constexpr size_t kRegs = 4;
+    constexpr size_t kStrip = kRegs * W;
+    const long strips = static_cast<long>((n + kStrip - 1) / kStrip);
+    #pragma omp parallel for schedule(static) if (X.rowPtr[X.rows] * n >= gemm_detail::kParallelMinWork)
+    for (long s = 0; s < strips; ++s) {
+        const size_t j0 = static_cast<size_t>(s) * kStrip;
+        for (size_t i = 0; i < count; ++i) {
+            const size_t begin = X.rowPtr[rows[i]], end = X.rowPtr[rows[i] + 1];
+            T* o = out + i * n + j0;
+            if (j0 + kStrip <= n) {
+                typename P::type acc[kRegs];
+                for (size_t q = 0; q < kRegs; ++q)
+                    acc[q] = P::zero();
+                for (size_t e = begin; e < end; ++e) {
+                    const typename P::type v = P::set1(X.values[e]);
+                    const T* g = G + static_cast<size_t>(X.colIdx[e]) * ldg + j0;
+                    for (size_t q = 0; q < kRegs; ++q)
+                        acc[q] = P::fmadd(v, P::loadu(g + q * W), acc[q]);
+                }
+                for (size_t q = 0; q < kRegs; ++q)
+                    P::storeu(o + q * W, acc[q]);
+            } else {
+                for (size_t j = 0; j < n - j0; ++j)
+                    o[j] = T(0);
+                for (size_t e = begin; e < end; ++e) {
+                    const T v = X.values[e];
+                    const T* g = G + static_cast<size_t>(X.colIdx[e]) * ldg + j0;
+                    for (size_t j = 0; j < n - j0; ++j)
+                        o[j] += v * g[j];
+                }
+            }
+        }
+    }
+}
+
+} // namespace SIMD_ISA
+
+inline constexpr size_t kParallelMinNonZeros = size_t(1) << 15;
+
+// Calls rowFn(r, scratch) for r in [0, rows), where scratch holds scratchSize elements
+// private to the calling thread. Dynamic scheduling evens out uneven row lengths.
+template<typename T, typename RowFn>
+void forRows(size_t rows, size_t nnz, size_t scratchSize, RowFn rowFn) {
+    const long n = static_cast<long>(rows);
+    #pragma omp parallel if (nnz >= kParallelMinNonZeros)
+    {
+        std::vector<T> scratch(scratchSize);
+        #pragma omp for schedule(dynamic, 16)
+        for (long r = 0; r < n; ++r)
+            rowFn(static_cast<size_t>(r), scratch.data());
+    }
+}
+
+// Copies nvec vectors of length cols (stride ldx) into a rows x nvec block, zero-padded
+// up to rows, so that one stored entry a(r, c) updates every vector with a single
+// contiguous axpy over row c.
+template<typename T>
+std::vector<T> transposeVectors(const T* X, size_t nvec, size_t ldx, size_t cols, size_t rows) {
+    std::vector<T> xt(rows * nvec, T(0));
+    for (size_t v = 0; v < nvec; ++v)
+        for (size_t c = 0; c < cols; ++c)
+            xt[c * nvec + v] = X[v * ldx + c];
+    return xt;
+}
+
+// acc[0:nvec] = sum over entries (c, a) of a * xt[c, 0:nvec], where entries(fn) calls
+// fn(c, a) for every stored entry of one row. Vectors are processed in register-sized
+// chunks so the accumulators never leave registers while the row is walked.
+template<typename T, typename Entries>
+void sparseRowTimesBlock(Entries entries, const T* xt, size_t nvec, T* acc) {
+    using P = simd::Packet<T>;
+    constexpr size_t kRegs = 4;
+    constexpr size_t kChunk = kRegs * P::size;
+    size_t v0 = 0;
+    for (; v0 + kChunk <= nvec; v0 += kChunk) {
+        typename P::type s[kRegs];
+        for (size_t q = 0; q < kRegs; ++q)
+            s[q] = P::zero();
+        entries([&](size_t c, T a) {
+            typename P::type av = P::set1(a);
+            const T* x = xt + c * nvec + v0;
+            for (size_t q = 0; q < kRegs; ++q)
+                s[q] = P::fmadd(av, P::loadu(x + q * P::size), s[q]);
+        });
+        for (size_t q = 0; q < kRegs; ++q)
+            P::storeu(acc + v0 + q * P::size, s[q]);
+    }
+    if (v0 < nvec) {
+        std::fill(acc + v0, acc + nvec, T(0));
+        entries([&](size_t c, T a) {
+            const T* x = xt + c * nvec;
+            for (size_t v = v0; v < nvec; ++v)
+                acc[v] += a * x[v];
+        });
+    }
+}
+
+} // namespace sparse_detail
+
+template<typename T>
+class CsrMatrix {
+public:
+    CsrMatrix() = default;
+    CsrMatrix(size_t rows, size_t cols) : rows_(rows), cols_(cols), rowPtr_(rows + 1, 0) {}
+
+    // Row-major dense input with row stride ld. Entries are counted first and then stored
+    // without branches (every value is written, the cursor only moves past kept ones), as
+    // zero patterns such as those of input pixels are too irregular to predict.
+    static CsrMatrix fromDense(const T* data, size_t rows, size_t cols, size_t ld, T threshold = T(0)) {
+        CsrMatrix m(rows, cols);
+        size_t nnz = 0;
+        for (size_t r = 0; r < rows; ++r)
+            for (size_t c = 0; c < cols; ++c)
+                nnz += std::abs(data[r * ld + c]) > threshold;
+        // One slot of slack for the store after the last kept entry.
+        m.colIdx_.resize(nnz + 1);
+        m.values_.resize(nnz + 1);
+        size_t k = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            const T* row = data + r * ld;
+            for (size_t c = 0; c < cols; ++c) {
+                m.colIdx_[k] = static_cast<int32_t>(c);
+                m.values_[k] = row[c];
+                k += std::abs(row[c]) > threshold;
+            }
+            m.rowPtr_[r + 1] = k;
+        }
+        m.colIdx_.resize(nnz);
+        m.values_.resize(nnz);
+        return m;
+    }
+    template<AllocatorPolicy Alloc>
+    static CsrMatrix fromDense(const Matrix<T, Alloc>& dense, T threshold = T(0)) {
+        return fromDense(dense.data(), dense.rows(), dense.cols(), dense.cols(), threshold);
+    }
+    template<typename Derived>
+    static CsrMatrix fromDense(const Eigen::MatrixBase<Derived>& dense, T threshold = T(0)) {
+        Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> rm = dense;
+        return fromDense(rm.data(), rm.rows(), rm.cols(), rm.cols(), threshold);
+    }
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t nonZeros() const { return values_.size(); }
+    double density() const { return rows_ && cols_ ? double(nonZeros()) / double(rows_ * cols_) : 0.0; }
+    SparseRows<T> view() const { return { rowPtr_.data(), colIdx_.data(), values_.data(), rows_, cols_ }; }
+
+    // The transpose, by a counting sort of the entries on their column.
+    CsrMatrix transposed() const {
+        CsrMatrix t(cols_, rows_);
+        t.colIdx_.resize(nonZeros());
+        t.values_.resize(nonZeros());
+        for (int32_t c : colIdx_)
+            ++t.rowPtr_[static_cast<size_t>(c) + 1];
+        for (size_t c = 0; c < cols_; ++c)
+            t.rowPtr_[c + 1] += t.rowPtr_[c];
+        std::vector<size_t> next(t.rowPtr_.begin(), t.rowPtr_.end() - 1);
+        for (size_t r = 0; r < rows_; ++r)
+            for (size_t k = rowPtr_[r]; k < rowPtr_[r + 1]; ++k) {
+                const size_t dst = next[static_cast<size_t>(colIdx_[k])]++;
+                t.colIdx_[dst] = static_cast<int32_t>(r);
+                t.values_[dst] = values_[k];
+            }
+        return t;
+    }
+
+    const std::vector<size_t>& rowPtr() const { return rowPtr_; }
+    const std::vector<int32_t>& colIdx() const { return colIdx_; }
+    const std::vector<T>& values() const { return values_; }
+
+    // y[r] = dot(row r, x) for a dense x of length cols().
+    void multiply(const T* x, T* y) const { multiplyBatched(x, 1, cols_, y, rows_); }
+
+    // Y[v * ldy + r] = dot(row r, X[v * ldx, ...]) for v < nvec.
+    void multiplyBatched(const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy) const {
+        const T* vals = values_.data();
+        const int32_t* idx = colIdx_.data();
+        if (nvec == 1) {
+            // Single vector: gather x at the column indices of each row.
+            using P = simd::Packet<T>;
+            constexpr size_t W = P::size;
+            sparse_detail::forRows<T>(rows_, nonZeros(), 0, [&](size_t r, T*) {
+                const size_t begin = rowPtr_[r], end = rowPtr_[r + 1];
+                typename P::type acc = P::zero();
+                size_t k = begin;
+                for (; k + W <= end; k += W)
+                    acc = P::fmadd(P::loadu(vals + k), P::gather(X, idx + k), acc);
+                T t = P::reduceAdd(acc);
+                for (; k < end; ++k)
+                    t += vals[k] * X[idx[k]];
+                Y[r] = t;
+            });
+            return;
+        }
+        // Several vectors: every nonzero is read once and applied to all of them.
+        const std::vector<T> xt = sparse_detail::transposeVectors(X, nvec, ldx, cols_, cols_);
+        sparse_detail::forRows<T>(rows_, nonZeros() * nvec, nvec, [&](size_t r, T* acc) {
+            auto entries = [&](auto fn) {
+                for (size_t k = rowPtr_[r]; k < rowPtr_[r + 1]; ++k)
+                    fn(size_t(idx[k]), vals[k]);
+            };
+            sparse_detail::sparseRowTimesBlock(entries, xt.data(), nvec, acc);
+            for (size_t v = 0; v < nvec; ++v)
+                Y[v * ldy + r] = acc[v];
+        });
+    }
+
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> toDense() const {
+        Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> d =
+            Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>::Zero(rows_, cols_);
+        for (size_t r = 0; r < rows_; ++r)
+            for (size_t k = rowPtr_[r]; k < rowPtr_[r + 1]; ++k)
+                d(r, colIdx_[k]) = values_[k];
+        return d;
+    }
+
+private:
+    size_t rows_ = 0, cols_ = 0;
+    std::vector<size_t> rowPtr_{ 0 };
+    std::vector<int32_t> colIdx_;
+    std::vector<T> values_;
+};
+
+// Block-sparse rows: tiles of kBlockRows x BlockCols stored densely (row-major inside the
+// tile). The default tile width is one SIMD packet.
+template<typename T, size_t BlockCols = simd::Packet<T>::size>
+class BlockSparseMatrix {
+public:
+    static constexpr size_t kBlockRows = 4;
+    static constexpr size_t kBlockCols = BlockCols;
+    static constexpr size_t kBlockSize = kBlockRows * kBlockCols;
+
+    BlockSparseMatrix() = default;
+
+    // Keeps every tile that contains at least one entry with |a| > threshold.
+    static BlockSparseMatrix fromDense(const T* data, size_t rows, size_t cols, size_t ld, T threshold = T(0)) {
+        BlockSparseMatrix m;
+        m.rows_ = rows;
+        m.cols_ = cols;
+        const size_t blockRows = (rows + kBlockRows - 1) / kBlockRows;
+        const size_t blockCols = (cols + kBlockCols - 1) / kBlockCols;
+        m.blockRowPtr_.assign(blockRows + 1, 0);
+        for (size_t br = 0; br < blockRows; ++br) {
+            for (size_t bc = 0; bc < blockCols; ++bc) {
+                bool keep = false;
+                for (size_t i = 0; i < kBlockRows && !keep; ++i)
+                    for (size_t j = 0; j < kBlockCols && !keep; ++j) {
+                        size_t r = br * kBlockRows + i, c = bc * kBlockCols + j;
+                        keep = r < rows && c < cols && std::abs(data[r * ld + c]) > threshold;
+                    }
+                if (!keep)
+                    continue;
+                m.blockCol_.push_back(static_cast<int32_t>(bc * kBlockCols));
+                for (size_t i = 0; i < kBlockRows; ++i)
+                    for (size_t j = 0; j < kBlockCols; ++j) {
+                        size_t r = br * kBlockRows + i, c = bc * kBlockCols + j;
+                        T v = r < rows && c < cols ? data[r * ld + c] : T(0);
+                        m.values_.push_back(std::abs(v) > threshold ? v : T(0));
+                    }
+            }
+            m.blockRowPtr_[br + 1] = m.blockCol_.size();
+        }
+        return m;
+    }
+    template<AllocatorPolicy Alloc>
+    static BlockSparseMatrix fromDense(const Matrix<T, Alloc>& dense, T threshold = T(0)) {
+        return fromDense(dense.data(), dense.rows(), dense.cols(), dense.cols(), threshold);
+    }
+    template<typename Derived>
+    static BlockSparseMatrix fromDense(const Eigen::MatrixBase<Derived>& dense, T threshold = T(0)) {
+        Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> rm = dense;
+        return fromDense(rm.data(), rm.rows(), rm.cols(), rm.cols(), threshold);
+    }
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t numBlocks() const { return blockCol_.size(); }
+    // Stored entries, including the zeros inside kept tiles.
+    size_t storedElements() const { return values_.size(); }
+
+    void multiply(const T* x, T* y) const { multiplyBatched(x, 1, cols_, y, rows_); }
+
+    // Y[v * ldy + r] = dot(row r, X[v * ldx, ...]) for v < nvec.
+    void multiplyBatched(const T* X, size_t nvec, size_t ldx, T* Y, size_t ldy) const {
+        const size_t blockRows = blockRowPtr_.size() - 1;
+        const size_t paddedCols = (cols_ + kBlockCols - 1) / kBlockCols * kBlockCols;
+        if (nvec == 1) {
+            // Tiles overhanging the last column read a zero-padded copy of x.
+            std::vector<T> xPad;
+            if (paddedCols != cols_) {
+                xPad.assign(paddedCols, T(0));
+                std::copy_n(X, cols_, xPad.data());
+                X = xPad.data();
+            }
+            sparse_detail::forRows<T>(blockRows, storedElements(), 0, [&](size_t br, T*) {
+                T out[kBlockRows];
+                tileRowDot(br, X, out);
+                for (size_t i = 0; i < kBlockRows && br * kBlockRows + i < rows_; ++i)
+                    Y[br * kBlockRows + i] = out[i];
+            });
+            return;
+        }
+        // Several vectors: every tile row is applied to all vectors at once; the zeros
+        // stored inside kept tiles are skipped.
+        const std::vector<T> xt = sparse_detail::transposeVectors(X, nvec, ldx, cols_, paddedCols);
+        sparse_detail::forRows<T>(blockRows, storedElements() * nvec, kBlockRows * nvec, [&](size_t br, T* acc) {
+            for (size_t i = 0; i < kBlockRows; ++i) {
+                auto entries = [&](auto fn) {
+                    for (size_t b = blockRowPtr_[br]; b < blockRowPtr_[br + 1]; ++b) {
+                        const T* tileRow = values_.data() + b * kBlockSize + i * kBlockCols;
+                        for (size_t j = 0; j < kBlockCols; ++j)
+                            if (tileRow[j] != T(0))
+                                fn(size_t(blockCol_[b]) + j, tileRow[j]);
+                    }
+                };
+                sparse_detail::sparseRowTimesBlock(entries, xt.data(), nvec, acc + i * nvec);
+            }
+            for (size_t i = 0; i < kBlockRows && br * kBlockRows + i < rows_; ++i)
+                for (size_t v = 0; v < nvec; ++v)
+                    Y[v * ldy + br * kBlockRows + i] = acc[i * nvec + v];
+        });
+    }
+
+private:
+    // out[i] = dot(row br * kBlockRows + i, x) over the kept tiles of block row br;
+    // x must be readable up to the padded column count.
+    void tileRowDot(size_t br, const T* x, T* out) const {
+        using P = simd::Packet<T>;
+        const size_t begin = blockRowPtr_[br], end = blockRowPtr_[br + 1];
+        if constexpr (kBlockCols % P::size == 0) {
+            typename P::type acc[kBlockRows];
+            for (size_t i = 0; i < kBlockRows; ++i)
+                acc[i] = P::zero();
+            for (size_t b = begin; b < end; ++b) {
+                const T* tile = values_.data() + b * kBlockSize;
+                for (size_t j = 0; j < kBlockCols; j += P::size) {
+                    typename P::type xv = P::loadu(x + blockCol_[b] + j);
+                    for (size_t i = 0; i < kBlockRows; ++i)
+                        acc[i] = P::fmadd(P::loadu(tile + i * kBlockCols + j), xv, acc[i]);
+                }
+            }
+            for (size_t i = 0; i < kBlockRows; ++i)
+                out[i] = P::reduceAdd(acc[i]);
+        } else {
+            std::fill_n(out, kBlockRows, T(0));
+            for (size_t b = begin; b < end; ++b) {
+                const T* tile = values_.data() + b * kBlockSize;
+                for (size_t i = 0; i < kBlockRows; ++i)
+                    for (size_t j = 0; j < kBlockCols; ++j)
+                        out[i] += tile[i * kBlockCols + j] * x[blockCol_[b] + j];
+            }
+        }
+    }
+
+    size_t rows_ = 0, cols_ = 0;
+    std::vector<size_t> blockRowPtr_{ 0 };
+    std::vector<int32_t> blockCol_;
+    std::vector<T> values_;
+};
+
+//-----------------------------------------
+// Sparse MatVec / MatMat
+//-----------------------------------------
+template<typename SparseMatrixType, typename ComponentType, AllocatorPolicy Alloc>
+Vector<ComponentType, Alloc> spmv(const SparseMatrixType& mat, const Vector<ComponentType, Alloc>& vec)
+{
+    if (mat.cols() != vec.size())
+        throw std::invalid_argument("spmv: dimension mismatch");
+    Vector<ComponentType, Alloc> out(mat.rows());
+    mat.multiply(vec.data(), out.data());
+    return out;
+}
+
+// Same convention as matvecBatched(): row b of the result is mat * (row b of vecs).
+template<typename SparseMatrixType, typename ComponentType, AllocatorPolicy Alloc>
+Matrix<ComponentType, Alloc> spmvBatched(const SparseMatrixType& mat, const Matrix<ComponentType, Alloc>& vecs)
+{
+    if (mat.cols() != vecs.cols())
+        throw std::invalid_argument("spmvBatched: dimension mismatch");
+    Matrix<ComponentType, Alloc> out(vecs.rows(), mat.rows());
+    mat.multiplyBatched(vecs.data(), vecs.rows(), vecs.cols(), out.data(), mat.rows());
+    return out;
+}
+
+// Dense input times sparse weights, input (batch x in) * W (in x out), with W supplied
+// transposed as an out x in sparse matrix: the layout a FullyConnected forward pass needs.
+template<typename T, typename SparseMatrixType>
+Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+spmm(const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& input, const SparseMatrixType& weightsT)
+{
+    if (static_cast<size_t>(input.cols()) != weightsT.cols())
+        throw std::invalid_argument("spmm: dimension mismatch");
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> out(input.rows(), weightsT.rows());
+    weightsT.multiplyBatched(input.data(), input.rows(), input.cols(), out.data(), weightsT.rows());
+    return out;
+}
@@ -1,13 +1,17 @@
 #pragma once
 #include <Eigen/Dense>
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 #include <type_traits>
 
+#include "allocator.hpp"
+
 // Compute flat (linear) index from multi-dimensional indices.
 inline constexpr size_t linearIndex(const std::vector<size_t>& shape, const std::vector<size_t>& idx) {
     assert(shape.size() == idx.size());
@@ -40,55 +44,168 @@ T stringToScalar(const std::string &str) {
     return val;
 }
 
+// Built-in arithmetic types plus Eigen's 16-bit floating-point formats.
 template<typename T>
-concept Arithmetic = std::is_arithmetic_v<T>;
+concept Arithmetic = std::is_arithmetic_v<T> || std::is_same_v<T, Eigen::bfloat16> || std::is_same_v<T, Eigen::half>;
 
-template<Arithmetic T>
+template<Arithmetic T, AllocatorPolicy Alloc = HeapAllocator>
 class Tensor {
 public:
-    Tensor() : shape_{}, data_(1) { data_(0) = T(0); }
-    Tensor(const std::vector<size_t>& s) : shape_(s), data_(::numElements(s)) { data_.setZero(); }
-    Tensor(const std::vector<size_t>& s, const T &fillVal) : shape_(s), data_(::numElements(s)) { data_.setConstant(fillVal); }
+    using value_type = T;
+    using allocator_type = Alloc;
+    using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using MatrixMap = Eigen::Map<RowMajorMatrix>;
+    using ConstMatrixMap = Eigen::Map<const RowMajorMatrix>;
+    using VectorMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1>>;
+    using ConstVectorMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
 
-    Tensor(const Tensor&) = default;
-    Tensor(Tensor&& other) noexcept
-        : shape_(std::move(other.shape_)), data_(std::move(other.data_)) {
-        other.shape_.clear();
-        other.data_.resize(1);
-        other.data_(0) = T(0);
+    Tensor() : shape_{} { allocate(1); data_[0] = T(0); }
+    Tensor(const std::vector<size_t>& s) : shape_(s) { allocate(::numElements(s)); std::fill_n(data_, size_, T(0)); }
+    Tensor(const std::vector<size_t>& s, const T &fillVal) : shape_(s) { allocate(::numElements(s)); std::fill_n(data_, size_, fillVal); }
+
+    // Copies always own their storage, also when other is a view or adopted buffer.
+    Tensor(const Tensor& other) : shape_(other.shape_) {
+        allocate(other.size_);
+        std::copy_n(other.data_, size_, data_);
+    }
+    Tensor(Tensor&& other) noexcept : shape_(std::move(other.shape_)) { steal(other); }
+    Tensor& operator=(const Tensor& other) {
+        if (this != &other) {
+            if (size_ != other.size_ || borrowed_) {
+                release();
+                allocate(other.size_);
+            }
+            shape_ = other.shape_;
+            std::copy_n(other.data_, size_, data_);
+        }
+        return *this;
     }
-    Tensor& operator=(const Tensor&) = default;
     Tensor& operator=(Tensor&& other) noexcept {
         if (this != &other) {
+            release();
             shape_ = std::move(other.shape_);
-            data_  = std::move(other.data_);
-            other.shape_.clear();
-            other.data_.resize(1);
-            other.data_(0) = T(0);
+            steal(other);
         }
         return *this;
     }
+    ~Tensor() { release(); }
+
+    // Non-owning view of existing storage; the caller keeps data alive and unmoved.
+    static Tensor view(T* data, const std::vector<size_t>& shape) {
+        Tensor t;
+        t.shape_ = shape;
+        t.size_ = ::numElements(shape);
+        t.data_ = data;
+        t.borrowed_ = true;
+        return t;
+    }
+
+    // Takes over the buffer of a dynamically sized Eigen matrix without copying. Column
+    // vectors become rank-1 tensors, everything else rank-2. Row-major matrices and
+    // matrices with a single row or column map directly; a column-major matrix with
+    // several rows and columns has to be transposed into fresh row-major storage.
+    template<int Rows, int Cols, int Options>
+    static Tensor adopt(Eigen::Matrix<T, Rows, Cols, Options>&& m) {
+        static_assert(Rows == Eigen::Dynamic || Cols == Eigen::Dynamic,
+                      "adopt() needs heap storage; copy fixed-size matrices instead");
+        using Mat = Eigen::Matrix<T, Rows, Cols, Options>;
+        std::vector<size_t> shape = Cols == 1
+            ? std::vector<size_t>{ static_cast<size_t>(m.rows()) }
+            : std::vector<size_t>{ static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols()) };
+        if (!Mat::IsRowMajor && m.rows() > 1 && m.cols() > 1) {
+            Tensor t(shape);
+            t.asMatrix() = m;
+            return t;
+        }
+        auto holder = std::make_shared<Mat>(std::move(m));
+        Tensor t;
+        t.shape_ = std::move(shape);
+        t.size_ = static_cast<size_t>(holder->size());
+        t.data_ = holder->data();
+        t.owner_ = std::move(holder);
+        return t;
+    }
 
     size_t rank() const { return shape_.size(); }
     std::vector<size_t> shape() const { return shape_; }
+    size_t dim(size_t i) const { return shape_[i]; }
     size_t numElements() const { return ::numElements(shape_); }
 
-    const T& operator()(const std::vector<size_t>& idx) const { return data_.coeff(linearIndex(shape_, idx)); }
-    T& operator()(const std::vector<size_t>& idx) { return data_.coeffRef(linearIndex(shape_, idx)); }
+    // Reinterprets the row-major storage with a new shape of the same element count.
+    void reshape(const std::vector<size_t>& s) {
+        if (::numElements(s) != numElements())
+            throw std::invalid_argument("reshape: element count mismatch");
+        shape_ = s;
+    }
+
+    const T& operator()(const std::vector<size_t>& idx) const { return data_[linearIndex(shape_, idx)]; }
+    T& operator()(const std::vector<size_t>& idx) { return data_[linearIndex(shape_, idx)]; }
+
+    // Contiguous row-major storage; allocator-owned buffers are aligned to kTensorAlignment.
+    const T* data() const { return data_; }
+    T* data() { return data_; }
+    bool isView() const { return borrowed_; }
+
+    // Zero-copy Eigen views. asMatrix() shows rank-2 tensors as rows x cols (row-major)
+    // and rank-1 tensors as a column; asVector() shows the flat storage.
+    MatrixMap asMatrix() { return MatrixMap(data_, matRows(), matCols()); }
+    ConstMatrixMap asMatrix() const { return ConstMatrixMap(data_, matRows(), matCols()); }
+    VectorMap asVector() { return VectorMap(data_, static_cast<Eigen::Index>(numElements())); }
+    ConstVectorMap asVector() const { return ConstVectorMap(data_, static_cast<Eigen::Index>(numElements())); }
 
 private:
+    Eigen::Index matRows() const {
+        if (rank() > 2)
+            throw std::runtime_error("asMatrix: rank > 2");
+        return rank() == 0 ? 1 : static_cast<Eigen::Index>(shape_[0]);
+    }
+    Eigen::Index matCols() const { return rank() == 2 ? static_cast<Eigen::Index>(shape_[1]) : 1; }
+
+    // Tensors with at most one element (scalars, default-constructed and moved-from
+    // objects) live in inline_ and never touch the allocator.
+    void allocate(size_t n) {
+        size_ = n;
+        data_ = n <= 1 ? &inline_ : static_cast<T*>(Alloc::allocate(n * sizeof(T)));
+    }
+    bool allocatorOwned() const { return data_ != &inline_ && !borrowed_ && !owner_; }
+    void release() noexcept {
+        if (allocatorOwned())
+            Alloc::deallocate(data_, size_ * sizeof(T));
+        owner_.reset();
+        borrowed_ = false;
+        data_ = &inline_;
+        size_ = 1;
+    }
+    void steal(Tensor& other) noexcept {
+        size_ = other.size_;
+        if (other.data_ == &other.inline_) {
+            inline_ = other.inline_;
+            data_ = &inline_;
+        } else {
+            data_ = other.data_;
+        }
+        borrowed_ = other.borrowed_;
+        owner_ = std::move(other.owner_);
+        other.shape_.clear();
+        other.data_ = &other.inline_;
+        other.size_ = 1;
+        other.inline_ = T(0);
+        other.borrowed_ = false;
+    }
+
     std::vector<size_t> shape_;
-    Eigen::Matrix<T, Eigen::Dynamic, 1> data_;
+    T* data_ = &inline_;
+    size_t size_ = 1;
+    T inline_ = T(0);
+    bool borrowed_ = false;
+    std::shared_ptr<void> owner_;  // keeps an adopted Eigen matrix alive
 };
 
-template<Arithmetic T>
-bool operator==(const Tensor<T>& a, const Tensor<T>& b) {
+template<Arithmetic T, AllocatorPolicy A, AllocatorPolicy B>
+bool operator==(const Tensor<T, A>& a, const Tensor<T, B>& b) {
     if (a.shape() != b.shape())
         return false;
-    for (size_t i = 0; i < a.numElements(); ++i)
-        if (a({ i }) != b({ i }))
-            return false;
-    return true;
+    return std::equal(a.data(), a.data() + a.numElements(), b.data());
 }
 
 template<Arithmetic T>
@@ -116,47 +233,31 @@ Tensor<T> readTensorFromFile(const std::string &filename) {
             throw std::runtime_error("Shape line missing");
         shp[i] = stringToScalar<size_t>(line);
     }
-    Tensor<T> tensor(shp);
-    if (rnk == 0)
-        tensor({}) = readScalarLine<T>(file);
-    else if (rnk == 1)
-        for (size_t i = 0; i < tensor.numElements(); ++i)
-            tensor({ i }) = readScalarLine<T>(file);
-    else if (rnk == 2) {
-        size_t rows = shp[0], cols = shp[1];
-        for (size_t r = 0; r < rows; ++r)
-            for (size_t c = 0; c < cols; ++c)
-                tensor({ r, c }) = readScalarLine<T>(file);
-    } else {
+    if (rnk > 2)
         throw std::runtime_error("Rank >2 not supported");
-    }
+    Tensor<T> tensor(shp);
+    // Storage is row-major, so the flat order matches the file's element order.
+    T* data = tensor.data();
+    for (size_t i = 0; i < tensor.numElements(); ++i)
+        data[i] = readScalarLine<T>(file);
     file.close();
     return tensor;
 }
 
-template<Arithmetic T>
-void writeTensorToFile(const Tensor<T> &tensor, const std::string &filename) {
+template<Arithmetic T, AllocatorPolicy Alloc>
+void writeTensorToFile(const Tensor<T, Alloc> &tensor, const std::string &filename) {
     std::ofstream file(filename);
     if (!file.is_open()) {
         std::cerr << "Could not open file for writing: " << filename << "\n";
         std::exit(1);
     }
+    if (tensor.rank() > 2)
+        throw std::runtime_error("Rank >2 not supported");
     file << tensor.rank() << "\n";
     for (auto d : tensor.shape())
         file << d << "\n";
-    size_t rnk = tensor.rank();
-    if (rnk == 0)
-        file << tensor({}) << "\n";
-    else if (rnk == 1)
-        for (size_t i = 0; i < tensor.numElements(); ++i)
-            file << tensor({ i }) << "\n";
-    else if (rnk == 2) {
-        size_t rows = tensor.shape()[0], cols = tensor.shape()[1];
-        for (size_t r = 0; r < rows; ++r)
-            for (size_t c = 0; c < cols; ++c)
-                file << tensor({ r, c }) << "\n";
-    } else {
-        throw std::runtime_error("Rank >2 not supported");
-    }
+    const T* data = tensor.data();
+    for (size_t i = 0; i < tensor.numElements(); ++i)
+        file << data[i] << "\n";
     file.close();
 }
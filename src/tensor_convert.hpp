@@ -0,0 +1,275 @@
+#pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__F16C__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "dispatch.hpp"
+#include "simd.hpp"
+#include "tensor.hpp"
+
+// Bulk element-type conversion between double, float, Eigen::bfloat16, Eigen::half and
+// affine-quantized int8 (real = scale * (q - zeroPoint)). Every kernel is a flat loop over
+// contiguous storage: the float <-> bfloat16 and double <-> float loops are written so the
+// compiler vectorizes them (rounding to bfloat16 is dispatched per ISA level), float <->
+// half and the int8 paths use F16C/AVX2 intrinsics when available. Large buffers are split
+// across OpenMP threads.
+
+namespace convert_detail {
+
+inline constexpr size_t kParallelThreshold = size_t(1) << 16;
+inline constexpr size_t kChunk = size_t(1) << 14;
+
+// Runs kernel(begin, count) over [0, n), in parallel chunks for large n.
+template<typename Kernel>
+void forChunks(size_t n, Kernel kernel) {
+    if (n < kParallelThreshold) {
+        kernel(size_t(0), n);
+        return;
+    }
+    const long numChunks = static_cast<long>((n + kChunk - 1) / kChunk);
+    #pragma omp parallel for schedule(static)
+    for (long c = 0; c < numChunks; ++c) {
+        size_t begin = static_cast<size_t>(c) * kChunk;
+        kernel(begin, std::min(kChunk, n - begin));
+    }
+}
+
+inline void bf16ToFloat(const Eigen::bfloat16* src, float* dst, size_t n) {
+    const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = std::bit_cast<float>(uint32_t(in[i]) << 16);
+}
+
+inline void floatToHalf(const float* src, Eigen::half* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < n; ++i)
+        dst[i] = Eigen::half(src[i]);
+}
+
+inline void halfToFloat(const Eigen::half* src, float* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+#endif
+    for (; i < n; ++i)
+        dst[i] = static_cast<float>(src[i]);
+}
+
+inline void quantizeFloat(const float* src, int8_t* dst, size_t n, float scale, int zeroPoint) {
+    const float inv = 1.0f / scale;
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 vinv = _mm256_set1_ps(inv);
+    const __m256 vlo = _mm256_set1_ps(-32768.0f), vhi = _mm256_set1_ps(32767.0f);
+    const __m256i vzp = _mm256_set1_epi32(zeroPoint);
+    const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for (; i + 32 <= n; i += 32) {
+        __m256i q[4];
+        for (int k = 0; k < 4; ++k) {
+            // Clamp before conversion so out-of-range values saturate instead of wrapping.
+            __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8 * k), vinv), vlo), vhi);
+            q[k] = _mm256_add_epi32(_mm256_cvtps_epi32(x), vzp);
+        }
+        // Saturating packs interleave 128-bit lanes; the permute restores element order.
+        __m256i p16a = _mm256_packs_epi32(q[0], q[1]);
+        __m256i p16b = _mm256_packs_epi32(q[2], q[3]);
+        __m256i p8 = _mm256_packs_epi16(p16a, p16b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permutevar8x32_epi32(p8, perm));
+    }
+#endif
+    for (; i < n; ++i) {
+        float x = std::clamp(src[i] * inv, -32768.0f, 32767.0f);
+        int q = static_cast<int>(std::nearbyint(x)) + zeroPoint;
+        dst[i] = static_cast<int8_t>(std::clamp(q, -128, 127));
+    }
+}
+
+inline void dequantizeFloat(const int8_t* src, float* dst, size_t n, float scale, int zeroPoint) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256i vzp = _mm256_set1_epi32(zeroPoint);
+    for (; i + 8 <= n; i += 8) {
+        __m256i q = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(q, vzp)), vscale));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = scale * static_cast<float>(int(src[i]) - zeroPoint);
+}
+
+template<typename T>
+inline constexpr bool isFloat16 = std::is_same_v<T, Eigen::bfloat16> || std::is_same_v<T, Eigen::half>;
+
+// One chunk of From -> To; 16-bit formats and double go through a float staging buffer.
+template<typename From, typename To>
+void convertChunk(const From* src, To* dst, size_t n) {
+    if constexpr (std::is_same_v<From, To>) {
+        std::copy_n(src, n, dst);
+    } else if constexpr (dispatch::hasKernels<From> && std::is_same_v<To, Eigen::bfloat16>) {
+        dispatch::kernels<From>().realToBf16(src, dst, n);
+    } else if constexpr (std::is_same_v<From, Eigen::bfloat16> && std::is_same_v<To, float>) {
+        bf16ToFloat(src, dst, n);
+    } else if constexpr (std::is_same_v<From, float> && std::is_same_v<To, Eigen::half>) {
+        floatToHalf(src, dst, n);
+    } else if constexpr (std::is_same_v<From, Eigen::half> && std::is_same_v<To, float>) {
+        halfToFloat(src, dst, n);
+    } else if constexpr (isFloat16<From> || isFloat16<To>) {
+        constexpr size_t kStage = 256;
+        float stage[kStage];
+        for (size_t i = 0; i < n; i += kStage) {
+            size_t m = std::min(kStage, n - i);
+            convertChunk<From, float>(src + i, stage, m);
+            convertChunk<float, To>(stage, dst + i, m);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = static_cast<To>(src[i]);
+    }
+}
+
+inline namespace SIMD_ISA {
+
+// dst = src / 255 for 8-bit pixel intensities, bit-identical to the scalar division.
+template<typename T>
+void pixelsToReal(const uint8_t* src, T* dst, size_t n) {
+    using P = simd::Packet<T>;
+    const typename P::type scale = P::set1(T(255));
+    size_t i = 0;
+    for (; i + P::size <= n; i += P::size)
+        P::storeu(dst + i, P::div(P::loadBytes(src + i), scale));
+    for (; i < n; ++i)
+        dst[i] = static_cast<T>(src[i]) / T(255);
+}
+
+// dst = src rounded to bf16 (double via float): round to nearest even, NaNs keep a quiet
+// NaN payload. Written for the compiler to vectorize at each ISA level.
+template<typename T>
+void realToBf16(const T* src, Eigen::bfloat16* dst, size_t n) {
+    uint16_t* out = reinterpret_cast<uint16_t*>(dst);
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t bits = std::bit_cast<uint32_t>(static_cast<float>(src[i]));
+        const uint32_t rounded = bits + 0x7FFFu + ((bits >> 16) & 1u);
+        const bool isNan = (bits & 0x7FFFFFFFu) > 0x7F800000u;
+        out[i] = isNan ? uint16_t((bits >> 16) | 0x40u) : uint16_t(rounded >> 16);
+    }
+}
+
+} // namespace SIMD_ISA
+} // namespace convert_detail
+
+// Converts n elements from src to dst.
+template<typename From, typename To>
+void convertBuffer(const From* src, To* dst, size_t n) {
+    convert_detail::forChunks(n, [=](size_t b, size_t m) { convert_detail::convertChunk(src + b, dst + b, m); });
+}
+
+// Maps n 8-bit pixels to [0, 1] (value / 255); float and double use the dispatched kernel,
+// the 16-bit formats round its float result.
+template<typename To>
+void convertPixels(const uint8_t* src, To* dst, size_t n) {
+    if constexpr (dispatch::hasKernels<To>) {
+        dispatch::kernels<To>().pixelsToReal(src, dst, n);
+    } else if constexpr (convert_detail::isFloat16<To>) {
+        constexpr size_t kStage = 256;
+        float stage[kStage];
+        for (size_t i = 0; i < n; i += kStage) {
+            const size_t m = std::min(kStage, n - i);
+            dispatch::kernels<float>().pixelsToReal(src + i, stage, m);
+            convert_detail::convertChunk(stage, dst + i, m);
+        }
+    } else {
+        convert_detail::pixelsToReal(src, dst, n);
+    }
+}
+
+template<typename To, Arithmetic From, AllocatorPolicy A>
+Tensor<To> convertTensor(const Tensor<From, A>& src) {
+    Tensor<To> out(src.shape());
+    convertBuffer(src.data(), out.data(), src.numElements());
+    return out;
+}
+
+// Affine int8 quantization parameters: real = scale * (q - zeroPoint).
+struct QuantParams {
+    float scale = 1.0f;
+    int zeroPoint = 0;
+};
+
+// Parameters covering [minVal, maxVal] (widened to include 0 so that zero is exact).
+inline QuantParams chooseQuantParams(double minVal, double maxVal, bool symmetric = false) {
+    minVal = std::min(minVal, 0.0);
+    maxVal = std::max(maxVal, 0.0);
+    QuantParams p;
+    if (symmetric) {
+        double absMax = std::max(-minVal, maxVal);
+        p.scale = absMax > 0 ? static_cast<float>(absMax / 127.0) : 1.0f;
+        p.zeroPoint = 0;
+    } else {
+        double range = maxVal - minVal;
+        p.scale = range > 0 ? static_cast<float>(range / 255.0) : 1.0f;
+        p.zeroPoint = std::clamp(static_cast<int>(std::lround(-128.0 - minVal / p.scale)), -128, 127);
+    }
+    return p;
+}
+
+template<typename From>
+void quantizeBuffer(const From* src, int8_t* dst, size_t n, const QuantParams& p) {
+    convert_detail::forChunks(n, [=](size_t b, size_t m) {
+        if constexpr (std::is_same_v<From, float>) {
+            convert_detail::quantizeFloat(src + b, dst + b, m, p.scale, p.zeroPoint);
+        } else {
+            constexpr size_t kStage = 256;
+            float stage[kStage];
+            for (size_t i = 0; i < m; i += kStage) {
+                size_t k = std::min(kStage, m - i);
+                convert_detail::convertChunk(src + b + i, stage, k);
+                convert_detail::quantizeFloat(stage, dst + b + i, k, p.scale, p.zeroPoint);
+            }
+        }
+    });
+}
+
+template<typename To>
+void dequantizeBuffer(const int8_t* src, To* dst, size_t n, const QuantParams& p) {
+    convert_detail::forChunks(n, [=](size_t b, size_t m) {
+        if constexpr (std::is_same_v<To, float>) {
+            convert_detail::dequantizeFloat(src + b, dst + b, m, p.scale, p.zeroPoint);
+        } else {
+            constexpr size_t kStage = 256;
+            float stage[kStage];
+            for (size_t i = 0; i < m; i += kStage) {
+                size_t k = std::min(kStage, m - i);
+                convert_detail::dequantizeFloat(src + b + i, stage, k, p.scale, p.zeroPoint);
+                convert_detail::convertChunk(stage, dst + b + i, k);
+            }
+        }
+    });
+}
+
+template<Arithmetic From, AllocatorPolicy A>
+Tensor<int8_t> quantizeTensor(const Tensor<From, A>& src, const QuantParams& p) {
+    Tensor<int8_t> out(src.shape());
+    quantizeBuffer(src.data(), out.data(), src.numElements(), p);
+    return out;
+}
+
+template<Arithmetic To, AllocatorPolicy A>
+Tensor<To> dequantizeTensor(const Tensor<int8_t, A>& src, const QuantParams& p) {
+    Tensor<To> out(src.shape());
+    dequantizeBuffer(src.data(), out.data(), src.numElements(), p);
+    return out;
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "tensor.hpp"
+
+// Reductions over Tensor storage. Flat reductions map the contiguous buffer as an Eigen
+// vector (so they vectorize) and split it into chunks across OpenMP threads once the
+// tensor is large enough to amortize the fork.
+
+namespace tensor_detail {
+
+inline constexpr size_t kParallelThreshold = size_t(1) << 16;
+inline constexpr size_t kChunk = size_t(1) << 14;
+
+template<typename T>
+using ConstVecMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
+
+// Type that sum, the norms and maxAbsDiff accumulate in and return: integers widen to 64 bits
+// and bf16/half to double, so an int8 tensor does not wrap and a bf16 one keeps its small
+// terms. float and double accumulate in themselves.
+template<typename T>
+using Accumulator = std::conditional_t<std::is_floating_point_v<T>, T,
+    std::conditional_t<std::is_unsigned_v<T>, uint64_t,
+    std::conditional_t<std::is_integral_v<T>, int64_t, double>>>;
+
+// Applies chunkOp(ptrOffset, length) -> R over [0, n) and folds the partial results with
+// combine. Runs in parallel for large n.
+template<typename R, typename ChunkOp, typename Combine>
+R chunkedReduce(size_t n, R init, ChunkOp chunkOp, Combine combine) {
+    if (n < kParallelThreshold)
+        return n == 0 ? init : combine(init, chunkOp(size_t(0), n));
+    const long numChunks = static_cast<long>((n + kChunk - 1) / kChunk);
+    std::vector<R> partial(numChunks);
+    #pragma omp parallel for schedule(static)
+    for (long c = 0; c < numChunks; ++c) {
+        size_t begin = static_cast<size_t>(c) * kChunk;
+        partial[c] = chunkOp(begin, std::min(kChunk, n - begin));
+    }
+    R result = init;
+    for (const R& p : partial)
+        result = combine(result, p);
+    return result;
+}
+
+// Splits shape around axis into (outer, extent, inner) so that element
+// (o, k, i) lives at o * extent * inner + k * inner + i.
+inline void splitAxis(const std::vector<size_t>& shape, size_t axis,
+                      size_t& outer, size_t& extent, size_t& inner) {
+    if (axis >= shape.size())
+        throw std::out_of_range("Reduction axis out of range");
+    outer = 1;
+    inner = 1;
+    for (size_t d = 0; d < axis; ++d) outer *= shape[d];
+    for (size_t d = axis + 1; d < shape.size(); ++d) inner *= shape[d];
+    extent = shape[axis];
+}
+
+inline std::vector<size_t> reducedShape(std::vector<size_t> shape, size_t axis) {
+    shape.erase(shape.begin() + static_cast<std::ptrdiff_t>(axis));
+    return shape;
+}
+
+// Reduces along axis: for every (o, i) the extent values are folded into out[o * inner + i]
+// via rowOp over a contiguous slice when inner == 1, else via colOp(outSlice, inSlice).
+template<typename T, typename A, typename U, typename RowOp, typename ColOp>
+Tensor<U> reduceAxis(const Tensor<T, A>& t, size_t axis, RowOp rowOp, ColOp colOp) {
+    size_t outer, extent, inner;
+    splitAxis(t.shape(), axis, outer, extent, inner);
+    if (extent == 0)
+        throw std::invalid_argument("Cannot reduce over an empty axis");
+    Tensor<U> out(reducedShape(t.shape(), axis));
+    const T* src = t.data();
+    U* dst = out.data();
+    const long outerL = static_cast<long>(outer);
+    const bool parallel = t.numElements() >= kParallelThreshold;
+    if (inner == 1) {
+        #pragma omp parallel for schedule(static) if (parallel)
+        for (long o = 0; o < outerL; ++o)
+            dst[o] = rowOp(ConstVecMap<T>(src + o * extent, static_cast<Eigen::Index>(extent)));
+    } else {
+        #pragma omp parallel for schedule(static) if (parallel)
+        for (long o = 0; o < outerL; ++o)
+            colOp(dst + o * inner, src + o * extent * inner, extent, inner);
+    }
+    return out;
+}
+
+} // namespace tensor_detail
+
+template<Arithmetic T, AllocatorPolicy A>
+tensor_detail::Accumulator<T> sum(const Tensor<T, A>& t) {
+    using R = tensor_detail::Accumulator<T>;
+    const T* p = t.data();
+    return tensor_detail::chunkedReduce<R>(t.numElements(), R(0),
+        [p](size_t b, size_t n) { return tensor_detail::ConstVecMap<T>(p + b, n).template cast<R>().sum(); },
+        [](R x, R y) { return x + y; });
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+T minValue(const Tensor<T, A>& t) {
+    const T* p = t.data();
+    return tensor_detail::chunkedReduce<T>(t.numElements(), std::numeric_limits<T>::max(),
+        [p](size_t b, size_t n) { return tensor_detail::ConstVecMap<T>(p + b, n).minCoeff(); },
+        [](T x, T y) { return std::min(x, y); });
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+T maxValue(const Tensor<T, A>& t) {
+    const T* p = t.data();
+    return tensor_detail::chunkedReduce<T>(t.numElements(), std::numeric_limits<T>::lowest(),
+        [p](size_t b, size_t n) { return tensor_detail::ConstVecMap<T>(p + b, n).maxCoeff(); },
+        [](T x, T y) { return std::max(x, y); });
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+tensor_detail::Accumulator<T> norm1(const Tensor<T, A>& t) {
+    using R = tensor_detail::Accumulator<T>;
+    if constexpr (std::is_unsigned_v<T>) {
+        return sum(t);
+    } else {
+        const T* p = t.data();
+        return tensor_detail::chunkedReduce<R>(t.numElements(), R(0),
+            [p](size_t b, size_t n) {
+                return tensor_detail::ConstVecMap<T>(p + b, n).template cast<R>().cwiseAbs().sum();
+            },
+            [](R x, R y) { return x + y; });
+    }
+}
+
+// The square root is taken in double; integer tensors get it truncated.
+template<Arithmetic T, AllocatorPolicy A>
+tensor_detail::Accumulator<T> norm2(const Tensor<T, A>& t) {
+    using R = tensor_detail::Accumulator<T>;
+    const T* p = t.data();
+    const R sq = tensor_detail::chunkedReduce<R>(t.numElements(), R(0),
+        [p](size_t b, size_t n) { return tensor_detail::ConstVecMap<T>(p + b, n).template cast<R>().squaredNorm(); },
+        [](R x, R y) { return x + y; });
+    return static_cast<R>(std::sqrt(static_cast<double>(sq)));
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+tensor_detail::Accumulator<T> normInf(const Tensor<T, A>& t) {
+    using R = tensor_detail::Accumulator<T>;
+    if constexpr (std::is_unsigned_v<T>) {
+        return t.numElements() == 0 ? R(0) : static_cast<R>(maxValue(t));
+    } else {
+        const T* p = t.data();
+        return tensor_detail::chunkedReduce<R>(t.numElements(), R(0),
+            [p](size_t b, size_t n) {
+                return tensor_detail::ConstVecMap<T>(p + b, n).template cast<R>().cwiseAbs().maxCoeff();
+            },
+            [](R x, R y) { return std::max(x, y); });
+    }
+}
+
+// Sum along axis in the accumulator type; the result has rank() - 1.
+template<Arithmetic T, AllocatorPolicy A>
+Tensor<tensor_detail::Accumulator<T>> sum(const Tensor<T, A>& t, size_t axis) {
+    using R = tensor_detail::Accumulator<T>;
+    return tensor_detail::reduceAxis<T, A, R>(t, axis,
+        [](const auto& row) { return row.template cast<R>().sum(); },
+        [](R* out, const T* in, size_t extent, size_t inner) {
+            for (size_t i = 0; i < inner; ++i)
+                out[i] = static_cast<R>(in[i]);
+            for (size_t k = 1; k < extent; ++k)
+                for (size_t i = 0; i < inner; ++i)
+                    out[i] += static_cast<R>(in[k * inner + i]);
+        });
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+Tensor<T> minValue(const Tensor<T, A>& t, size_t axis) {
+    return tensor_detail::reduceAxis<T, A, T>(t, axis,
+        [](const auto& row) { return row.minCoeff(); },
+        [](T* out, const T* in, size_t extent, size_t inner) {
+            std::copy_n(in, inner, out);
+            for (size_t k = 1; k < extent; ++k)
+                for (size_t i = 0; i < inner; ++i)
+                    out[i] = std::min(out[i], in[k * inner + i]);
+        });
+}
+
+template<Arithmetic T, AllocatorPolicy A>
+Tensor<T> maxValue(const Tensor<T, A>& t, size_t axis) {
+    return tensor_detail::reduceAxis<T, A, T>(t, axis,
+        [](const auto& row) { return row.maxCoeff(); },
+        [](T* out, const T* in, size_t extent, size_t inner) {
+            std::copy_n(in, inner, out);
+            for (size_t k = 1; k < extent; ++k)
+                for (size_t i = 0; i < inner; ++i)
+                    out[i] = std::max(out[i], in[k * inner + i]);
+        });
+}
+
+// Index of the first maximum along axis, e.g. argmax(predictions, 1) gives the class per row.
+template<Arithmetic T, AllocatorPolicy A>
+Tensor<size_t> argmax(const Tensor<T, A>& t, size_t axis) {
+    return tensor_detail::reduceAxis<T, A, size_t>(t, axis,
+        [](const auto& row) {
+            Eigen::Index idx;
+            row.maxCoeff(&idx);
+            return static_cast<size_t>(idx);
+        },
+        [](size_t* out, const T* in, size_t extent, size_t inner) {
+            std::vector<T> best(in, in + inner);
+            std::fill_n(out, inner, size_t(0));
+            for (size_t k = 1; k < extent; ++k)
+                for (size_t i = 0; i < inner; ++i)
+                    if (in[k * inner + i] > best[i]) {
+                        best[i] = in[k * inner + i];
+                        out[i] = k;
+                    }
+        });
+}
+
+// Largest elementwise |a - b|; shapes must match. Taken as max(a, b) - min(a, b) in the
+// accumulator type so unsigned and narrow signed inputs neither wrap nor overflow.
+template<Arithmetic T, AllocatorPolicy A, AllocatorPolicy B>
+tensor_detail::Accumulator<T> maxAbsDiff(const Tensor<T, A>& a, const Tensor<T, B>& b) {
+    using R = tensor_detail::Accumulator<T>;
+    if (a.shape() != b.shape())
+        throw std::invalid_argument("maxAbsDiff: shape mismatch");
+    const T* pa = a.data();
+    const T* pb = b.data();
+    return tensor_detail::chunkedReduce<R>(a.numElements(), R(0),
+        [pa, pb](size_t o, size_t n) {
+            auto x = tensor_detail::ConstVecMap<T>(pa + o, n).template cast<R>();
+            auto y = tensor_detail::ConstVecMap<T>(pb + o, n).template cast<R>();
+            return (x.cwiseMax(y) - x.cwiseMin(y)).maxCoeff();
+        },
+        [](R x, R y) { return std::max(x, y); });
+}
+
+// True if shapes match and |a - b| <= atol + rtol * |b| holds elementwise (numpy.allclose).
+template<Arithmetic T, AllocatorPolicy A, AllocatorPolicy B>
+bool allClose(const Tensor<T, A>& a, const Tensor<T, B>& b, double rtol = 1e-5, double atol = 1e-8) {
+    if (a.shape() != b.shape())
+        return false;
+    const T* pa = a.data();
+    const T* pb = b.data();
+    // int rather than bool: the per-chunk results are written concurrently.
+    return tensor_detail::chunkedReduce<int>(a.numElements(), 1,
+        [pa, pb, rtol, atol](size_t o, size_t n) {
+            auto x = tensor_detail::ConstVecMap<T>(pa + o, n).template cast<double>().array();
+            auto y = tensor_detail::ConstVecMap<T>(pb + o, n).template cast<double>().array();
+            return int(((x - y).abs() <= atol + rtol * y.abs()).all());
+        },
+        [](int x, int y) { return x & y; }) != 0;
+}
@@ -1,26 +1,253 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
+#include "dispatch.hpp"
+#include "gemm_tuning.hpp"
 #include "neuralnetwork.hpp"
+#include "quantized.hpp"
+
+namespace {
+
+struct Config {
+    double lr;
+    int epochs, batch, hidden;
+    std::string trainData, trainLabels, testData, testLabels, logPath, backend, optimizer, network;
+};
+
+struct RunResult {
+    const char *precision;
+    double trainSeconds, accuracy;
+    std::vector<int> predictions;
+    double inferenceSeconds = 0.0;
+};
+
+// Training images sampled (evenly spaced) to calibrate the int8 activation scale.
+constexpr size_t kCalibrationImages = 1024;
+
+// trained, if set, sees the network after its test.
+template<typename T, typename S = T>
+RunResult run(const Config &c, const char *precision, const std::string &logPath,
+              const std::function<void(const NeuralNetwork<T, S> &)> &trained = {}) {
+    NeuralNetwork<T, S> nn(c.lr, c.epochs, c.batch, c.hidden, c.trainData, c.trainLabels, c.testData, c.testLabels,
+                        logPath, c.backend, c.optimizer, c.network);
+    std::cout << "Starting training with:\n"
+              << " Learning rate: " << c.lr << "\n Epochs: " << c.epochs
+              << "\n Batch size: " << c.batch << "\n Hidden size: " << c.hidden
+              << "\n Precision: " << precision
+              << "\n Backend: " << nn.backendName()
+              << "\n Optimizer: " << nn.optimizerName()
+              << "\n Network: " << nn.networkName()
+              << "\n Kernels: " << dispatch::isaName(dispatch::activeIsa())
+              << "\n GEMM profile: " << tuning::defaultProfilePath() << " (" << tuning::activeProfile().size()
+              << " tuned shapes)\n";
+    RunResult result{ precision, nn.train(), 0.0, {} };
+    std::cout << "Training complete. Running test phase...\n";
+    result.accuracy = nn.test();
+    result.predictions = nn.predictions();
+    result.inferenceSeconds = nn.inferenceSeconds();
+    std::cout << "Test completed. Predictions logged to: " << logPath << "\n";
+    if (trained)
+        trained(nn);
+    return result;
+}
+
+// The trained fp64 network quantized to int8 (quantized.hpp) and tested on the raw test
+// pixels; the predictions are logged in the same format as the network's own.
+RunResult runInt8(const Config &c, const NeuralNetwork<double> &nn, WeightScales scales, const std::string &logPath) {
+    const RawImages train = MNISTDataLoader<>::readRawImages(c.trainData);
+    const size_t count = std::min(train.count, kCalibrationImages), stride = count ? train.count / count : 1;
+    std::vector<uint8_t> sample(count * train.size);
+    for (size_t s = 0; s < count; ++s)
+        std::copy_n(train.pixels.data() + s * stride * train.size, train.size, sample.data() + s * train.size);
+    std::vector<int32_t> features = nn.inputFeatures();
+    if (features.empty()) {
+        features.resize(nn.inputSize());
+        std::iota(features.begin(), features.end(), 0);
+    }
+    const QuantizedNetwork quantized(nn.layerWeights(0), nn.layerWeights(1), features, nn.inputSize(),
+                                     sample.data(), count, scales);
+
+    const RawImages test = MNISTDataLoader<>::readRawImages(c.testData);
+    const std::vector<uint8_t> labels = MNISTDataLoader<>::readRawLabels(c.testLabels);
+    if (test.size != nn.inputSize() || labels.size() < test.count)
+        throw std::runtime_error("int8: test set does not match the network");
+    std::cout << "int8 inference: " << (scales == WeightScales::PerChannel ? "per-channel" : "per-tensor")
+              << " weight scales, hidden scale " << quantized.hiddenScale() << " calibrated on " << count
+              << " training images\n";
+    const auto start = std::chrono::steady_clock::now();
+    RunResult result{ "int8", 0.0, 0.0, quantized.predict(test.pixels.data(), test.count) };
+    result.inferenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream buffer;
+    size_t correct = 0;
+    for (size_t i = 0; i < test.count; ++i) {
+        if (i % static_cast<size_t>(c.batch) == 0)
+            buffer << "Current batch: " << i / c.batch << "\n";
+        buffer << " - image " << i << ": Prediction=" << result.predictions[i] << ". Label=" << int(labels[i])
+               << "\n";
+        correct += result.predictions[i] == labels[i];
+    }
+    result.accuracy = test.count ? 100.0 * correct / test.count : 0.0;
+    std::ofstream logFile(logPath);
+    if (!logFile.is_open())
+        throw std::runtime_error("Cannot open log file: " + logPath);
+    logFile << buffer.str();
+    std::cout << "int8 test accuracy: " << result.accuracy << "%. Predictions logged to: " << logPath << "\n";
+    return result;
+}
+
+size_t samePredictions(const RunResult &a, const RunResult &b) {
+    size_t same = 0;
+    for (size_t i = 0; i < a.predictions.size() && i < b.predictions.size(); ++i)
+        same += a.predictions[i] == b.predictions[i];
+    return same;
+}
+
+// The lower precisions against the fp64 reference: all start from the same weights and
+// see the same batches in the same order.
+void printComparison(const RunResult &ref, const std::vector<RunResult> &others) {
+    std::printf("Precision comparison:\n  %-9s %12s %14s\n", "precision", "train [s]", "accuracy [%]");
+    std::printf("  %-9s %12.3f %14.2f\n", ref.precision, ref.trainSeconds, ref.accuracy);
+    for (const RunResult &r : others)
+        std::printf("  %-9s %12.3f %14.2f\n", r.precision, r.trainSeconds, r.accuracy);
+    for (const RunResult &r : others) {
+        std::printf("  %s vs %s: %.2fx training speed, accuracy %+.2f points, same prediction for %zu of %zu test "
+                    "images\n",
+                    r.precision, ref.precision, ref.trainSeconds / r.trainSeconds, r.accuracy - ref.accuracy,
+                    samePredictions(ref, r), ref.predictions.size());
+    }
+}
+
+// Accuracy delta of the int8 network against the fp64 one it was quantized from.
+void printQuantization(const RunResult &ref, const RunResult &q) {
+    std::printf("Quantization report:\n  %-9s %14s %14s\n", "precision", "inference [s]", "accuracy [%]");
+    for (const RunResult *r : { &ref, &q })
+        std::printf("  %-9s %14.4f %14.2f\n", r->precision, r->inferenceSeconds, r->accuracy);
+    std::printf("  %s vs %s: %.2fx inference speed, accuracy %+.2f points, same prediction for %zu of %zu test "
+                "images\n",
+                q.precision, ref.precision, ref.inferenceSeconds / q.inferenceSeconds, q.accuracy - ref.accuracy,
+                samePredictions(ref, q), ref.predictions.size());
+}
+
+} // namespace
 
 int main(int argc, char **argv) {
-    if (argc != 10) {
+    bool autotune = false;
+    std::string backend = "optimized", optimizer = "sgd", precision = "fp64", int8, network = "runtime";
+    for (int i = 10; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--autotune") {
+            autotune = true;
+        } else if (arg.rfind("--backend=", 0) == 0) {
+            backend = arg.substr(10);
+        } else if (arg.rfind("--optimizer=", 0) == 0) {
+            optimizer = arg.substr(12);
+        } else if (arg.rfind("--precision=", 0) == 0) {
+            precision = arg.substr(12);
+        } else if (arg.rfind("--network=", 0) == 0) {
+            network = arg.substr(10);
+        } else if (arg.rfind("--int8=", 0) == 0) {
+            int8 = arg.substr(7);
+        } else {
+            std::cerr << "Unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+    if (argc < 10) {
         std::cerr << "Usage: " << argv[0]
                   << " <learningRate> <numEpochs> <batchSize> <hiddenLayerSize>"
-                     " <trainDataPath> <trainLabelsPath> <testDataPath> <testLabelsPath> <predictionLogFilePath>\n";
+                     " <trainDataPath> <trainLabelsPath> <testDataPath> <testLabelsPath> <predictionLogFilePath>"
+                     " [--autotune] [--backend=naive|eigen|optimized]"
+                     " [--optimizer=sgd|momentum|nesterov|adam|adamw] [--precision=fp64|fp32|bf16|compare]"
+                     " [--int8=per-channel|per-tensor] [--network=runtime|static]\n"
+                  << "  --autotune  benchmark GEMM blockings for this batch and hidden size, save them to the"
+                     " host profile and use them\n"
+                  << "  --backend   implementation of the layer primitives (default: optimized)\n"
+                  << "  --optimizer update rule (default: sgd); momentum and nesterov use momentum 0.9, adamw"
+                     " weight decay 0.01\n"
+                  << "  --precision scalar type of the network (default: fp64); bf16 stores the data and the"
+                     " forward weights in bfloat16 and computes in fp32; compare trains all three, logs the fp32"
+                     " and bf16 predictions to <predictionLogFilePath>.fp32 and .bf16 and reports the"
+                     " differences\n"
+                  << "  --int8      also quantize the trained fp64 network to int8 weights (one scale per"
+                     " output or per layer) and u8 activations, calibrated on training images, log its"
+                     " predictions to <predictionLogFilePath>.int8 and report the accuracy delta\n"
+                  << "  --network   runtime-sized layers (default) or the compiled 784-500-10 topology; static"
+                     " falls back to runtime for other hidden sizes and for bf16\n";
         return 1;
     }
-    double lr = std::stod(argv[1]);
-    int epochs = std::stoi(argv[2]), batch = std::stoi(argv[3]), hidden = std::stoi(argv[4]);
-    std::string trainData = argv[5], trainLabels = argv[6],
-                testData = argv[7], testLabels = argv[8], logPath = argv[9];
+    Config config{ std::stod(argv[1]), std::stoi(argv[2]), std::stoi(argv[3]), std::stoi(argv[4]), argv[5],
+                   argv[6], argv[7], argv[8], argv[9], backend, optimizer, network };
 
-    NeuralNetwork nn(lr, epochs, batch, hidden, trainData, trainLabels, testData, testLabels, logPath);
-    std::cout << "Starting training with:\n"
-              << " Learning rate: " << lr << "\n Epochs: " << epochs
-              << "\n Batch size: " << batch << "\n Hidden size: " << hidden << "\n";
-    nn.train();
-    std::cout << "Training complete. Running test phase...\n";
-    nn.test();
-    std::cout << "Test completed. Predictions logged to: " << logPath << "\n";
+    if (precision != "fp64" && precision != "fp32" && precision != "bf16" && precision != "compare") {
+        std::cerr << "Unknown precision: " << precision << " (expected fp64, fp32, bf16 or compare)\n";
+        return 1;
+    }
+    if (!int8.empty() && int8 != "per-channel" && int8 != "per-tensor") {
+        std::cerr << "Unknown int8 weight scales: " << int8 << " (expected per-channel or per-tensor)\n";
+        return 1;
+    }
+    if (!int8.empty() && precision != "fp64" && precision != "compare") {
+        std::cerr << "--int8 quantizes the fp64 network; use it with --precision=fp64 or compare\n";
+        return 1;
+    }
+    if (network != "runtime" && network != "static") {
+        std::cerr << "Unknown network: " << network << " (expected runtime or static)\n";
+        return 1;
+    }
+    try {
+        makeBackend<double>(backend);
+        makeOptimizer(optimizer, config.lr);
+    } catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (autotune) {
+        std::cout << "Autotuning GEMM blocking (" << dispatch::isaName(dispatch::activeIsa()) << "):\n";
+        tuning::GemmProfile profile = tuning::activeProfile();
+        if (precision == "fp64" || precision == "compare")
+            profile.merge(tuning::tuneLayerGemms(config.batch, 784, config.hidden, 10, std::cout, sizeof(double)));
+        if (precision != "fp64")
+            profile.merge(tuning::tuneLayerGemms(config.batch, 784, config.hidden, 10, std::cout, sizeof(float)));
+        profile.save(tuning::defaultProfilePath(), dispatch::activeIsa());
+        tuning::setActiveProfile(std::move(profile));
+    }
+
+    RunResult quantized{ "int8", 0.0, 0.0, {} };
+    std::function<void(const NeuralNetwork<double> &)> quantize;
+    if (!int8.empty()) {
+        const WeightScales scales = int8 == "per-channel" ? WeightScales::PerChannel : WeightScales::PerTensor;
+        quantize = [&, scales](const NeuralNetwork<double> &nn) {
+            quantized = runInt8(config, nn, scales, config.logPath + ".int8");
+        };
+    }
+
+    if (precision == "fp64") {
+        const RunResult ref = run<double>(config, "fp64", config.logPath, quantize);
+        if (quantize)
+            printQuantization(ref, quantized);
+    } else if (precision == "fp32") {
+        run<float>(config, "fp32", config.logPath);
+    } else if (precision == "bf16") {
+        run<float, Eigen::bfloat16>(config, "bf16", config.logPath);
+    } else {
+        const RunResult ref = run<double>(config, "fp64", config.logPath, quantize);
+        std::vector<RunResult> others;
+        others.push_back(run<float>(config, "fp32", config.logPath + ".fp32"));
+        others.push_back(run<float, Eigen::bfloat16>(config, "bf16", config.logPath + ".bf16"));
+        printComparison(ref, others);
+        if (quantize)
+            printQuantization(ref, quantized);
+    }
     return 0;
 }
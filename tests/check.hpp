@@ -0,0 +1,36 @@
+#pragma once
+#include <cmath>
+#include <iostream>
+
+// Minimal checks for the unit tests in this directory: a failed CHECK is reported with
+// its location and the test carries on; main returns testResult(), nonzero after any
+// failure, which is what ctest looks at.
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n";     \
+            ++testFailures();                                                              \
+        }                                                                                  \
+    } while (0)
+
+// |a - b| <= tol, with both values printed on failure.
+#define CHECK_NEAR(a, b, tol)                                                              \
+    do {                                                                                   \
+        const double a_ = static_cast<double>(a), b_ = static_cast<double>(b);             \
+        if (!(std::abs(a_ - b_) <= static_cast<double>(tol))) {                            \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_NEAR(" #a ", " #b ") failed: " \
+                      << a_ << " vs " << b_ << "\n";                                       \
+            ++testFailures();                                                              \
+        }                                                                                  \
+    } while (0)
+
+inline int testResult() {
+    if (testFailures() != 0)
+        std::cerr << testFailures() << " check(s) failed\n";
+    return testFailures() != 0 ? 1 : 0;
+}
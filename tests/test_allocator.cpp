@@ -0,0 +1,102 @@
+// Allocator policies: alignment, arena rewind and scope lifetime, pool size-class reuse.
+#include <cstdint>
+
+#include "check.hpp"
+#include "tensor.hpp"
+
+namespace {
+
+bool aligned(const void* p) {
+    return reinterpret_cast<std::uintptr_t>(p) % kTensorAlignment == 0;
+}
+
+void testAlignment() {
+    // A single element lives inline in the tensor, so start at two.
+    for (size_t n : { 2, 3, 17, 1000 }) {
+        CHECK(aligned(Tensor<double>({ n }).data()));
+        CHECK(aligned(Tensor<float, ArenaAllocator>({ n }).data()));
+        CHECK(aligned(Tensor<int8_t, PoolAllocator>({ n }).data()));
+    }
+    Arena arena(1024);
+    for (size_t bytes : { 1, 63, 64, 65, 5000 })
+        CHECK(aligned(arena.allocate(bytes)));
+}
+
+void testArena() {
+    Arena arena(1024);
+    std::byte* a = static_cast<std::byte*>(arena.allocate(100));
+    std::byte* b = static_cast<std::byte*>(arena.allocate(100));
+    CHECK(b == a + alignUp(100));
+
+    // Rewinding to a mark hands the same storage out again.
+    const Arena::Mark m = arena.mark();
+    void* c = arena.allocate(200);
+    arena.rewind(m);
+    CHECK(arena.allocate(200) == c);
+
+    // A request larger than a chunk gets a chunk of its own; reset() reuses the first one.
+    void* big = arena.allocate(10000);
+    CHECK(big != nullptr && aligned(big));
+    arena.reset();
+    CHECK(arena.allocate(100) == a);
+}
+
+void testArenaScope() {
+    void* inner = nullptr;
+    {
+        ArenaScope scope;
+        Tensor<double, ArenaAllocator> t({ 32, 32 }, 1.0);
+        inner = t.data();
+        CHECK(t.data()[32 * 32 - 1] == 1.0);
+    }
+    // The scope rewound the thread's arena: the next step gets the same buffer.
+    {
+        ArenaScope scope;
+        Tensor<double, ArenaAllocator> t({ 32, 32 });
+        CHECK(t.data() == inner);
+    }
+    // Nested scopes rewind to their own mark only.
+    ArenaScope outer;
+    Tensor<float, ArenaAllocator> kept({ 10 }, 2.0f);
+    void* scratch = nullptr;
+    {
+        ArenaScope scope;
+        scratch = Tensor<float, ArenaAllocator>({ 10 }).data();
+    }
+    Tensor<float, ArenaAllocator> next({ 10 });
+    CHECK(next.data() == scratch);
+    CHECK(kept.data()[9] == 2.0f);
+}
+
+void testPool() {
+    // Sizes in the same power-of-two class share freed blocks.
+    void* p = PoolAllocator::allocate(100);
+    PoolAllocator::deallocate(p, 100);
+    CHECK(PoolAllocator::allocate(128) == p);
+    PoolAllocator::deallocate(p, 128);
+
+    // Another class does not take it.
+    void* q = PoolAllocator::allocate(129);
+    CHECK(q != p);
+    PoolAllocator::deallocate(q, 129);
+
+    // A tensor freed in one iteration is recycled by the next.
+    const void* first = nullptr;
+    for (int step = 0; step < 3; ++step) {
+        Tensor<double, PoolAllocator> t({ 50, 50 });
+        if (step == 0)
+            first = t.data();
+        else
+            CHECK(t.data() == first);
+    }
+}
+
+} // namespace
+
+int main() {
+    testAlignment();
+    testArena();
+    testArenaScope();
+    testPool();
+    return testResult();
+}
@@ -0,0 +1,84 @@
+// matvec, matvecBatched and matvecTransposed against Eigen, over row counts that are not
+// a multiple of the 4-row tiles and small batch sizes.
+#include <Eigen/Dense>
+#include <random>
+
+#include "check.hpp"
+#include "matvec.hpp"
+
+namespace {
+
+template<typename T>
+using RowMajor = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+template<typename T>
+Matrix<T> randomMatrix(size_t rows, size_t cols, std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    Matrix<T> m(rows, cols);
+    for (size_t i = 0; i < rows * cols; ++i)
+        m.data()[i] = static_cast<T>(dist(rng));
+    return m;
+}
+
+template<typename T>
+Eigen::Map<const RowMajor<T>> asEigen(const Matrix<T>& m) {
+    return { m.data(), static_cast<Eigen::Index>(m.rows()), static_cast<Eigen::Index>(m.cols()) };
+}
+
+// Relative to the magnitude of a length-k dot product of values in [-1, 1].
+template<typename T>
+double tolerance(size_t k) {
+    return (std::is_same_v<T, float> ? 1e-5 : 1e-12) * static_cast<double>(k + 1);
+}
+
+template<typename T>
+void testShape(size_t rows, size_t cols, std::mt19937& rng) {
+    const Matrix<T> A = randomMatrix<T>(rows, cols, rng);
+    const auto a = asEigen(A);
+
+    const Matrix<T> x = randomMatrix<T>(1, cols, rng);
+    Vector<T> v(cols);
+    std::copy_n(x.data(), cols, v.data());
+    const Vector<T> y = matvec(A, v);
+    const Eigen::Matrix<T, Eigen::Dynamic, 1> yRef = a * asEigen(x).transpose();
+    for (size_t i = 0; i < rows; ++i)
+        CHECK_NEAR(y(i), yRef(static_cast<Eigen::Index>(i)), tolerance<T>(cols));
+
+    for (size_t batch : { 1, 3, 5 }) {
+        const Matrix<T> X = randomMatrix<T>(batch, cols, rng);
+        const Matrix<T> Y = matvecBatched(A, X);
+        CHECK(Y.rows() == batch && Y.cols() == rows);
+        const RowMajor<T> ref = asEigen(X) * a.transpose();
+        for (size_t b = 0; b < batch; ++b)
+            for (size_t i = 0; i < rows; ++i)
+                CHECK_NEAR(Y(b, i), ref(static_cast<Eigen::Index>(b), static_cast<Eigen::Index>(i)),
+                           tolerance<T>(cols));
+    }
+
+    const Matrix<T> u = randomMatrix<T>(1, rows, rng);
+    Vector<T> w(rows);
+    std::copy_n(u.data(), rows, w.data());
+    const Vector<T> z = matvecTransposed(A, w);
+    CHECK(z.size() == cols);
+    const Eigen::Matrix<T, Eigen::Dynamic, 1> zRef = a.transpose() * asEigen(u).transpose();
+    for (size_t j = 0; j < cols; ++j)
+        CHECK_NEAR(z(j), zRef(static_cast<Eigen::Index>(j)), tolerance<T>(rows));
+}
+
+template<typename T>
+void testShapes() {
+    std::mt19937 rng(42);
+    for (size_t rows : { 1, 2, 3, 4, 5, 7, 13, 66 })
+        for (size_t cols : { 1, 5, 17, 100 })
+            testShape<T>(rows, cols, rng);
+    // Large enough for the threaded paths.
+    testShape<T>(603, 517, rng);
+}
+
+} // namespace
+
+int main() {
+    testShapes<float>();
+    testShapes<double>();
+    return testResult();
+}
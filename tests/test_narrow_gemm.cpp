@@ -0,0 +1,49 @@
+// The width-specialized gemmPackedNarrow kernels against gemmPacked: StaticDense swaps one
+// for the other, so they must agree bit for bit, bias and ReLU included. A single row or
+// column takes gemmPacked's matrix-vector paths instead and is not compared.
+#include <Eigen/Dense>
+#include <random>
+
+#include "backend.hpp"
+#include "check.hpp"
+
+namespace {
+
+template<typename T>
+void testWidths() {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    const OptimizedBackend<T> backend;
+    CHECK(backend.narrowGemmPacked(0) == nullptr);
+    CHECK(backend.narrowGemmPacked(dispatch::kNarrowWidths + 1) == nullptr);
+    for (size_t n = 2; n <= dispatch::kNarrowWidths; ++n)
+        for (size_t batch : { 2, 3, 17, 100 })
+            for (size_t k : { 1, 7, 64, 500 }) {
+                MatrixX<T> A(batch, k), B(k, n);
+                RowVectorX<T> bias(n);
+                for (Eigen::Index i = 0; i < A.size(); ++i)
+                    A.data()[i] = static_cast<T>(dist(rng));
+                for (Eigen::Index i = 0; i < B.size(); ++i)
+                    B.data()[i] = static_cast<T>(dist(rng));
+                for (Eigen::Index i = 0; i < bias.size(); ++i)
+                    bias(i) = static_cast<T>(dist(rng));
+                const PackedMatrix<T> packed(B);
+                const dispatch::NarrowGemm<T> narrow = backend.narrowGemmPacked(n);
+                CHECK(narrow != nullptr);
+                for (const GemmEpilogue<T> &epilogue : { GemmEpilogue<T>{}, GemmEpilogue<T>{ bias.data(), false },
+                                                         GemmEpilogue<T>{ bias.data(), true } }) {
+                    MatrixX<T> expected(batch, n), actual(batch, n);
+                    backend.gemmPacked(gemmOperand(A), packed.view(), expected.data(), 1, batch, T(1), T(0), epilogue);
+                    narrow(gemmOperand(A), packed.view(), actual.data(), batch, epilogue);
+                    CHECK(actual == expected);
+                }
+            }
+}
+
+} // namespace
+
+int main() {
+    testWidths<float>();
+    testWidths<double>();
+    return testResult();
+}
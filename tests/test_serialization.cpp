@@ -0,0 +1,109 @@
+// PackedMatrix and FrozenFullyConnected save/load round trips: the loaded copy matches the
+// original exactly and computes the same forward pass.
+#include <Eigen/Dense>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "check.hpp"
+#include "fullyconnected.hpp"
+
+namespace {
+
+template<typename T>
+Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> randomDense(size_t rows, size_t cols, std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> m(rows, cols);
+    for (Eigen::Index i = 0; i < m.size(); ++i)
+        m.data()[i] = static_cast<T>(dist(rng));
+    return m;
+}
+
+template<typename T>
+bool throwsOnLoad(const std::string& bytes) {
+    std::istringstream in(bytes);
+    try {
+        PackedMatrix<T>::load(in);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+template<typename T>
+void testPackedMatrix() {
+    std::mt19937 rng(3);
+    // Column counts below, at and past a panel width leave padding in the last panel.
+    for (size_t cols : { size_t(1), size_t(10), PackedMatrix<T>::kPanelWidth, PackedMatrix<T>::kPanelWidth + 3 })
+        for (size_t rows : { 1, 7, 65 }) {
+            const PackedMatrix<T> m(randomDense<T>(rows, cols, rng));
+            std::stringstream buffer;
+            m.save(buffer);
+            const PackedMatrix<T> loaded = PackedMatrix<T>::load(buffer);
+            CHECK(loaded.rows() == rows && loaded.cols() == cols);
+            CHECK(loaded.storageSize() == m.storageSize());
+            CHECK(std::equal(m.data(), m.data() + m.storageSize(), loaded.data()));
+        }
+
+    std::stringstream buffer;
+    PackedMatrix<T>(randomDense<T>(4, 5, rng)).save(buffer);
+    const std::string bytes = buffer.str();
+    CHECK(throwsOnLoad<T>(bytes.substr(0, bytes.size() - 1)));
+    CHECK(throwsOnLoad<T>(std::string(bytes.size(), 'x')));
+    // The header records the element size, so a double file is not read as float.
+    using Other = std::conditional_t<sizeof(T) == 4, double, float>;
+    CHECK(throwsOnLoad<Other>(bytes));
+}
+
+// A frozen layer and its reloaded copy give bit-identical outputs, dense and sparse input.
+template<typename T, typename S>
+void testFrozenLayer() {
+    std::mt19937 rng(5);
+    const size_t in = 37, out = 10, batch = 9;
+    const auto weights = randomDense<T>(in, out, rng);
+    const RowVectorX<T> bias = randomDense<T>(1, out, rng);
+    FrozenFullyConnected<T, S> layer(PackedMatrix<S>(weights.template cast<S>()), bias);
+
+    std::stringstream buffer;
+    layer.save(buffer);
+    FrozenFullyConnected<T, S> loaded = FrozenFullyConnected<T, S>::load(buffer);
+
+    MatrixX<T> input = randomDense<T>(batch, in, rng);
+    MatrixX<T> sparse = input;
+    for (Eigen::Index i = 0; i < sparse.size(); ++i)
+        if (i % 10 != 0)
+            sparse.data()[i] = T(0);
+
+    for (bool relu : { false, true }) {
+        // The ReLU flag is not stored and has to be set again after a load.
+        layer.setRelu(relu);
+        loaded.setRelu(relu);
+        for (bool sparseInput : { false, true }) {
+            layer.setSparseInput(sparseInput);
+            loaded.setSparseInput(sparseInput);
+            for (const MatrixX<T>* x : { &input, &sparse }) {
+                const MatrixX<T> expected = layer.forward(*x), actual = loaded.forward(*x);
+                CHECK(expected == actual);
+                // And both match the dense product with the stored weights.
+                MatrixX<T> reference = (*x * weights.template cast<S>().template cast<T>()).rowwise() + bias;
+                if (relu)
+                    reference = reference.cwiseMax(T(0));
+                CHECK_NEAR((expected - reference).cwiseAbs().maxCoeff(), 0.0, 1e-4);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    testPackedMatrix<float>();
+    testPackedMatrix<double>();
+    testFrozenLayer<float, float>();
+    testFrozenLayer<double, double>();
+    testFrozenLayer<float, Eigen::bfloat16>();
+    return testResult();
+}
@@ -0,0 +1,125 @@
+// CsrMatrix and BlockSparseMatrix products (spmv, spmvBatched, spmm) against a dense
+// reference, with ragged tiles, empty rows and thresholds.
+#include <Eigen/Dense>
+#include <random>
+
+#include "check.hpp"
+#include "sparse.hpp"
+
+namespace {
+
+template<typename T>
+using RowMajor = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+// About half the entries zero, whole rows zero where row % 5 == 2, and some entries of
+// magnitude below 0.1 for the threshold to drop.
+template<typename T>
+RowMajor<T> pruned(size_t rows, size_t cols, std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    RowMajor<T> m(rows, cols);
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j) {
+            const double v = dist(rng);
+            m(i, j) = static_cast<T>(i % 5 == 2 || std::abs(v) < 0.5 ? (std::abs(v) < 0.05 ? v : 0.0) : v);
+        }
+    return m;
+}
+
+template<typename T>
+RowMajor<T> dropped(RowMajor<T> m, T threshold) {
+    for (Eigen::Index i = 0; i < m.size(); ++i)
+        if (std::abs(m.data()[i]) <= threshold)
+            m.data()[i] = T(0);
+    return m;
+}
+
+template<typename T>
+double tolerance(size_t k) {
+    return (std::is_same_v<T, float> ? 1e-5 : 1e-12) * static_cast<double>(k + 1);
+}
+
+template<typename T>
+Matrix<T> toMatrix(const RowMajor<T>& m) {
+    Matrix<T> out(static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols()));
+    std::copy_n(m.data(), m.size(), out.data());
+    return out;
+}
+
+template<typename T, typename Sparse>
+void checkProducts(const Sparse& s, const RowMajor<T>& dense, std::mt19937& rng) {
+    const size_t rows = static_cast<size_t>(dense.rows()), cols = static_cast<size_t>(dense.cols());
+    CHECK(s.rows() == rows && s.cols() == cols);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+    Vector<T> x(cols);
+    for (size_t j = 0; j < cols; ++j)
+        x(j) = static_cast<T>(dist(rng));
+    const Vector<T> y = spmv(s, x);
+    const Eigen::Matrix<T, Eigen::Dynamic, 1> yRef =
+        dense * Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>(x.data(), static_cast<Eigen::Index>(cols));
+    for (size_t i = 0; i < rows; ++i)
+        CHECK_NEAR(y(i), yRef(static_cast<Eigen::Index>(i)), tolerance<T>(cols));
+
+    for (size_t batch : { 1, 2, 7 }) {
+        RowMajor<T> X(batch, cols);
+        for (Eigen::Index i = 0; i < X.size(); ++i)
+            X.data()[i] = static_cast<T>(dist(rng));
+        const RowMajor<T> ref = X * dense.transpose();
+        const Matrix<T> Y = spmvBatched(s, toMatrix<T>(X));
+        const RowMajor<T> Z = spmm<T>(X, s);
+        CHECK(Y.rows() == batch && Y.cols() == rows);
+        CHECK(static_cast<size_t>(Z.rows()) == batch && static_cast<size_t>(Z.cols()) == rows);
+        for (size_t b = 0; b < batch; ++b)
+            for (size_t i = 0; i < rows; ++i) {
+                const T r = ref(static_cast<Eigen::Index>(b), static_cast<Eigen::Index>(i));
+                CHECK_NEAR(Y(b, i), r, tolerance<T>(cols));
+                CHECK_NEAR(Z(static_cast<Eigen::Index>(b), static_cast<Eigen::Index>(i)), r, tolerance<T>(cols));
+            }
+    }
+}
+
+template<typename T>
+void testShapes() {
+    std::mt19937 rng(7);
+    // Rows and columns that do not fill the last 4-row tile or packet-wide tile column.
+    for (size_t rows : { 1, 3, 4, 9, 38 })
+        for (size_t cols : { 1, 5, 16, 33, 70 }) {
+            const RowMajor<T> dense = pruned<T>(rows, cols, rng);
+            checkProducts<T>(CsrMatrix<T>::fromDense(dense), dense, rng);
+            checkProducts<T>(BlockSparseMatrix<T>::fromDense(dense), dense, rng);
+            // A tile width that is not a packet multiple takes the scalar tile path.
+            checkProducts<T>(BlockSparseMatrix<T, 3>::fromDense(dense), dense, rng);
+
+            const T threshold = T(0.1);
+            const RowMajor<T> kept = dropped<T>(dense, threshold);
+            checkProducts<T>(CsrMatrix<T>::fromDense(dense, threshold), kept, rng);
+            checkProducts<T>(BlockSparseMatrix<T>::fromDense(dense, threshold), kept, rng);
+            CHECK(CsrMatrix<T>::fromDense(dense, threshold).toDense() == kept);
+        }
+
+    // Nothing kept at all, and a matrix large enough for the threaded paths.
+    const RowMajor<T> zero = RowMajor<T>::Zero(6, 10);
+    const BlockSparseMatrix<T> empty = BlockSparseMatrix<T>::fromDense(zero);
+    CHECK(empty.numBlocks() == 0);
+    checkProducts<T>(empty, zero, rng);
+    checkProducts<T>(CsrMatrix<T>::fromDense(zero), zero, rng);
+    const RowMajor<T> big = pruned<T>(1030, 700, rng);
+    checkProducts<T>(CsrMatrix<T>::fromDense(big), big, rng);
+    checkProducts<T>(BlockSparseMatrix<T>::fromDense(big), big, rng);
+
+    // Only tiles holding a kept entry are stored, zeros inside them included.
+    RowMajor<T> corner = RowMajor<T>::Zero(8, 40);
+    corner(5, 37) = T(2);
+    const BlockSparseMatrix<T> one = BlockSparseMatrix<T>::fromDense(corner);
+    CHECK(one.numBlocks() == 1);
+    CHECK(one.storedElements() == BlockSparseMatrix<T>::kBlockSize);
+    checkProducts<T>(one, corner, rng);
+}
+
+} // namespace
+
+int main() {
+    testShapes<float>();
+    testShapes<double>();
+    return testResult();
+}
@@ -0,0 +1,92 @@
+// Element-type conversion and affine int8 quantization round trips.
+#include <cmath>
+#include <cstdint>
+
+#include "check.hpp"
+#include "tensor_convert.hpp"
+
+namespace {
+
+// Values spanning several binades with both signs; n > kParallelThreshold in the large
+// case so the chunked path runs too.
+Tensor<double> ramp(size_t n) {
+    Tensor<double> t({ n });
+    for (size_t i = 0; i < n; ++i)
+        t.data()[i] = (i % 2 ? -1.0 : 1.0) * std::ldexp(1.0 + double(i % 97) / 97.0, int(i % 13) - 6);
+    return t;
+}
+
+// The 16-bit format keeps `bits` significant bits: round to nearest is within half an ulp.
+template<typename F>
+void testRoundTrip(size_t n, int bits) {
+    const Tensor<double> x = ramp(n);
+    const Tensor<F> narrow = convertTensor<F>(x);
+    const Tensor<double> back = convertTensor<double>(narrow);
+    CHECK(back.shape() == x.shape());
+    const double tol = std::ldexp(1.0, -bits);
+    for (size_t i = 0; i < n; ++i)
+        CHECK(std::abs(back.data()[i] - x.data()[i]) <= tol * std::abs(x.data()[i]));
+
+    // Values the format represents exactly come back unchanged.
+    Tensor<double> exact({ 5 });
+    const double values[] = { 0.0, 1.0, -2.0, 0.375, 96.0 };
+    std::copy_n(values, 5, exact.data());
+    const Tensor<double> same = convertTensor<double>(convertTensor<F>(exact));
+    for (size_t i = 0; i < 5; ++i)
+        CHECK(same.data()[i] == values[i]);
+}
+
+template<typename From>
+void testQuantize() {
+    // Relative rounding of From itself on the dequantized values.
+    const double rel = std::is_same_v<From, Eigen::bfloat16> ? std::ldexp(1.0, -8) : 1e-6;
+    // Asymmetric [-1, 3]: a nonzero zero point.
+    const QuantParams p = chooseQuantParams(-1.0, 3.0);
+    CHECK_NEAR(p.scale, 4.0 / 255.0, 1e-7);
+    CHECK(p.zeroPoint == -64);
+
+    const size_t n = 1000;
+    Tensor<From> x({ n });
+    for (size_t i = 0; i < n; ++i)
+        x.data()[i] = static_cast<From>(-1.0 + 4.0 * double(i) / double(n - 1));
+    const Tensor<int8_t> q = quantizeTensor(x, p);
+    const Tensor<From> back = dequantizeTensor<From>(q, p);
+    for (size_t i = 0; i < n; ++i)
+        CHECK(std::abs(double(back.data()[i]) - double(x.data()[i])) <= 0.5 * p.scale + 3.0 * rel);
+
+    // Zero is exact, and values outside the range saturate instead of wrapping.
+    Tensor<From> edge({ 40 });
+    for (size_t i = 0; i < 40; ++i)
+        edge.data()[i] = static_cast<From>(i % 4 == 0 ? 0.0 : i % 4 == 1 ? 10.0 : i % 4 == 2 ? -10.0 : 1e6);
+    const Tensor<int8_t> qe = quantizeTensor(edge, p);
+    const Tensor<From> be = dequantizeTensor<From>(qe, p);
+    for (size_t i = 0; i < 40; ++i) {
+        const int expected = i % 4 == 0 ? p.zeroPoint : i % 4 == 2 ? -128 : 127;
+        CHECK(qe.data()[i] == expected);
+    }
+    CHECK(double(be.data()[0]) == 0.0);
+    CHECK_NEAR(double(be.data()[1]), p.scale * (127 - p.zeroPoint), 3.0 * rel);
+    CHECK_NEAR(double(be.data()[2]), p.scale * (-128 - p.zeroPoint), 3.0 * rel);
+
+    // Symmetric: zero point 0 and the largest magnitude maps to +-127.
+    const QuantParams s = chooseQuantParams(-2.0, 0.5, true);
+    CHECK(s.zeroPoint == 0);
+    Tensor<From> ends({ 2 });
+    ends.data()[0] = From(-2.0);
+    ends.data()[1] = From(2.0);
+    const Tensor<int8_t> qs = quantizeTensor(ends, s);
+    CHECK(qs.data()[0] == -127 && qs.data()[1] == 127);
+}
+
+} // namespace
+
+int main() {
+    testRoundTrip<Eigen::bfloat16>(1000, 8);
+    testRoundTrip<Eigen::bfloat16>(200000, 8);
+    testRoundTrip<Eigen::half>(1000, 11);
+    testRoundTrip<Eigen::half>(200000, 11);
+    testQuantize<float>();
+    testQuantize<double>();
+    testQuantize<Eigen::bfloat16>();
+    return testResult();
+}
@@ -0,0 +1,99 @@
+// Reductions on integer and bf16 tensors, which accumulate in a wider type, against
+// exact sums; the large tensors take the chunked parallel path.
+#include <cstdint>
+
+#include "check.hpp"
+#include "tensor_reductions.hpp"
+
+namespace {
+
+template<typename T>
+Tensor<T> filled(const std::vector<size_t>& shape, T (*value)(size_t)) {
+    Tensor<T> t(shape);
+    for (size_t i = 0; i < t.numElements(); ++i)
+        t.data()[i] = value(i);
+    return t;
+}
+
+void testInt8() {
+    // Every third element is -128, the others 127.
+    auto value = [](size_t i) { return static_cast<int8_t>(i % 3 == 0 ? -128 : 127); };
+    const Tensor<int8_t> t = filled<int8_t>({ 1000, 100 }, value);
+    const int64_t low = 33334, high = 66666;
+    CHECK(sum(t) == high * 127 - low * 128);
+    CHECK(norm1(t) == high * 127 + low * 128);
+    CHECK(norm2(t) == static_cast<int64_t>(std::sqrt(double(high * 127 * 127 + low * 128 * 128))));
+    CHECK(normInf(t) == 128);
+
+    const Tensor<int8_t> ones({ 1000, 100 }, int8_t(1));
+    CHECK(norm2(ones) == 316);
+    const Tensor<int8_t> low1({ 1 }, int8_t(-128));
+    CHECK(normInf(low1) == 128);
+
+    // Both axis paths: contiguous rows (inner == 1) and strided columns.
+    const Tensor<int8_t> square({ 100, 100 }, int8_t(100));
+    const Tensor<int64_t> cols = sum(square, 0), rows = sum(square, 1);
+    CHECK(cols.numElements() == 100 && rows.numElements() == 100);
+    for (size_t j = 0; j < 100; ++j) {
+        CHECK(cols.data()[j] == 10000);
+        CHECK(rows.data()[j] == 10000);
+    }
+
+    Tensor<int8_t> a({ 2 }), b({ 2 });
+    a.data()[0] = 127;
+    b.data()[0] = -128;
+    CHECK(maxAbsDiff(a, b) == 255);
+}
+
+void testUnsigned() {
+    Tensor<uint8_t> a({ 3 }), b({ 3 });
+    b.data()[1] = 1;
+    CHECK(maxAbsDiff(a, b) == 1);
+    CHECK(maxAbsDiff(b, a) == 1);
+
+    const Tensor<uint8_t> t({ 300000 }, uint8_t(255));
+    CHECK(sum(t) == 255u * 300000u);
+    CHECK(norm1(t) == 255u * 300000u);
+    CHECK(normInf(t) == 255u);
+    CHECK(norm2(t) == static_cast<uint64_t>(std::sqrt(255.0 * 255.0 * 300000.0)));
+    const Tensor<uint64_t> cols = sum(Tensor<uint8_t>({ 1000, 3 }, uint8_t(200)), 0);
+    CHECK(cols.data()[2] == 200000u);
+}
+
+void testBf16() {
+    // bf16 has 8 significant bits: summing in bf16 would stop at 256.
+    const Tensor<Eigen::bfloat16> ones({ 100000 }, Eigen::bfloat16(1.0f));
+    CHECK(sum(ones) == 100000.0);
+    CHECK(norm1(ones) == 100000.0);
+    CHECK_NEAR(norm2(ones), std::sqrt(100000.0), 1e-9);
+    CHECK(normInf(Tensor<Eigen::bfloat16>({ 4 }, Eigen::bfloat16(-3.0f))) == 3.0);
+    const Tensor<double> cols = sum(Tensor<Eigen::bfloat16>({ 1000, 2 }, Eigen::bfloat16(0.5f)), 0);
+    CHECK(cols.data()[0] == 500.0 && cols.data()[1] == 500.0);
+
+    Tensor<Eigen::half> x({ 2 }), y({ 2 });
+    x.data()[1] = Eigen::half(2.0f);
+    y.data()[1] = Eigen::half(-1.5f);
+    CHECK(maxAbsDiff(x, y) == 3.5);
+}
+
+void testDouble() {
+    auto value = [](size_t i) { return i % 2 ? -0.5 : 1.0; };
+    const Tensor<double> t = filled<double>({ 4, 3 }, value);
+    CHECK_NEAR(sum(t), 3.0, 1e-12);
+    CHECK_NEAR(norm1(t), 9.0, 1e-12);
+    CHECK_NEAR(norm2(t), std::sqrt(7.5), 1e-12);
+    CHECK(normInf(t) == 1.0);
+    const Tensor<double> rows = sum(t, 1);
+    CHECK_NEAR(rows.data()[0], 1.5, 1e-12);
+    CHECK_NEAR(rows.data()[1], 0.0, 1e-12);
+}
+
+} // namespace
+
+int main() {
+    testInt8();
+    testUnsigned();
+    testBf16();
+    testDouble();
+    return testResult();
+}